@@ -39,6 +39,7 @@ __BEGIN_DECLS
 typedef void* bing_result_t;
 typedef void* bing_response_t;
 typedef void* bing_request_t;
+typedef void* bing_transfer_t;
 
 typedef void* data_dictionary_t;
 
@@ -51,6 +52,73 @@ typedef struct _bing_thumbnail
 	long long file_size;
 } bing_thumbnail_s, *bing_thumbnail_t;
 
+typedef struct _bing_string_pool_stats
+{
+	unsigned int lookups;
+	unsigned int unique_strings;
+	size_t requested_bytes;
+	size_t stored_bytes;
+	double dedupe_ratio;
+} bing_string_pool_stats_s, *bing_string_pool_stats_t;
+
+typedef struct _bing_prefetch_stats
+{
+	unsigned int prefetches;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int discarded;
+	double hit_rate;
+} bing_prefetch_stats_s, *bing_prefetch_stats_t;
+
+typedef struct _bing_hedging_stats
+{
+	unsigned int searches;
+	unsigned int hedges;
+	unsigned int wins;
+	unsigned int delay;
+} bing_hedging_stats_s, *bing_hedging_stats_t;
+
+typedef struct _bing_rate_limit_stats
+{
+	unsigned int requests;
+	unsigned int delayed;
+	unsigned int rejected;
+	unsigned int max_wait;
+	double average_wait;
+	double tokens;
+} bing_rate_limit_stats_s, *bing_rate_limit_stats_t;
+
+typedef struct _bing_body_cache_stats
+{
+	unsigned int bodies;
+	size_t body_bytes;
+	size_t hit_bytes;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+	unsigned int expirations;
+	unsigned int stale_hits;
+	unsigned int refreshes;
+	unsigned int revalidations;
+	double hit_rate;
+} bing_body_cache_stats_s, *bing_body_cache_stats_t;
+
+typedef struct _bing_transfer_stats
+{
+	size_t wire_bytes;
+	size_t decoded_bytes;
+	double compression_ratio;
+	unsigned int attempts;
+} bing_transfer_stats_s, *bing_transfer_stats_t;
+
+typedef struct _bing_capture_stats
+{
+	unsigned int records;
+	unsigned int recorded;
+	unsigned int replayed;
+	unsigned int misses;
+} bing_capture_stats_s, *bing_capture_stats_t;
+
 enum BING_SOURCE_TYPE
 {
 	BING_SOURCETYPE_UNKNOWN,
@@ -80,6 +148,42 @@ enum BING_SOURCE_TYPE
 	BING_SOURCETYPE_TOTAL_COUNT = BING_RESULT_TYPE
 };
 
+enum BING_EVENT_CODE
+{
+	//A search completed, the response is retrieved with bing_event_get_response
+	BING_EVENT_RESPONSE,
+
+	//A search didn't complete before it ran out of time (see bing_set_timeout), there is no response
+	BING_EVENT_TIMED_OUT,
+
+	//A search couldn't be made because the account key ran out of transactions (see bing_set_rate_limit), there is no response
+	BING_EVENT_RATE_LIMITED
+};
+
+enum BING_CAPTURE_MODE
+{
+	//Searches use the network
+	BING_CAPTURE_OFF,
+
+	//Searches use the network, and the responses are written to a capture file
+	BING_CAPTURE_RECORD,
+
+	//Searches are given the responses in a capture file, instead of using the network
+	BING_CAPTURE_REPLAY
+};
+
+enum BING_TRANSPORT
+{
+	//Requests are made with cURL
+	BING_TRANSPORT_CURL,
+
+	//Requests are given the responses added with bing_memory_transport_add, without using the network
+	BING_TRANSPORT_MEMORY,
+
+	//Requests are made by the functions of a bing_transport_s
+	BING_TRANSPORT_CUSTOM
+};
+
 #define BING_RESULT_TYPE_FIELD "bb_result-type"
 
 /*
@@ -87,11 +191,21 @@ enum BING_SOURCE_TYPE
  */
 
 typedef void (*receive_bing_response_func) (bing_response_t response, const void* user_data);
+typedef void (*receive_bing_result_func) (bing_result_t result, const void* user_data);
 typedef const char* (*request_get_options_func)(bing_request_t request);
 typedef void (*request_finish_get_options_func)(bing_request_t request, const char* options);
 typedef int (*response_creation_func)(const char* name, bing_response_t response, data_dictionary_t dictionary);
 typedef int (*result_creation_func)(const char* name, bing_result_t result, data_dictionary_t dictionary);
 typedef void (*result_additional_result_func)(const char* name, bing_result_t result, bing_result_t new_result, int* keepResult);
+typedef int (*transport_start_func)(bing_transfer_t transfer, const char* url, const char* account_key, void* transport_data);
+typedef void (*transport_cancel_func)(bing_transfer_t transfer, void* transport_data);
+
+typedef struct _bing_transport
+{
+	transport_start_func start;
+	transport_cancel_func cancel;
+	void* data;
+} bing_transport_s, *bing_transport_t;
 
 /*
  * Dictionary functions
@@ -148,6 +262,10 @@ int bing_get_domain();
  * The event does not free the Bing response unless it is never retrieved.
  * If it was retrieved, then it is up to the developer to free it.
  *
+ * The code of the event is a BING_EVENT_CODE. Events with the code
+ * BING_EVENT_TIMED_OUT or BING_EVENT_RATE_LIMITED have no response, so it is
+ * set to NULL.
+ *
  * @param event The event to retrieve the response from.
  * @param response A pointer to a Bing response which will store the
  * 	actual response that can be used.
@@ -266,6 +384,8 @@ void bing_free(unsigned int bing);
  * 46. Some other server response that resulted in the query not being able to complete successfully (networking)
  * 47. Everything broke. We made a search, but the search failed and didn't return any data. Then when we went to find the error, that failed too (everything...)
  * 48. When attempting to setup to perform additional parsing operations, such as translation, the setup process failed.
+ * 49. The search didn't complete before it ran out of time (search)
+ * 50. The search couldn't be made, the account key ran out of transactions (search)
  *
  * @return A integer defining the last error code to have occurred after a search.
  */
@@ -306,6 +426,553 @@ int bing_get_account_key(unsigned int bing, char* buffer);
  */
 int bing_set_account_key(unsigned int bing, const char* account_key);
 
+/**
+ * @brief Set how much a streamed search can hold before it stops receiving data.
+ *
+ * The @c bing_set_stream_budget() function allows developers to limit how many
+ * results, and how much of the downloaded feed, can be delivered by
+ * bing_search_stream_async but not yet released with bing_result_stream_release.
+ * When either limit is reached, the download is paused until enough results
+ * are released. This keeps memory usage bounded regardless of how large the
+ * response is. The limits are checked as data arrives, so they can be exceeded
+ * by the results contained in one block of received data. The budget applies to searches started after this is called.
+ *
+ * @param bing The unique Bing ID to set the budget for.
+ * @param max_pending_bytes The number of downloaded bytes that unreleased
+ * 	results can represent. Zero means unlimited.
+ * @param max_pending_results The number of results that can be unreleased.
+ * 	Zero means unlimited.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_stream_budget(unsigned int bing, size_t max_pending_bytes, unsigned int max_pending_results);
+
+/**
+ * @brief Set how far ahead the next pages of results are searched for.
+ *
+ * The @c bing_set_prefetch() function allows developers to have the next page
+ * of a response searched for in the background, as soon as the response is
+ * received. If bing_search_next_sync, bing_search_next_async, or
+ * bing_search_event_next_async is then called for that response, the prefetched
+ * response is returned without waiting for a search. Prefetched responses belong
+ * to the Bing instance until they are returned. Prefetching is off by default.
+ *
+ * @param bing The unique Bing ID to set prefetching for.
+ * @param depth How many pages ahead of the last response to prefetch. Zero
+ * 	turns prefetching off.
+ * @param max_bytes The amount of downloaded data that prefetched responses,
+ * 	waiting to be returned, can represent. The oldest are discarded to stay
+ * 	within it. Zero means unlimited.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_prefetch(unsigned int bing, unsigned int depth, size_t max_bytes);
+
+/**
+ * @brief Get the prefetch statistics of a Bing service.
+ *
+ * The @c bing_get_prefetch_stats() function allows developers to see how often
+ * requests for the next page were answered by a prefetched response. A request
+ * made while the prefetch is still running counts as a miss.
+ *
+ * @param bing The unique Bing ID to get the statistics of.
+ * @param stats The statistics structure to copy the statistics into. The
+ * 	hit_rate is hits divided by hits plus misses.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if stats is NULL.
+ */
+int bing_get_prefetch_stats(unsigned int bing, bing_prefetch_stats_t stats);
+
+/**
+ * @brief Set if searches should use HTTP/2.
+ *
+ * The @c bing_set_http2() function allows developers to have searches request
+ * HTTP/2. Asynchronous searches that are running at the same time then share
+ * connections, each search being a separate stream on the connection, instead
+ * of each search opening a connection of its own. If the server or the version
+ * of cURL doesn't support HTTP/2, HTTP/1.1 is used. This is off by default and
+ * applies to searches started after this is called.
+ *
+ * @param bing The unique Bing ID to set HTTP/2 use for.
+ * @param enable A non-zero value to use HTTP/2, zero to use HTTP/1.1.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_http2(unsigned int bing, int enable);
+
+/**
+ * @brief Set how long searches have to complete.
+ *
+ * The @c bing_set_timeout() function allows developers to limit how long a
+ * search can take, so a server or connection that stops responding can't hold
+ * up a search (or the thread waiting on it) forever. The time starts when the
+ * search is made, and covers connecting, receiving and parsing the response,
+ * and any retries (see bing_set_retry) and hedges (see bing_set_hedging). A
+ * retry or hedge that couldn't be made in the time that is left isn't made.
+ * A search that joined an identical search that was already running has the
+ * time of the search it joined. A streamed search (see bing_search_stream_async)
+ * can run out of time while it's paused waiting for results to be released.
+ *
+ * A search that runs out of time fails with errno set to ETIMEDOUT. For
+ * synchronous searches, NULL is returned. For asynchronous searches, the
+ * response function is called with a NULL response, and errno is set on the
+ * thread calling it. For event searches, an event with the code
+ * BING_EVENT_TIMED_OUT is delegated instead of a response. There is no limit
+ * by default, this applies to searches started after this is called.
+ *
+ * @param bing The unique Bing ID to set the time limit for.
+ * @param timeout The time, in milliseconds, that searches have to complete.
+ * 	Zero means there is no limit.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_timeout(unsigned int bing, unsigned int timeout);
+
+/**
+ * @brief Get how well asynchronous searches are sharing connections.
+ *
+ * The @c bing_get_connection_stats() function allows developers to see how
+ * many connections asynchronous searches needed. Dividing the number of
+ * searches by the number of connections gives the streams per connection.
+ * These cover every asynchronous search made by the application.
+ *
+ * @param searches A pointer to be set to the number of transfers completed.
+ * 	If NULL, it is ignored.
+ * @param connections A pointer to be set to the number of new connections
+ * 	those transfers opened. If NULL, it is ignored.
+ * @param multiplexed A pointer to be set to the number of transfers that
+ * 	were made over HTTP/2. If NULL, it is ignored.
+ */
+void bing_get_connection_stats(unsigned int* searches, unsigned int* connections, unsigned int* multiplexed);
+
+/**
+ * @brief Set how searches that fail are retried.
+ *
+ * The @c bing_set_retry() function allows developers to have searches that
+ * fail in a way that could go away on its own retried. This covers not being
+ * able to connect, timeouts, the connection failing before anything was
+ * received, and the server responding that it had a problem (5xx) or is
+ * getting too many requests (429). Other failures, such as the response not
+ * being parsable or the request being rejected (4xx), aren't retried. A search
+ * that already started receiving its response isn't retried. Each retry waits
+ * a random amount of time that grows with each attempt, so searches that fail
+ * at the same time don't all retry at the same time. Retrying is off by
+ * default, and applies to searches started after this is called.
+ *
+ * @param bing The unique Bing ID to set retrying for.
+ * @param max_attempts The most times a search is requested, including the
+ * 	first. Zero or one turns retrying off.
+ * @param base_delay The shortest time, in milliseconds, to wait before a retry.
+ * @param max_delay The longest time, in milliseconds, to wait before a retry.
+ * 	Zero means there is no limit.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_retry(unsigned int bing, unsigned int max_attempts, unsigned int base_delay, unsigned int max_delay);
+
+/**
+ * @brief Set if slow searches should be made a second time.
+ *
+ * The @c bing_set_hedging() function allows developers to cut down on searches
+ * that take much longer then usual. How long searches take to start receiving
+ * a response is kept track of, and if a search hasn't received anything after
+ * the percentile of that time, the same search is made again on another
+ * connection. Whichever of the two starts receiving first is used, and the
+ * other is cancelled. No search is hedged until enough searches have been
+ * timed. Searches with additional URLs aren't hedged. Synchronous searches are
+ * run on the network engine while this is on. This is off by default and
+ * applies to searches started after this is called.
+ *
+ * @param bing The unique Bing ID to set hedging for.
+ * @param percentile The percentile (1 to 100) of how long recent searches took
+ * 	to start receiving, that a search waits before it is hedged. Zero turns
+ * 	hedging off.
+ * @param max_fraction The most searches that can be hedged, as a fraction of
+ * 	all the searches made (0.05 is one in twenty), so hedging doesn't use up
+ * 	the account's quota.
+ *
+ * @return A boolean value which is non-zero if hedging was set, otherwise zero
+ * 	if the Bing ID, percentile, or fraction is not valid.
+ */
+int bing_set_hedging(unsigned int bing, unsigned int percentile, double max_fraction);
+
+/**
+ * @brief Get the hedging statistics of a Bing service.
+ *
+ * The @c bing_get_hedging_stats() function allows developers to see how often
+ * searches were hedged, and how often the hedge was faster.
+ *
+ * @param bing The unique Bing ID to get the statistics of.
+ * @param stats The statistics structure to copy the statistics into. Searches
+ * 	are the searches made while hedging was on, hedges are the searches made a
+ * 	second time, and wins are the hedges that started receiving first. The
+ * 	delay is how long (in milliseconds) a search currently waits before it's
+ * 	hedged, zero if not enough searches have been timed.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if stats is NULL.
+ */
+int bing_get_hedging_stats(unsigned int bing, bing_hedging_stats_t stats);
+
+/**
+ * @brief Get how many asynchronous searches shared another search's transfer.
+ *
+ * The @c bing_get_coalesced_search_count() function allows developers to see
+ * how many asynchronous searches joined an identical search that was already
+ * running, instead of downloading the same thing again. This covers every
+ * asynchronous search made by the application.
+ *
+ * @return The number of searches that joined another search.
+ */
+unsigned int bing_get_coalesced_search_count();
+
+/**
+ * @brief Limit how many requests are made with each account key.
+ *
+ * The @c bing_set_rate_limit() function allows developers to keep searches
+ * within the transaction limits of their account keys, instead of the server
+ * rejecting the searches that go over. Each account key has a bucket of
+ * tokens, shared by every Bing instance using the account key. Every request
+ * takes a token (including retries, hedges, and each URL of a search with
+ * additional URLs), and tokens are added at a steady rate up to the burst.
+ * Searches that are cached, or that joined an identical search, don't take a
+ * token.
+ *
+ * When an account key is out of tokens, requests either wait for a token
+ * (synchronous searches wait on the calling thread, asynchronous searches
+ * wait without holding up other searches) or fail right away. A search that
+ * fails because of this fails with errno set to EAGAIN: a synchronous search
+ * returns NULL, an asynchronous search either doesn't start (the search
+ * function returns zero) or calls the response function with a NULL response,
+ * and an event search delegates an event with the code BING_EVENT_RATE_LIMITED.
+ * A wait that would go past a search's time limit (see bing_set_timeout) isn't
+ * made, the search times out instead. Hedges are never waited for.
+ *
+ * There is no limit by default. Setting the limit refills every bucket. Once
+ * every Bing instance using an account key is freed, the bucket (and the
+ * statistics) of the account key are removed, and it starts full again if the
+ * account key is used again.
+ *
+ * @param rate The tokens added each second. Zero means there is no limit.
+ * @param burst The most tokens a bucket can hold, which is the most requests
+ * 	that can be made at once. Zero is treated as one.
+ * @param queue A non-zero value to have requests wait for a token, zero to
+ * 	have them fail.
+ *
+ * @return A boolean value which is non-zero if the limit was set, otherwise
+ * 	zero if the rate is negative.
+ */
+int bing_set_rate_limit(double rate, unsigned int burst, int queue);
+
+/**
+ * @brief Get the rate limit statistics of an account key.
+ *
+ * The @c bing_get_rate_limit_stats() function allows developers to see how the
+ * rate limit is affecting searches made with the account key of a Bing
+ * instance. The statistics are for the account key, so they include every
+ * Bing instance using it, and start over when bing_set_rate_limit is called.
+ *
+ * @param bing The unique Bing ID whose account key the statistics are for.
+ * @param stats The statistics structure to copy the statistics into. Requests
+ * 	are the requests that were given a token, delayed are the requests that
+ * 	had to wait for their token, and rejected are the requests that weren't
+ * 	made. The wait times are in milliseconds, for the delayed requests. Tokens
+ * 	are the tokens available right now, which is below zero if requests are
+ * 	waiting.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if stats is NULL.
+ */
+int bing_get_rate_limit_stats(unsigned int bing, bing_rate_limit_stats_t stats);
+
+/**
+ * @brief Set up the body cache.
+ *
+ * The @c bing_set_body_cache() function allows developers to have the raw
+ * bodies received for searches kept, so running the same search again (same
+ * URL and account key) doesn't download the body again. Parsed responses are
+ * not cached: the cached body is parsed for every hit, like a body that was
+ * just downloaded, and each search gets a response of its own (and any
+ * creation functions for custom types are called again). The response is
+ * freed with bing_response_free like any other. This saves the network time
+ * but not the parse time, which for a 200 result response is a few
+ * milliseconds.
+ * The cache is shared by every Bing instance and is off by default. Only
+ * searches with a single URL that aren't streamed are cached.
+ *
+ * If the server sent an ETag or Last-Modified header with a body, the body is
+ * kept after it expires. The next search for it asks the server if it changed
+ * (If-None-Match/If-Modified-Since), and if it hasn't, the cached body is used
+ * for another TTL instead of being downloaded again.
+ *
+ * @param ttl How long, in seconds, a cached body can be used for. Zero turns
+ * 	caching off. Source types can have a TTL of their own, see
+ * 	bing_set_body_cache_ttl.
+ * @param max_bytes The size of the bodies the cache can hold. The least
+ * 	recently used bodies are evicted to stay within it. Zero turns caching
+ * 	off.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed.
+ */
+int bing_set_body_cache(unsigned int ttl, size_t max_bytes);
+
+/**
+ * @brief Set how long cached bodies are used for, for a source type.
+ *
+ * The @c bing_set_body_cache_ttl() function allows developers to have cached
+ * bodies for a source type be used after they're stale. Once the soft TTL
+ * passes, the cached body is still used, but one search is started in the
+ * background to refresh it (searches that find the same stale body don't start
+ * another refresh). Once the hard TTL passes, the cached body isn't used and
+ * the search is made like normal. The source type is the type of the response,
+ * so composite responses use BING_SOURCETYPE_COMPOSITE. Caching needs to be
+ * turned on with bing_set_body_cache.
+ *
+ * @param source_type The source type to set the TTL of.
+ * @param soft_ttl How long, in seconds, a cached body is used before it is
+ * 	refreshed. If larger then hard_ttl, it is the same as hard_ttl.
+ * @param hard_ttl How long, in seconds, a cached body can be used for. Zero
+ * 	means the source type uses the TTL set with bing_set_body_cache (and is never
+ * 	stale).
+ *
+ * @return A boolean value which is non-zero if the TTL was set, otherwise zero
+ * 	if the source type is not valid.
+ */
+int bing_set_body_cache_ttl(enum BING_SOURCE_TYPE source_type, unsigned int soft_ttl, unsigned int hard_ttl);
+
+/**
+ * @brief Keep the body cache in a file.
+ *
+ * The @c bing_set_body_cache_file() function allows developers to have the body
+ * cache last between runs of the application. Bodies are written to the file as
+ * they're cached, and the file is read (only what is needed to find the cached
+ * bodies, a body itself is read when it's used) the first time the cache is
+ * used after this is called. A search that is cached doesn't need a network
+ * connection. The file is compacted as it fills with bodies that are no longer
+ * used. Only one application should use a cache file at a time. Caching still
+ * needs to be turned on with bing_set_body_cache.
+ *
+ * Account keys are not written to the file, only a hash of them.
+ *
+ * @param path The path of the cache file. It is created if it doesn't exist. If
+ * 	NULL, the cache stops using a file (anything cached only in the file is no
+ * 	longer cached).
+ *
+ * @return A boolean value which is non-zero if the cache file is being used, or
+ * 	path is NULL. Zero if the file could not be opened or created, or is not a
+ * 	cache file. A cache file written by a different version of the library is
+ * 	not used (or changed), zero is returned for it too.
+ */
+int bing_set_body_cache_file(const char* path);
+
+/**
+ * @brief Get the statistics of the body cache.
+ *
+ * The @c bing_get_body_cache_stats() function allows developers to see how well
+ * the body cache is working. Misses are only counted while caching is on.
+ *
+ * @param stats The statistics structure to copy the statistics into. Bodies
+ * 	and body_bytes are what the cache holds now. Hit_bytes are the bodies
+ * 	given to searches instead of being downloaded (hits and revalidations),
+ * 	which were still parsed. The hit_rate is hits divided by hits plus misses.
+ * 	Evictions are bodies removed to make room, expirations are bodies found to
+ * 	be too old to use. Stale hits are hits on bodies past their soft TTL,
+ * 	refreshes are the searches made to replace them. Revalidations are cached
+ * 	bodies the server said hadn't changed.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if stats is NULL.
+ */
+int bing_get_body_cache_stats(bing_body_cache_stats_t stats);
+
+/**
+ * @brief Record responses to a file, or replay them from one.
+ *
+ * The @c bing_set_capture() function allows developers to record the responses
+ * searches receive, then replay them later without a network connection. While
+ * recording, the response each request receives (the HTTP status, headers, and
+ * body, and how long it took to start and to finish) is added to the end of the
+ * capture file. Only responses that were received completely are recorded.
+ *
+ * While replaying, no requests are made. Each request is given a recorded
+ * response for its URL, after the time the response originally took multiplied
+ * by the time scale, so searches behave as they did when recorded (retries,
+ * the rate limit, time limits, the cache, coalescing, prefetching, and
+ * streaming all work the same). A URL recorded more then once gets its
+ * responses in the order they were recorded, starting over after the last. A
+ * request for a URL that wasn't recorded fails, as if the server didn't have
+ * it. Searches aren't hedged while replaying.
+ *
+ * Account keys are not written to the file. The mode applies to searches made
+ * after it is set.
+ *
+ * @param path The path of the capture file. When recording, it is created if
+ * 	it doesn't exist. Ignored if mode is BING_CAPTURE_OFF.
+ * @param mode What to do with the capture file.
+ * @param time_scale What the recorded times are multiplied by when replaying.
+ * 	One replays responses with the time they took, zero replays them right away.
+ *
+ * @return A boolean value which is non-zero if the mode was set, otherwise zero
+ * 	if the file could not be opened or created, is not a capture file, or
+ * 	time_scale is negative. Capture is off if it wasn't set.
+ */
+int bing_set_capture(const char* path, enum BING_CAPTURE_MODE mode, double time_scale);
+
+/**
+ * @brief Get the statistics of recording or replaying responses.
+ *
+ * The @c bing_get_capture_stats() function allows developers to see what
+ * capture has done since bing_set_capture was called.
+ *
+ * @param stats The statistics structure to copy the statistics into. Records
+ * 	are the responses read from the capture file to replay, recorded are the
+ * 	responses written to it. Replayed are the requests given a recorded
+ * 	response, misses are the requests for a URL that wasn't recorded.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero if stats is NULL.
+ */
+int bing_get_capture_stats(bing_capture_stats_t stats);
+
+/**
+ * @brief Set what makes the requests of searches.
+ *
+ * The @c bing_set_transport() function allows developers to replace cURL,
+ * which makes the requests of searches by default. Everything else a search
+ * does (parsing, streaming, retries, the rate limit, time limits, the cache,
+ * coalescing, prefetching, and recording responses) works the same with any
+ * transport. Searches are only hedged when cURL is used.
+ *
+ * The memory transport gives each request the response added for its URL
+ * with bing_memory_transport_add, right away, so searches can be run without
+ * a network connection or any waiting (such as to measure parsing). A request
+ * for a URL without a response fails, as if the server didn't have it.
+ *
+ * A custom transport is given each request with the start function. The start
+ * function should make the request (with HTTP basic authentication, an empty
+ * user name and the account key as the password) and return right away,
+ * returning non-zero if the request is being made. As the response is received,
+ * the transport gives it to the search with bing_transfer_header and
+ * bing_transfer_data, then calls bing_transfer_complete, on any thread (but
+ * only one thread at a time for a request). If the request is cancelled (see
+ * bing_search_cancel), the cancel function is called, and the transport
+ * should stop and call bing_transfer_complete. Cancel can be called for a
+ * request that was just completed on another thread, which should be ignored.
+ * The transfer can't be used once bing_transfer_complete is called.
+ *
+ * The transport applies to searches made after it is set. A replayed search
+ * (see bing_set_capture) doesn't use a transport.
+ *
+ * @param type What makes the requests.
+ * @param custom The functions of the custom transport, which are copied. The
+ * 	start function is required, cancel can be NULL. Data is given to both of
+ * 	them. Ignored unless type is BING_TRANSPORT_CUSTOM.
+ *
+ * @return A boolean value which is non-zero if the transport was set, otherwise
+ * 	zero if type is BING_TRANSPORT_CUSTOM and custom, or its start function,
+ * 	is NULL.
+ */
+int bing_set_transport(enum BING_TRANSPORT type, const bing_transport_t custom);
+
+/**
+ * @brief Give a header of a response to a search.
+ *
+ * The @c bing_transfer_header() function allows a custom transport to give a
+ * search the headers of a response, one line at a time starting with the
+ * status line (such as "HTTP/1.1 200 OK"), in the order they were received.
+ *
+ * @param transfer The transfer the response is for.
+ * @param header The header line. It doesn't need to be null terminated.
+ * @param size The size of the header line.
+ *
+ * @return A boolean value which is non-zero if the header was taken, otherwise
+ * 	zero on error.
+ */
+int bing_transfer_header(bing_transfer_t transfer, const char* header, size_t size);
+
+/**
+ * @brief Give part of the body of a response to a search.
+ *
+ * The @c bing_transfer_data() function allows a custom transport to give a
+ * search the body of a response, in order, as it's received. The body needs
+ * to be decompressed (if the transport asked for a compressed response).
+ *
+ * @param transfer The transfer the response is for.
+ * @param data The data that was received.
+ * @param size The size of the data.
+ *
+ * @return One if the data was taken. Negative one if the search is streaming
+ * 	results and too many are waiting to be released: the data wasn't taken,
+ * 	and should be given again later. Zero if the transfer should be stopped
+ * 	(an error occurred, or enough results were received): the transport should
+ * 	call bing_transfer_complete.
+ */
+int bing_transfer_data(bing_transfer_t transfer, const char* data, size_t size);
+
+/**
+ * @brief Finish a transfer.
+ *
+ * The @c bing_transfer_complete() function allows a custom transport to tell a
+ * search that a request it made is done. It's called once for every request
+ * the start function returned non-zero for.
+ *
+ * @param transfer The transfer that is done.
+ * @param error Zero if the whole response was received (even if it's an HTTP
+ * 	error), otherwise non-zero if the request failed (such as not being able
+ * 	to connect, or the connection being lost), which can be retried (see
+ * 	bing_set_retry).
+ *
+ * @return A boolean value which is non-zero if the transfer was completed,
+ * 	otherwise zero on error.
+ */
+int bing_transfer_complete(bing_transfer_t transfer, int error);
+
+/**
+ * @brief Add a response to the memory transport.
+ *
+ * The @c bing_memory_transport_add() function allows developers to give the
+ * memory transport (see bing_set_transport) a response to give requests for a
+ * URL. A URL only has one response, adding another replaces it.
+ *
+ * Like a server, successful responses have an ETag (made from the body), so
+ * they can be cached and revalidated (see bing_set_body_cache). A request asking if
+ * cached data changed is given a 304 if the response has the same body.
+ *
+ * @param url The URL of the request, as made by the search (see
+ * 	bing_request_url).
+ * @param status The HTTP status of the response.
+ * @param body The body of the response, which is copied. It doesn't need to be
+ * 	null terminated.
+ * @param size The size of the body.
+ *
+ * @return A boolean value which is non-zero if the response was added,
+ * 	otherwise zero on error, if url is NULL, or if status is zero.
+ */
+int bing_memory_transport_add(const char* url, long status, const char* body, size_t size);
+
+/**
+ * @brief Remove every response from the memory transport.
+ *
+ * The @c bing_memory_transport_clear() function allows developers to remove the
+ * responses added with bing_memory_transport_add.
+ *
+ * @return A boolean value which is non-zero if the responses were removed.
+ */
+int bing_memory_transport_clear();
+
 /**
  * @brief Perform a synchronous search.
  *
@@ -350,6 +1017,14 @@ bing_response_t bing_search_next_sync(const bing_response_t pre_response);
  * different thread other than the one calling this function. So plan synchronization
  * out properly with your callback function.
  *
+ * All asynchronous searches are run on a single network thread. The callback is
+ * called on that thread, so it should return quickly (and not perform a synchronous
+ * search) or it will hold up every other asynchronous search.
+ *
+ * If an identical search (same URL and account key) is already running and hasn't
+ * received any data yet, this search joins it instead of downloading the same thing
+ * again. Each search still gets a response of its own.
+ *
  * @param bing The unique Bing ID to perform a search with.
  * @param query The search query to perform. If this is NULL, then the function
  * 	returns a zero (false) value.
@@ -360,8 +1035,9 @@ bing_response_t bing_search_next_sync(const bing_response_t pre_response);
  * @param response_func The function that will be called with a response from
  * 	the search. If this is NULL, then the function returns a zero (false) value.
  *
- * @return A boolean result which is non-zero for a successful query, otherwise
- * 	zero on error or bad query.
+ * @return A search ID which is non-zero for a successful query, otherwise
+ * 	zero on error or bad query. The search ID can be given to
+ * 	bing_search_cancel to cancel the search.
  */
 int bing_search_async(unsigned int bing, const char* query, const bing_request_t request, const void* user_data, receive_bing_response_func response_func);
 
@@ -380,11 +1056,96 @@ int bing_search_async(unsigned int bing, const char* query, const bing_request_t
  * @param response_func The function that will be called with a response from
  * 	the search. If this is NULL, then the function returns a zero (false) value.
  *
- * @return A boolean result which is non-zero for a successful query, otherwise
- * 	zero on error, bad query, or lack of next set of results.
+ * @return A search ID which is non-zero for a successful query, otherwise
+ * 	zero on error, bad query, or lack of next set of results. The search ID
+ * 	can be given to bing_search_cancel to cancel the search.
  */
 int bing_search_next_async(const bing_response_t pre_response, const void* user_data, receive_bing_response_func response_func);
 
+/**
+ * @brief Perform a asynchronous search that streams results as they are parsed.
+ *
+ * The @c bing_search_stream_async() function allows developers to perform a
+ * non-blocking search operation that calls the result function for each result
+ * as soon as it has been downloaded and parsed, instead of waiting for the whole
+ * response. The parsed portion of the feed is freed as each result is delivered.
+ * Once the search is complete, the response function is called with the response
+ * the results belong to (or NULL on error, after which the delivered results are
+ * no longer valid).
+ *
+ * Each delivered result counts against the budget set with bing_set_stream_budget
+ * until it is released with bing_result_stream_release. When the budget is used up,
+ * the download is paused. It resumes as soon as enough results are released. The
+ * time limit set with bing_set_timeout includes the time the download is paused.
+ *
+ * Composite results are not streamed, they are available from the response.
+ * Remember, the callbacks will be called by a different thread other than the one
+ * calling this function. So plan synchronization out properly with your callback
+ * functions. Like bing_search_async, they are called on the network thread that
+ * runs all asynchronous searches, so they should return quickly.
+ *
+ * @param bing The unique Bing ID to perform a search with.
+ * @param query The search query to perform. If this is NULL, then the function
+ * 	returns a zero (false) value.
+ * @param request The type of search to perform. This determines the response
+ * 	that will be returned. If this is NULL, then the function function returns
+ * 	a zero (false) value.
+ * @param user_data Any user data that will be passed to the result and response
+ * 	functions.
+ * @param result_func The function that will be called with each result. If this
+ * 	is NULL, then the function returns a zero (false) value.
+ * @param response_func The function that will be called with the response once
+ * 	the search completes. If this is NULL, the response is freed when the
+ * 	search completes, along with all the results that were delivered.
+ *
+ * @return A search ID which is non-zero for a successful query, otherwise
+ * 	zero on error or bad query. The search ID can be given to
+ * 	bing_search_cancel to cancel the search.
+ */
+int bing_search_stream_async(unsigned int bing, const char* query, const bing_request_t request, const void* user_data, receive_bing_result_func result_func, receive_bing_response_func response_func);
+
+/**
+ * @brief Release a streamed result.
+ *
+ * The @c bing_result_stream_release() function allows developers to free a
+ * result delivered by bing_search_stream_async and return its share of the
+ * stream budget. This can be called before or after the search completes. The
+ * result is removed from its response, so it should not be used afterwards.
+ *
+ * @param result The streamed result to release.
+ *
+ * @return A boolean value specifying if the function completed successfully.
+ * 	If this is a non-zero value then the operation completed. Otherwise it
+ * 	failed, such as if the result was not streamed.
+ */
+int bing_result_stream_release(bing_result_t result);
+
+/**
+ * @brief Cancel an asynchronous search.
+ *
+ * The @c bing_search_cancel() function allows developers to stop an
+ * asynchronous search that is no longer wanted, such as when the developer
+ * has moved on to something else. The search's transfers are stopped (along
+ * with any retries and hedges of them), which frees up the connections for
+ * other searches, and the response function isn't called (for event searches,
+ * no event is delegated). If identical searches joined the search, it keeps
+ * running for them, but this search is still not told it completed.
+ *
+ * The search is stopped on the network thread, so the response function could
+ * already be running when this is called. If this returns a non-zero value,
+ * the response function was not called and won't be. Results of a streamed
+ * search that were already delivered should not be used after the search is
+ * cancelled.
+ *
+ * @param search The search ID returned by the function that started the
+ * 	search.
+ *
+ * @return A boolean value which is non-zero if the search was cancelled,
+ * 	otherwise zero if the search already completed (or was already cancelled)
+ * 	or the search ID is not valid.
+ */
+int bing_search_cancel(int search);
+
 /**
  * @brief Perform a asynchronous search but returns with an event.
  *
@@ -401,8 +1162,9 @@ int bing_search_next_async(const bing_response_t pre_response, const void* user_
  * 	that will be returned. If this is NULL, then the function function returns
  * 	a zero (false) value.
  *
- * @return A boolean result which is non-zero for a successful query, otherwise
- * 	zero on error or bad query.
+ * @return A search ID which is non-zero for a successful query, otherwise
+ * 	zero on error or bad query. The search ID can be given to
+ * 	bing_search_cancel to cancel the search.
  */
 int bing_search_event_async(unsigned int bing, const char* query, const bing_request_t request);
 
@@ -417,8 +1179,9 @@ int bing_search_event_async(unsigned int bing, const char* query, const bing_req
  *
  * @param pre_response The previous search response.
  *
- * @return A boolean result which is non-zero for a successful query, otherwise
- * 	zero on error, bad query, or lack of next set of results.
+ * @return A search ID which is non-zero for a successful query, otherwise
+ * 	zero on error, bad query, or lack of next set of results. The search ID
+ * 	can be given to bing_search_cancel to cancel the search.
  */
 int bing_search_event_next_async(const bing_response_t pre_response);
 
@@ -442,6 +1205,32 @@ int bing_search_event_next_async(const bing_response_t pre_response);
  */
 const char* bing_request_url(const char* query, const bing_request_t request);
 
+/**
+ * @brief Set the service that searches are made to.
+ *
+ * The @c bing_set_service_url() function allows developers to make searches
+ * to a server other than Bing, such as a local server that acts like the
+ * service to test or measure an application without a network connection or
+ * using transactions of an account. The source type and options of each search
+ * are appended to the URL, so the server should take the same paths and
+ * parameters, and return the same Atom feeds, as the service. Next links are
+ * taken from the responses, so they go to whichever server the response says.
+ * tools/mockserver.c is such a server, and can also act like a slow or
+ * overloaded service. To test without any server, the memory transport can be
+ * used instead (see bing_set_transport).
+ *
+ * This only changes searches made after it is called. Cached responses are
+ * kept by URL, so responses from the service are not used for another server.
+ *
+ * @param url The URL of the service, starting with http:// or https://. A
+ * 	slash is added to the end if it doesn't have one. If NULL, searches are
+ * 	made to Bing again.
+ *
+ * @return A boolean value which is non-zero if the URL was set, otherwise zero
+ * 	if the URL is not a HTTP or HTTPS URL or on error.
+ */
+int bing_set_service_url(const char* url);
+
 /**
  * @brief Set memory handlers to be used by Bing.
  *
@@ -490,7 +1279,9 @@ enum BING_REQUEST_FIELD
 	BING_REQUEST_FIELD_LOCATION_OVERRIDE,
 	BING_REQUEST_FIELD_SORT_BY,
 	BING_REQUEST_FIELD_FILE_TYPE,
-	BING_REQUEST_FIELD_WEB_OPTIONS
+	BING_REQUEST_FIELD_WEB_OPTIONS,
+	//64bit integer. Not sent to Bing, searches stop downloading and parsing once this many results (for composite requests, this many responses) have been received. The partial response is returned as a successful search.
+	BING_REQUEST_FIELD_RESULT_LIMIT
 };
 
 //Helper functions to make the end result better, from http://stackoverflow.com/questions/195975/how-to-make-a-char-string-from-a-c-macros-value
@@ -1039,6 +1830,45 @@ int bing_response_get_query(bing_response_t response, char* buffer);
  */
 int bing_response_get_results(bing_response_t response, bing_result_t* results);
 
+/**
+ * @brief Get the string pool statistics of a Bing response.
+ *
+ * The @c bing_response_get_string_pool_stats() function allows developers to see
+ * how well repeated values (display URLs, news sources, content types, etc.) were
+ * shared within a response. A response, its composite responses, and all their
+ * results share one pool of strings.
+ *
+ * @param response The Bing response to get the statistics of.
+ * @param stats The statistics structure to copy the statistics into. The
+ * 	dedupe_ratio is requested_bytes divided by stored_bytes, a value of 1.0
+ * 	means nothing was shared.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if response or stats is NULL.
+ */
+int bing_response_get_string_pool_stats(bing_response_t response, bing_string_pool_stats_t stats);
+
+/**
+ * @brief Get the transfer statistics of a Bing response.
+ *
+ * The @c bing_response_get_transfer_stats() function allows developers to see
+ * how much data was downloaded for a response, compared to how much the parser
+ * received once it was decompressed. Composite child responses are part of the
+ * parent's download and don't have statistics of their own.
+ *
+ * @param response The Bing response to get the statistics of.
+ * @param stats The statistics structure to copy the statistics into. The
+ * 	compression_ratio is decoded_bytes divided by wire_bytes, a value of 1.0
+ * 	means the response wasn't compressed. Attempts is how many times the
+ * 	response was requested from the server, retries included (see
+ * 	bing_set_retry). It's zero if the body came from the body cache or from
+ * 	another search's transfer.
+ *
+ * @return A boolean value which is non-zero if the statistics were retrieved,
+ * 	otherwise zero on error or if response or stats is NULL.
+ */
+int bing_response_get_transfer_stats(bing_response_t response, bing_transfer_stats_t stats);
+
 /**
  * @brief Free a Bing response from memory.
  *
@@ -0,0 +1,347 @@
+/*
+ * arena.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+//A bump allocator for everything libxml allocates while parsing a single search. The document is never freed node by node, the whole arena is released at once when the search is cleaned up.
+
+//libxml's memory functions are global, so the arena being allocated from is tracked per thread (a search is parsed entirely on one thread, but a thread can parse more then one search). Frees and reallocs can happen anywhere, so they find the arena that owns the memory (if any) by it's address.
+
+#define ARENA_ALIGN (sizeof(void*) * 2)
+#define ARENA_ALIGN_SIZE(x) (((x) + (ARENA_ALIGN - 1)) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER_SIZE ARENA_ALIGN_SIZE(sizeof(size_t))
+#define ARENA_BLOCK_HEADER_SIZE ARENA_ALIGN_SIZE(sizeof(bing_arena_block))
+
+#define ARENA_FIRST_BLOCK_SIZE (16 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (512 * 1024)
+
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t arenaKey;
+
+//Every block of every arena, sorted by address
+static pthread_mutex_t arenaBlockMutex = PTHREAD_MUTEX_INITIALIZER;
+static bing_arena_block** arenaBlocks = NULL;
+static volatile unsigned int arenaBlockCount = 0;
+static unsigned int arenaBlockAlloc = 0;
+
+void arena_key_create()
+{
+	pthread_key_create(&arenaKey, NULL);
+}
+
+bing_arena* arena_current()
+{
+	pthread_once(&arenaKeyOnce, arena_key_create);
+	return (bing_arena*)pthread_getspecific(arenaKey);
+}
+
+//Must be called with the block mutex locked. Returns the index of the first block after ptr.
+unsigned int arena_block_index(const void* ptr)
+{
+	unsigned int low = 0;
+	unsigned int high = arenaBlockCount;
+	unsigned int mid;
+
+	while(low < high)
+	{
+		mid = low + ((high - low) / 2);
+		if((const char*)arenaBlocks[mid] <= (const char*)ptr)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+
+BOOL arena_block_register(bing_arena_block* block)
+{
+	bing_arena_block** nBlocks;
+	unsigned int nAlloc;
+	unsigned int i;
+	BOOL ret = TRUE;
+
+	pthread_mutex_lock(&arenaBlockMutex);
+
+	if(arenaBlockCount == arenaBlockAlloc)
+	{
+		nAlloc = arenaBlockAlloc > 0 ? arenaBlockAlloc * 2 : 16;
+		nBlocks = (bing_arena_block**)bing_mem_realloc(arenaBlocks, nAlloc * sizeof(bing_arena_block*));
+		if(nBlocks)
+		{
+			arenaBlocks = nBlocks;
+			arenaBlockAlloc = nAlloc;
+		}
+		else
+		{
+			ret = FALSE;
+		}
+	}
+	if(ret)
+	{
+		i = arena_block_index(block);
+		memmove(arenaBlocks + i + 1, arenaBlocks + i, (arenaBlockCount - i) * sizeof(bing_arena_block*));
+		arenaBlocks[i] = block;
+		arenaBlockCount++;
+	}
+
+	pthread_mutex_unlock(&arenaBlockMutex);
+
+	return ret;
+}
+
+//Must be called with the block mutex locked
+void arena_block_unregister(bing_arena_block* block)
+{
+	unsigned int i = arena_block_index(block);
+
+	if(i > 0 && arenaBlocks[i - 1] == block)
+	{
+		i--;
+		memmove(arenaBlocks + i, arenaBlocks + i + 1, (arenaBlockCount - i - 1) * sizeof(bing_arena_block*));
+		arenaBlockCount--;
+	}
+}
+
+BOOL arena_block_contains(const bing_arena_block* block, const void* ptr)
+{
+	return (const char*)ptr >= (const char*)block && (const char*)ptr < ((const char*)block + ARENA_BLOCK_HEADER_SIZE + block->size);
+}
+
+//Returns the arena that ptr was allocated from, NULL if it wasn't
+bing_arena* arena_owner(const void* ptr)
+{
+	bing_arena* ret = NULL;
+	bing_arena_block* block;
+	unsigned int i;
+
+	//Nothing to look through (memory can't be freed while it's arena is being created or freed)
+	if(!ptr || arenaBlockCount == 0)
+	{
+		return NULL;
+	}
+
+	//Most of what's freed while parsing is from the thread's own arena. Only this thread adds blocks to it, so they're checked without the lock (there are only a few).
+	ret = arena_current();
+	if(ret)
+	{
+		for(block = ret->blocks; block; block = block->next)
+		{
+			if(arena_block_contains(block, ptr))
+			{
+				return ret;
+			}
+		}
+		ret = NULL;
+	}
+
+	pthread_mutex_lock(&arenaBlockMutex);
+
+	i = arena_block_index(ptr);
+	if(i > 0 && arena_block_contains(arenaBlocks[i - 1], ptr))
+	{
+		ret = arenaBlocks[i - 1]->arena;
+	}
+
+	pthread_mutex_unlock(&arenaBlockMutex);
+
+	return ret;
+}
+
+bing_arena* arena_create()
+{
+	bing_arena* arena = (bing_arena*)bing_mem_malloc(sizeof(bing_arena));
+	if(arena)
+	{
+		memset(arena, 0, sizeof(bing_arena));
+	}
+	return arena;
+}
+
+void arena_attach(bing_arena* arena)
+{
+	pthread_once(&arenaKeyOnce, arena_key_create);
+	pthread_setspecific(arenaKey, arena);
+}
+
+void arena_enable(bing_arena* arena, BOOL enable)
+{
+	if(arena)
+	{
+		//Multiple searches can be parsed on the same thread, so the arena is only attached while it's in use (and whatever was attached before is put back)
+		if(enable)
+		{
+			arena->previous = arena_current();
+			arena->enabled = TRUE;
+			arena_attach(arena);
+		}
+		else
+		{
+			arena->enabled = FALSE;
+			arena_attach(arena->previous);
+			arena->previous = NULL;
+		}
+	}
+}
+
+void arena_free(bing_arena* arena)
+{
+	bing_arena_block* block;
+	if(arena)
+	{
+		if(arena_current() == arena)
+		{
+			arena_attach(arena->previous);
+		}
+
+#if defined(BING_DEBUG)
+		BING_MSG_PRINTOUT("Arena: %u allocations (%u frees skipped) in %u blocks, %u bytes\n", arena->allocations, arena->skippedFrees, arena->blockCount, (unsigned int)arena->totalSize);
+#endif
+
+		pthread_mutex_lock(&arenaBlockMutex);
+
+		for(block = arena->blocks; block; block = block->next)
+		{
+			arena_block_unregister(block);
+		}
+
+		pthread_mutex_unlock(&arenaBlockMutex);
+
+		while((block = arena->blocks))
+		{
+			arena->blocks = block->next;
+			bing_mem_free(block);
+		}
+		bing_mem_free(arena);
+	}
+}
+
+void* arena_alloc(bing_arena* arena, size_t size)
+{
+	bing_arena_block* block = arena->blocks;
+	size_t blockSize;
+	char* ret;
+
+	size = ARENA_HEADER_SIZE + ARENA_ALIGN_SIZE(size);
+
+	if(!block || (block->size - block->used) < size)
+	{
+		//Each block is double the last, until it hits the max. Large allocations get a block of their own.
+		blockSize = block ? block->size * 2 : ARENA_FIRST_BLOCK_SIZE;
+		if(blockSize > ARENA_MAX_BLOCK_SIZE)
+		{
+			blockSize = ARENA_MAX_BLOCK_SIZE;
+		}
+		if(blockSize < size)
+		{
+			blockSize = size;
+		}
+
+		block = (bing_arena_block*)bing_mem_malloc(ARENA_BLOCK_HEADER_SIZE + blockSize);
+		if(!block)
+		{
+			return NULL;
+		}
+		block->size = blockSize;
+		block->used = 0;
+		block->arena = arena;
+		if(!arena_block_register(block))
+		{
+			bing_mem_free(block);
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		arena->blockCount++;
+		arena->totalSize += blockSize;
+	}
+
+	ret = (char*)block + ARENA_BLOCK_HEADER_SIZE + block->used;
+	block->used += size;
+
+	//Save the size so realloc knows how much to copy
+	*((size_t*)ret) = size - ARENA_HEADER_SIZE;
+
+	arena->allocations++;
+	return ret + ARENA_HEADER_SIZE;
+}
+
+//libxml memory functions
+
+void* arena_xml_malloc(size_t size)
+{
+	bing_arena* arena = arena_current();
+	if(arena && arena->enabled)
+	{
+		return arena_alloc(arena, size);
+	}
+	return bing_mem_malloc(size);
+}
+
+void* arena_xml_realloc(void* ptr, size_t size)
+{
+	bing_arena* arena = arena_current();
+	bing_arena* owner = arena_owner(ptr);
+	size_t oldSize;
+	void* ret;
+	if(owner)
+	{
+		//Bump allocators can't grow in place, so allocate (from whatever would be allocated from now) and copy
+		oldSize = *((size_t*)((char*)ptr - ARENA_HEADER_SIZE));
+		if(oldSize >= size)
+		{
+			return ptr;
+		}
+		ret = arena && arena->enabled ? arena_alloc(arena, size) : bing_mem_malloc(size);
+		if(ret)
+		{
+			memcpy(ret, ptr, oldSize);
+		}
+		return ret;
+	}
+	if(arena && arena->enabled && !ptr)
+	{
+		return arena_alloc(arena, size);
+	}
+	return bing_mem_realloc(ptr, size);
+}
+
+void arena_xml_free(void* ptr)
+{
+	bing_arena* owner = arena_owner(ptr);
+	if(owner)
+	{
+		//Released with the arena
+		atomic_add(&owner->skippedFrees, 1);
+		return;
+	}
+	bing_mem_free(ptr);
+}
+
+char* arena_xml_strdup(const char* str)
+{
+	bing_arena* arena = arena_current();
+	size_t size;
+	char* ret;
+	if(arena && arena->enabled && str)
+	{
+		size = strlen(str) + 1;
+		ret = (char*)arena_alloc(arena, size);
+		if(ret)
+		{
+			memcpy(ret, str, size);
+		}
+		return ret;
+	}
+	return bing_mem_strdup(str);
+}
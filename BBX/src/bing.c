@@ -12,6 +12,14 @@
 
 static volatile BOOL bing_initialized = FALSE;
 
+#if !defined(BING_NO_MEM_HANDLERS)
+bing_malloc_handler bing_mem_malloc = (bing_malloc_handler)malloc;
+bing_calloc_handler bing_mem_calloc = (bing_calloc_handler)calloc;
+bing_realloc_handler bing_mem_realloc = (bing_realloc_handler)realloc;
+bing_free_handler bing_mem_free = (bing_free_handler)free;
+bing_strdup_handler bing_mem_strdup = (bing_strdup_handler)strdup;
+#endif
+
 void bing_initialize()
 {
 	if(atomic_set_value((unsigned int*)&bing_initialized, TRUE) == FALSE) //Set this first so if another thread tries to initialize it, it doesn't work
@@ -215,7 +223,7 @@ unsigned int bing_create(const char* account_key)
 
 void bing_free(unsigned int bingID)
 {
-	bing* bingI;
+	bing* bingI = NULL;
 
 	bing_initialize(); //This shouldn't be here but put it here for safety
 
@@ -240,24 +248,33 @@ void bing_free(unsigned int bingID)
 				bingSystem.bingInstancesCount--;
 				bingSystem.bingInstances[bingID - 1] = NULL;
 			}
+		}
+
+		//Responses look up the Bing instance when freed, so the system can't be locked while they are freed
+		pthread_mutex_unlock(&bingSystem.mutex);
+
+		if(bingI)
+		{
+			rate_release(bingI);
 
 			pthread_mutex_lock(&bingI->mutex);
 
-			//Free the responses themselves
+			//Free the responses themselves (the instance has already been removed, so they can't remove themselves)
 			while(bingI->responseCount > 0)
 			{
-				bing_response_free((bing_response_t)bingI->responses[bingI->responseCount - 1]);
+				bing_response_free((bing_response_t)bingI->responses[--bingI->responseCount]);
 			}
 			bing_mem_free(bingI->responses);
 
 			bing_mem_free(bingI->accountKey);
 
+			prefetch_free(bingI);
+			transport_free_curl_pool(bingI);
+
 			pthread_mutex_destroy(&bingI->mutex);
 
 			bing_mem_free(bingI);
 		}
-
-		pthread_mutex_unlock(&bingSystem.mutex);
 	}
 }
 
@@ -282,6 +299,22 @@ bing* retrieveBing(unsigned int bingID)
 	return bingI;
 }
 
+char* retrieveAccountKey(unsigned int bingID)
+{
+	char* ret = NULL;
+	bing* bingI = retrieveBing(bingID);
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+		if(bingI->accountKey)
+		{
+			ret = bing_mem_strdup(bingI->accountKey);
+		}
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+	return ret;
+}
+
 int bing_get_account_key(unsigned int bingID, char* buffer)
 {
 	bing* bingI = retrieveBing(bingID);
@@ -344,12 +377,150 @@ int bing_set_account_key(unsigned int bingID, const char* account_key)
 	return res;
 }
 
+int bing_set_stream_budget(unsigned int bingID, size_t max_pending_bytes, unsigned int max_pending_results)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->streamMaxPendingBytes = max_pending_bytes;
+		bingI->streamMaxPendingResults = max_pending_results;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+int bing_set_prefetch(unsigned int bingID, unsigned int depth, size_t max_bytes)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->prefetchDepth = depth;
+		bingI->prefetchMaxBytes = max_bytes;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+int bing_set_http2(unsigned int bingID, int enable)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->http2 = enable ? TRUE : FALSE;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+int bing_set_timeout(unsigned int bingID, unsigned int timeout)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->timeout = timeout;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
 //Utility functions
 
 const char BING_URL[] = "https://api.datamarket.azure.com/Bing/Search/";
 const char URL_UNRESERVED[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.~";
 const char HEX[] = "0123456789ABCDEF";
 
+//The service searches are made to, BING_URL unless set to something else (such as a local server for testing)
+static pthread_mutex_t serviceUrlMutex = PTHREAD_MUTEX_INITIALIZER;
+static char* serviceUrl = NULL;
+
+int bing_set_service_url(const char* url)
+{
+	BOOL ret = FALSE;
+	char* copy = NULL;
+	size_t len;
+
+	if(url)
+	{
+		len = strlen(url);
+		if((strncmp(url, "http://", 7) == 0 && len > 7) || (strncmp(url, "https://", 8) == 0 && len > 8))
+		{
+			//The source type is appended directly, so it needs to end with a slash
+			copy = (char*)bing_mem_malloc(len + 2);
+			if(copy)
+			{
+				strcpy(copy, url);
+				if(copy[len - 1] != '/')
+				{
+					copy[len] = '/';
+					copy[len + 1] = '\0';
+				}
+				ret = TRUE;
+			}
+		}
+	}
+	else
+	{
+		ret = TRUE;
+	}
+
+	if(ret)
+	{
+		pthread_mutex_lock(&serviceUrlMutex);
+
+		bing_mem_free(serviceUrl);
+		serviceUrl = copy;
+
+		pthread_mutex_unlock(&serviceUrlMutex);
+	}
+
+	return ret;
+}
+
+char* service_url()
+{
+	char* ret;
+
+	pthread_mutex_lock(&serviceUrlMutex);
+
+	ret = bing_mem_strdup(serviceUrl ? serviceUrl : BING_URL);
+
+	pthread_mutex_unlock(&serviceUrlMutex);
+
+	return ret;
+}
+
 //requestUrl formats the URL, this encodes it so it is formatted in a manner that can be interpreted properly
 const char* encodeUrl(const char* url)
 {
@@ -404,15 +575,16 @@ const char* bing_request_url(const char* query, const bing_request_t request)
 	const char* requestOptions;
 	const char* sourceType;
 	char* sourceTypeTmp;
+	char* service;
 	bing_request* req = (bing_request*)request;
 	size_t urlSize = 26 + 1; //This is the length of the URL format and null char. We don't include '?' because when the size of sourceType is taken, it will include that
 
 	//TODO: If the request is a translation request, convert to URL. If the request is composite, and contains a translation URL, convert both to URLs, then get the index of the translation request, specify it and space-seperate the URLs. So translation is 2nd request: "normal_url 1 translation_url"
 
-	if(request)
+	if(request && (service = service_url()))
 	{
-		//Size of URL (it's constant but it could change so we don't want to hard code the size)
-		urlSize += sizeof(BING_URL);
+		//Size of URL
+		urlSize += strlen(service);
 
 		//Encode the query and get its size
 		queryStr = encodeUrl(query);
@@ -477,7 +649,7 @@ const char* bing_request_url(const char* query, const bing_request_t request)
 			if(ret)
 			{
 				//Now actually create the URL
-				if(snprintf(ret, urlSize, "%s%sQuery=%%27%s%%27&$format=ATOM%s", BING_URL, sourceType, queryStr, requestOptions) < 0)
+				if(snprintf(ret, urlSize, "%s%sQuery=%%27%s%%27&$format=ATOM%s", service, sourceType, queryStr, requestOptions) < 0)
 				{
 					//Error
 					bing_mem_free(ret);
@@ -490,6 +662,7 @@ const char* bing_request_url(const char* query, const bing_request_t request)
 			bing_mem_free((void*)sourceType);
 		}
 		bing_mem_free((void*)queryStr);
+		bing_mem_free(service);
 	}
 	return ret;
 }
@@ -75,6 +75,21 @@ __BEGIN_DECLS
 
 #define PARSE_COMPOSITE_IDENT "ExpandableSearchResult"
 
+//Number of idle cURL handles each Bing instance keeps (so connections and TLS sessions can be reused)
+#if !defined(BING_CURL_POOL_SIZE)
+#define BING_CURL_POOL_SIZE 4
+#endif
+
+//Most connections the network engine has open at once. Transfers past this wait for a connection to be free.
+#if !defined(BING_ENGINE_MAX_CONNECTIONS)
+#define BING_ENGINE_MAX_CONNECTIONS 32
+#endif
+
+//Number of recent searches that are timed to decide when to hedge a search
+#if !defined(BING_HEDGE_SAMPLES)
+#define BING_HEDGE_SAMPLES 64
+#endif
+
 /**
  * The print out function to use for messages.
  * void printFunc(const char* msg, ...);
@@ -103,11 +118,12 @@ typedef char* (*bing_strdup_handler)(const char*);
 #define bing_mem_free free
 #define bing_mem_strdup strdup
 #else
-static bing_malloc_handler bing_mem_malloc = (bing_malloc_handler)malloc;
-static bing_calloc_handler bing_mem_calloc = (bing_calloc_handler)calloc;
-static bing_realloc_handler bing_mem_realloc = (bing_realloc_handler)realloc;
-static bing_free_handler bing_mem_free = (bing_free_handler)free;
-static bing_strdup_handler bing_mem_strdup = (bing_strdup_handler)strdup;
+//Defined in bing.c, so what bing_set_memory_handlers sets is used everywhere
+extern bing_malloc_handler bing_mem_malloc;
+extern bing_calloc_handler bing_mem_calloc;
+extern bing_realloc_handler bing_mem_realloc;
+extern bing_free_handler bing_mem_free;
+extern bing_strdup_handler bing_mem_strdup;
 #endif
 
 /*
@@ -146,6 +162,67 @@ typedef struct BING_FIELD_SEARCH_S
 
 typedef struct hashtable_s hashtable_t;
 
+typedef struct BING_STRING_POOL_S
+{
+	pthread_mutex_t mutex; //The dictionary isn't thread safe, and the results of a response can be used on different threads
+	xmlDictPtr dict;
+	volatile unsigned int refCount;
+
+	//Statistics
+	unsigned int lookups;
+	size_t requestedBytes;
+	size_t storedBytes;
+} bing_string_pool;
+
+typedef struct BING_STREAM_S
+{
+	pthread_mutex_t mutex;
+	volatile unsigned int refCount;
+
+	//Budget (0 is unlimited)
+	size_t maxPendingBytes;
+	unsigned int maxPendingResults;
+
+	//Results that have been delivered but not released
+	size_t pendingBytes;
+	unsigned int pendingResults;
+	BOOL paused;
+
+	//The search producing the results, until it's done. Once it's paused and enough results are released, it's resumed on the engine thread.
+	void* search;
+	BOOL resumePosted;
+} bing_stream;
+
+typedef struct BING_ARENA_BLOCK_S
+{
+	struct BING_ARENA_BLOCK_S* next;
+	struct BING_ARENA_S* arena; //Owner
+	size_t size;
+	size_t used;
+} bing_arena_block;
+
+typedef struct BING_ARENA_S
+{
+	bing_arena_block* blocks; //Newest first
+	BOOL enabled; //Only allocate from the arena while enabled, frees/reallocs of arena memory are always handled (on any thread)
+	struct BING_ARENA_S* previous; //Attached to the thread before this was enabled
+
+	//Statistics
+	unsigned int allocations;
+	volatile unsigned int skippedFrees;
+	unsigned int blockCount;
+	size_t totalSize;
+} bing_arena;
+
+typedef struct BING_PREFETCH_S
+{
+	char* url;
+	struct BING_RESPONSE_S* response; //NULL while the search is running
+	size_t size;
+	unsigned int level; //How many pages ahead of the developer's response this is
+	struct BING_PREFETCH_S* next;
+} bing_prefetch;
+
 typedef struct BING_REQUEST_S
 {
 	const char* sourceType;
@@ -171,6 +248,9 @@ typedef struct BING_RESULT_S
 	result_creation_func creation;
 	result_additional_result_func additionalResult;
 	hashtable_t* data;
+
+	//Amount of the stream budget this result is holding
+	size_t streamBytes;
 } bing_result;
 
 typedef struct BING_RESPONSE_S
@@ -192,6 +272,17 @@ typedef struct BING_RESPONSE_S
 
 	unsigned int allocatedMemoryCount;
 	void** allocatedMemory;
+
+	//Shared with internal responses and results
+	bing_string_pool* pool;
+
+	//Only exists if results are streamed
+	bing_stream* stream;
+
+	//Transfer size (only set on the response that was downloaded)
+	size_t wireBytes;
+	size_t decodedBytes;
+	unsigned int attempts;
 } bing_response;
 
 typedef struct BING_S
@@ -200,6 +291,46 @@ typedef struct BING_S
 
 	char* accountKey;
 
+	size_t streamMaxPendingBytes;
+	unsigned int streamMaxPendingResults;
+
+	BOOL http2;
+
+	unsigned int timeout; //How long (ms) searches have to finish, zero if there is no limit
+
+	//Next page prefetching (oldest first)
+	unsigned int prefetchDepth;
+	size_t prefetchMaxBytes;
+	size_t prefetchBytes;
+	bing_prefetch* prefetch;
+	unsigned int prefetchRequests;
+	unsigned int prefetchHits;
+	unsigned int prefetchMisses;
+	unsigned int prefetchDiscarded;
+
+	//Hedged searches
+	unsigned int hedgePercentile; //Zero if searches aren't hedged
+	double hedgeMaxFraction;
+	unsigned int hedgeSamples[BING_HEDGE_SAMPLES]; //How long searches took to start receiving (ms)
+	unsigned int hedgeSampleCount;
+	unsigned int hedgeSampleNext;
+	unsigned int hedgeSearches;
+	unsigned int hedges;
+	unsigned int hedgeWins;
+
+	//Rate limit bucket of the account key (only used with the rate mutex locked)
+	void* rateBucket;
+	unsigned int rateGeneration;
+
+	//Retrying failed transfers
+	unsigned int retryMaxAttempts;
+	unsigned int retryBaseDelay;
+	unsigned int retryMaxDelay;
+
+	//Idle cURL handles
+	unsigned int curlPoolCount;
+	void* curlPool[BING_CURL_POOL_SIZE];
+
 	unsigned int responseCount;
 	bing_response** responses;
 } bing;
@@ -269,6 +400,7 @@ BOOL hashtable_copy(hashtable_t* dstTable, const hashtable_t* srcTable);
 BOOL hashtable_compact(hashtable_t* table);
 BOOL hashtable_key_exists(hashtable_t* table, const char* key);
 BOOL hashtable_put_item(hashtable_t* table, const char* key, const void* data, size_t data_size);
+BOOL hashtable_put_string(hashtable_t* table, const char* key, const char* value); //Only strings put with this (or hashtable_set_string) are interned
 size_t hashtable_get_item(hashtable_t* table, const char* name, void* data);
 BOOL hashtable_remove_item(hashtable_t* table, const char* key);
 int hashtable_get_keys(hashtable_t* table, char** keys); //Returns the number of keys
@@ -276,9 +408,170 @@ int hashtable_get_keys(hashtable_t* table, char** keys); //Returns the number of
 BOOL hashtable_get_data_key(hashtable_t* table, const char* key, void* value, size_t size);
 int hashtable_get_string(hashtable_t* table, const char* field, char* value);
 BOOL hashtable_set_data(hashtable_t* table, const char* field, const void* value, size_t size);
+BOOL hashtable_set_string(hashtable_t* table, const char* field, const char* value);
+void hashtable_set_string_pool(hashtable_t* table, bing_string_pool* pool);
+
+//String pool functions
+bing_string_pool* string_pool_create();
+void string_pool_retain(bing_string_pool* pool);
+void string_pool_release(bing_string_pool* pool);
+const char* string_pool_intern(bing_string_pool* pool, const char* str, int len); //If len is negative, the length of str is used
+
+//Stream functions
+bing_stream* stream_create(size_t maxPendingBytes, unsigned int maxPendingResults);
+void stream_retain(bing_stream* stream);
+void stream_release(bing_stream* stream);
+BOOL stream_pause(bing_stream* stream); //Returns TRUE if over budget, and marks the stream as paused
+BOOL stream_resume(bing_stream* stream); //Returns TRUE if the stream was paused and is now under budget
+void stream_set_search(bing_stream* stream, void* search); //NULL once the search is done
+
+//Arena functions
+bing_arena* arena_create();
+void arena_attach(bing_arena* arena); //Attach to the current thread, NULL to detach
+void arena_enable(bing_arena* arena, BOOL enable); //Enabling attaches to the current thread, disabling puts back what was attached before
+void arena_free(bing_arena* arena);
+void* arena_xml_malloc(size_t size);
+void* arena_xml_realloc(void* ptr, size_t size);
+void arena_xml_free(void* ptr);
+char* arena_xml_strdup(const char* str);
 
 //Bing functions
 bing* retrieveBing(unsigned int bingID);
+char* retrieveAccountKey(unsigned int bingID); //Returns a copy, free with bing_mem_free
+
+//Search functions
+void search_setup();
+void search_release();
+int search_async_url_in(unsigned int bingID, const char* url, unsigned int result_limit, const void* user_data, BOOL user_data_is_parser, receive_bing_result_func result_func, receive_bing_response_func response_func);
+BOOL search_stream_resume(void* data, void* curl, int curlCode); //Engine function, data is a retained stream whose search can continue
+
+//Prefetch functions
+void prefetch_next(bing_response* response, unsigned int level); //Level is how many pages ahead of the developer the response is
+void prefetch_done(bing_response_t response, const void* user_data);
+bing_response* prefetch_take(unsigned int bingID, const char* url); //Returns the prefetched response for the URL, if it has been received
+void prefetch_free(bing* bingI); //The Bing mutex must be locked
+
+//Hedging functions
+BOOL hedge_delay(unsigned int bingID, unsigned int* delay); //Returns TRUE if hedging is on (so the search is timed). Delay is how long (ms) the search waits before it's hedged, zero if it isn't.
+BOOL hedge_allow(unsigned int bingID); //Returns TRUE if a search can be hedged (counting it as hedged)
+void hedge_sample(unsigned int bingID, unsigned int time); //How long (ms) a search took to start receiving
+void hedge_won(unsigned int bingID);
+
+//Retry functions
+typedef struct BING_RETRY_S
+{
+	unsigned int attempts; //Attempts made so far
+	unsigned int maxAttempts;
+	unsigned int baseDelay;
+	unsigned int maxDelay;
+	unsigned int delay; //Delay (ms) before the next attempt
+	unsigned int seed;
+} bing_retry;
+
+void retry_setup(unsigned int bingID, bing_retry* retry); //Get the retry policy of a Bing instance
+BOOL retry_status(long httpStatus); //Returns TRUE if a response with the HTTP status can be retried
+BOOL retry_next(bing_retry* retry, int curlCode, long httpStatus); //Returns TRUE if the transfer should be attempted again (after retry->delay)
+void retry_sleep(unsigned int delay);
+
+//Rate limit functions
+BOOL rate_take(unsigned int bingID, BOOL optional, unsigned int maxWait, unsigned int* wait); //Take a token for a request made with the account key of the Bing instance. Wait is how long (ms) the request has to wait before it's made. Returns FALSE if it can't be made: there are no tokens and requests fail fast (or the request is optional), or the wait would be longer then maxWait (zero if there is no limit), in which case wait is set.
+void rate_release(bing* bingI); //The Bing instance is being freed, so it no longer uses the rate limit bucket of it's account key. The bucket is removed once no Bing instance uses it.
+
+//Cache functions
+size_t cache_limit(); //Largest amount of data that can be cached, 0 if caching is off
+char* cache_find(unsigned int bingID, const char* url, size_t* size, BOOL* refresh); //Returns a copy of the cached data, free with bing_mem_free. If refresh is set, the data is stale and the caller should refresh it.
+BOOL cache_validators(unsigned int bingID, const char* url, char** etag, char** modified); //Get the validators of cached data (even if it has expired), free with bing_mem_free. Returns FALSE if there are none.
+BOOL cache_revalidate(unsigned int bingID, const char* url, char** data, size_t* size); //The server said the cached data hasn't changed, so it's good for another TTL. If data isn't NULL it's given a copy of it (like cache_find). Returns FALSE if it isn't cached.
+void cache_store(unsigned int bingID, const char* url, enum BING_SOURCE_TYPE type, const char* etag, const char* modified, char* data, size_t size); //Takes ownership of data. The validators can be NULL.
+
+//Record/replay functions
+typedef struct BING_CAPTURE_S
+{
+	long status; //HTTP status, zero if nothing was recorded
+	char* headers; //Header lines, as received
+	size_t headerSize;
+	size_t headerAlloc;
+	char* body; //Decompressed
+	size_t bodySize;
+	size_t bodyAlloc;
+	size_t wireBytes;
+	unsigned int firstByte; //Time (ms) from when the transfer was made until the headers were received
+	unsigned int total; //Time (ms) until the transfer was done
+} bing_capture;
+
+enum BING_CAPTURE_MODE capture_mode();
+BOOL capture_append(char** data, size_t* size, size_t* alloc, const char* add, size_t addSize); //Returns FALSE if there isn't enough memory
+BOOL capture_take(const char* url, bing_capture* capture); //Get a copy of the next recorded response for the URL, with the times scaled. Returns FALSE if there isn't one (or capture isn't replaying).
+void capture_store(const char* url, const bing_capture* capture); //Record the response (if capture is recording)
+void capture_free(bing_capture* capture);
+
+//Transport functions
+typedef struct BING_TRANSFER_S
+{
+	const struct BING_TRANSPORT_OPS_S* transport; //What makes the transfer
+	void* search; //Given to search_engine_done once the transfer is done
+	unsigned int bing;
+	char* url;
+	unsigned long long deadline; //When (engine_time) the search has to be done by, zero if there is no limit
+	volatile BOOL cancelled;
+	long httpStatus; //Of the last status line received
+	char* ifNoneMatch; //Set if the server is being asked if cached data changed
+	char* ifModifiedSince;
+
+	//cURL
+	void* handle;
+	void* hedgeHandle; //The other transfer of a hedged search, while both are running
+	BOOL hedged; //The first transfer to receive anything is used (see search_transfer_claim)
+	void* headers;
+
+	//Replay and memory
+	bing_capture response; //The response being replayed
+	BOOL responseHeadersDone; //The headers have been replayed
+	size_t responseOffset; //Amount of the body that has been replayed
+
+	//Custom
+	bing_transport_s custom;
+	size_t customBytes; //Received by the custom transport
+	volatile BOOL customStarted; //The custom transport has the transfer
+	volatile BOOL customDone; //The custom transport completed the transfer
+	int customCode;
+} bing_transfer;
+
+//A transport makes transfers: what it receives is given to search_transfer_header and search_transfer_data, and once a transfer is done search_engine_done is called on the engine thread
+typedef struct BING_TRANSPORT_OPS_S
+{
+	BOOL (*start)(bing_transfer* transfer, unsigned int delay); //Make the transfer, once it has waited for delay (ms). Returns FALSE if it can't be made.
+	void (*cancel)(bing_transfer* transfer); //Called on the engine thread. The transfer is done with CURLE_ABORTED_BY_CALLBACK, unless it completes first.
+	long (*status)(bing_transfer* transfer); //HTTP status of the response, zero if there isn't one
+	size_t (*wireBytes)(bing_transfer* transfer); //Size of the (compressed) body that was received
+	BOOL (*deadline)(bing_transfer* transfer, unsigned int wait); //Give the transfer the time the search has left, once it has waited (ms). Returns FALSE if there's no time left.
+	void (*resume)(bing_transfer* transfer); //Called on the engine thread once a streamed transfer that was paused can continue. NULL if the transport gives the data again by itself.
+	BOOL (*hedge)(bing_transfer* transfer); //Called on the engine thread to make a second transfer (hedgeHandle) for a search that hasn't received anything yet. NULL if the transport has no connections to race.
+	void (*stop)(bing_transfer* transfer, void* handle); //Stop one transfer of a hedged search, it's done on the engine thread
+	void (*release)(bing_transfer* transfer, void* handle); //Give back a transfer of a hedged search that isn't used
+	int (*perform)(bing_transfer* transfer); //Make the transfer on the calling thread, returns the cURL code. NULL if transfers are only made on the engine thread.
+} transport_ops;
+
+BOOL transport_setup(bing_transfer* transfer, void* search, unsigned int bingID, const char* url, BOOL replay); //Pick what makes the transfer, replayed searches are given recorded responses. Returns FALSE if there isn't enough memory.
+void transport_swap(bing_transfer* transfer); //The hedge becomes the transfer being used
+void transport_unconditional(bing_transfer* transfer); //Further attempts ask for the data itself, not if it changed
+void transport_free(bing_transfer* transfer);
+void transport_free_curl_pool(bing* bingI); //The Bing mutex must be locked
+void transport_global_setup(); //Called by search_setup
+void transport_global_cleanup();
+size_t search_transfer_header(bing_transfer* transfer, char* header, size_t size); //Returns size, unless the transfer should be stopped
+size_t search_transfer_data(bing_transfer* transfer, char* data, size_t size); //Same as a cURL write function
+BOOL search_transfer_claim(bing_transfer* transfer, BOOL hedge); //Returns FALSE if what the transfer (or it's hedge) received isn't used
+BOOL search_engine_done(void* data, void* curl, int curlCode); //Engine function, data is the search of the transfer
+
+//Engine functions
+typedef BOOL (*engine_done_func)(void* data, void* curl, int curlCode); //Return TRUE if the cURL handle was setup to run again
+BOOL engine_add(void* curl, engine_done_func func, void* data);
+BOOL engine_post(engine_done_func func, void* data); //Call func on the engine thread (curl will be NULL)
+BOOL engine_post_delayed(engine_done_func func, void* data, unsigned int delay); //Same as engine_post, but only once delay (ms) has passed
+BOOL engine_cancel_post(engine_done_func func, void* data); //Stop a delayed call from being made. Returns FALSE if it was already made (or is being made).
+void engine_cancel(void* curl, void* data); //Stop a transfer. It's done (with CURLE_ABORTED_BY_CALLBACK) on the engine thread, unless it completes first.
+unsigned long long engine_time(); //Milliseconds, from a clock that only goes forward
 
 //Type functions
 BOOL isComplex(const char* name);
@@ -292,6 +585,7 @@ long long parseTime(const char* stime);
 
 //Request functions
 const char* request_get_composite_sourcetype(bing_request* composite);
+unsigned int request_get_result_limit(bing_request_t request); //0 if there is no limit
 
 //Response functions
 BOOL response_def_create_standard_responses(bing_response_t response, data_dictionary_t dictionary);
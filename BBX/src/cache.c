@@ -0,0 +1,1162 @@
+/*
+ * cache.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+//Body cache. The raw body received for a search is kept (by account key and URL), so the same search can be parsed again without using the network. Parsed responses aren't cached, every hit is parsed.
+
+//Cached data has a soft and hard TTL. Once the soft TTL passes the data is stale: it's still used, but a search is started in the background to refresh it. Once the hard TTL passes the data isn't used.
+
+//If the server gave validators (ETag, Last-Modified) with the data, the data is kept after it expires (until it's evicted), so searches for it can ask the server if it changed. If it hasn't, the data is used again for another TTL.
+
+//The cache can also be kept in a file, so it lasts between runs of the application. The file is a log: a header followed by records, which are only ever appended.
+//There is no separate index, the index is built by reading the record headers (the file is mapped into memory, so the data itself is only read when it's used).
+//A record that isn't complete (the application stopped while writing it) ends the log. Compaction writes the records still in use to a new file, which then replaces the log.
+
+#define CACHE_BUCKETS 64
+
+#define CACHE_FILE_MAGIC 0x43584242 //BBXC
+#define CACHE_FILE_VERSION 3
+#define CACHE_RECORD_MAGIC 0x52584242 //BBXR
+
+//How long to wait for a refresh before another can be started (seconds), in case the refresh failed
+#define CACHE_REFRESH_RETRY 30
+
+//Files smaller then this aren't compacted
+#define CACHE_COMPACT_MIN (1024 * 1024)
+
+typedef struct CACHE_FILE_HEADER_S
+{
+	uint32_t magic;
+	uint32_t version;
+} cache_file_header;
+
+typedef struct CACHE_RECORD_S
+{
+	uint32_t magic;
+	uint32_t keySize;
+	uint32_t validatorSize;
+	uint32_t dataSize;
+	uint32_t checksum; //Of the key, validators, and data
+	int32_t type;
+	int64_t stale;
+	int64_t expires;
+} cache_record;
+
+typedef struct CACHE_ENTRY_S
+{
+	char* key; //Hash of the account key and URL
+	unsigned int hash;
+	char* validators; //ETag and Last-Modified, separated by a newline. NULL if there are none.
+	char* data; //NULL if the data is in the cache file
+	size_t size;
+	enum BING_SOURCE_TYPE type;
+	time_t stale;
+	time_t expires;
+	time_t refreshAfter; //Only one refresh at a time
+
+	//Position of the record in the cache file, -1 if it's not in the file
+	off_t record;
+
+	struct CACHE_ENTRY_S* bucketNext;
+
+	//Most recently used first
+	struct CACHE_ENTRY_S* prev;
+	struct CACHE_ENTRY_S* next;
+} cache_entry;
+
+//A record being copied by compaction
+typedef struct CACHE_COMPACT_S
+{
+	off_t record; //Position in the cache file
+	off_t compactRecord; //Position in the new file, -1 if it wasn't copied
+	size_t size;
+	time_t stale;
+	time_t expires;
+} cache_compact;
+
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry* cacheBuckets[CACHE_BUCKETS];
+static cache_entry* cacheHead = NULL;
+static cache_entry* cacheTail = NULL;
+
+//Settings (caching is off until a TTL and size are set)
+static unsigned int cacheTTL = 0;
+static size_t cacheMaxBytes = 0;
+static unsigned int cacheSoftTTLs[BING_SOURCETYPE_TOTAL_COUNT];
+static unsigned int cacheHardTTLs[BING_SOURCETYPE_TOTAL_COUNT]; //Zero to use cacheTTL
+
+//Cache file
+static char* cacheFilePath = NULL;
+static int cacheFile = -1;
+static BOOL cacheFileLoaded = FALSE;
+static char* cacheMap = NULL;
+static size_t cacheMapSize = 0;
+static size_t cacheFileSize = 0;
+static size_t cacheFileLive = 0; //Size of the records that are still in use
+static unsigned int cacheFileGeneration = 0; //Changes every time the cache file is closed
+static BOOL cacheCompacting = FALSE;
+
+//Stats
+static size_t cacheBytes = 0;
+static unsigned int cacheEntries = 0;
+static size_t cacheHitBytes = 0; //Data given out instead of being downloaded
+static unsigned int cacheHits = 0;
+static unsigned int cacheMisses = 0;
+static unsigned int cacheEvictions = 0;
+static unsigned int cacheExpirations = 0;
+static unsigned int cacheStaleHits = 0;
+static unsigned int cacheRefreshes = 0;
+static unsigned int cacheRevalidations = 0;
+
+unsigned int cache_hash(const char* key)
+{
+	unsigned int hash = 5381;
+	while(*key)
+	{
+		hash = ((hash << 5) + hash) + (unsigned char)*(key++);
+	}
+	return hash;
+}
+
+uint32_t cache_checksum(uint32_t sum, const char* data, size_t size)
+{
+	//FNV-1a
+	while(size-- > 0)
+	{
+		sum = (sum ^ (unsigned char)*(data++)) * 16777619U;
+	}
+	return sum;
+}
+
+char* cache_key(unsigned int bingID, const char* url)
+{
+	char* ret = NULL;
+	char* accountKey = retrieveAccountKey(bingID);
+	uint64_t keyHash = 14695981039346656037ULL;
+	const char* c;
+	size_t size;
+
+	if(accountKey && url)
+	{
+		//The key could end up in the cache file, so the account key is hashed (FNV-1a)
+		for(c = accountKey; *c; c++)
+		{
+			keyHash = (keyHash ^ (unsigned char)*c) * 1099511628211ULL;
+		}
+
+		size = strlen(url) + 18;
+		ret = (char*)bing_mem_malloc(size);
+		if(ret)
+		{
+			snprintf(ret, size, "%016llx\n%s", (unsigned long long)keyHash, url);
+		}
+	}
+	bing_mem_free(accountKey);
+
+	return ret;
+}
+
+size_t cache_validator_size(cache_entry* entry)
+{
+	return entry->validators ? strlen(entry->validators) : 0;
+}
+
+//Must be called with the cache mutex locked
+const char* cache_data(cache_entry* entry)
+{
+	return entry->data ? entry->data : (cacheMap + entry->record + sizeof(cache_record) + strlen(entry->key) + cache_validator_size(entry));
+}
+
+size_t cache_record_size(cache_entry* entry)
+{
+	return sizeof(cache_record) + strlen(entry->key) + cache_validator_size(entry) + entry->size;
+}
+
+//Can the server be asked if the data changed, once it expires?
+BOOL cache_revalidatable(cache_entry* entry)
+{
+	return entry->validators != NULL;
+}
+
+//Must be called with the cache mutex locked
+cache_entry* cache_lookup(const char* key, unsigned int hash)
+{
+	cache_entry* entry;
+	for(entry = cacheBuckets[hash % CACHE_BUCKETS]; entry; entry = entry->bucketNext)
+	{
+		if(entry->hash == hash && strcmp(entry->key, key) == 0)
+		{
+			break;
+		}
+	}
+	return entry;
+}
+
+//Must be called with the cache mutex locked
+void cache_link(cache_entry* entry)
+{
+	entry->prev = NULL;
+	entry->next = cacheHead;
+	if(cacheHead)
+	{
+		cacheHead->prev = entry;
+	}
+	else
+	{
+		cacheTail = entry;
+	}
+	cacheHead = entry;
+}
+
+//Must be called with the cache mutex locked
+void cache_unlink(cache_entry* entry)
+{
+	if(entry->prev)
+	{
+		entry->prev->next = entry->next;
+	}
+	else
+	{
+		cacheHead = entry->next;
+	}
+	if(entry->next)
+	{
+		entry->next->prev = entry->prev;
+	}
+	else
+	{
+		cacheTail = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+//Must be called with the cache mutex locked
+void cache_remove(cache_entry* entry)
+{
+	cache_entry** bucket;
+
+	for(bucket = &cacheBuckets[entry->hash % CACHE_BUCKETS]; *bucket; bucket = &(*bucket)->bucketNext)
+	{
+		if(*bucket == entry)
+		{
+			*bucket = entry->bucketNext;
+			break;
+		}
+	}
+	cache_unlink(entry);
+
+	cacheBytes -= entry->size;
+	cacheEntries--;
+
+	//The record is no longer used, compaction will get rid of it
+	if(entry->record >= 0)
+	{
+		cacheFileLive -= cache_record_size(entry);
+	}
+
+	bing_mem_free(entry->key);
+	bing_mem_free(entry->validators);
+	bing_mem_free(entry->data);
+	bing_mem_free(entry);
+}
+
+//Must be called with the cache mutex locked. Removes the least recently used entries until size more bytes fit.
+void cache_evict(size_t size)
+{
+	while(cacheTail && (cacheBytes + size) > cacheMaxBytes)
+	{
+		cache_remove(cacheTail);
+		cacheEvictions++;
+	}
+}
+
+//Must be called with the cache mutex locked. Replaces anything already cached with the same key.
+void cache_insert(cache_entry* entry)
+{
+	cache_entry* old;
+
+	if((old = cache_lookup(entry->key, entry->hash)))
+	{
+		cache_remove(old);
+	}
+	cache_evict(entry->size);
+
+	entry->bucketNext = cacheBuckets[entry->hash % CACHE_BUCKETS];
+	cacheBuckets[entry->hash % CACHE_BUCKETS] = entry;
+	cache_link(entry);
+
+	cacheBytes += entry->size;
+	cacheEntries++;
+
+	if(entry->record >= 0)
+	{
+		cacheFileLive += cache_record_size(entry);
+	}
+}
+
+//Must be called with the cache mutex locked
+void cache_clear()
+{
+	while(cacheHead)
+	{
+		cache_remove(cacheHead);
+	}
+}
+
+//Must be called with the cache mutex locked. Maps the whole cache file into memory.
+BOOL cache_file_map()
+{
+	struct stat st;
+
+	if(cacheMap)
+	{
+		munmap(cacheMap, cacheMapSize);
+		cacheMap = NULL;
+		cacheMapSize = 0;
+	}
+
+	if(fstat(cacheFile, &st) != 0)
+	{
+		return FALSE;
+	}
+	cacheFileSize = (size_t)st.st_size;
+
+	if(cacheFileSize > 0)
+	{
+		cacheMap = (char*)mmap(NULL, cacheFileSize, PROT_READ, MAP_SHARED, cacheFile, 0);
+		if(cacheMap == MAP_FAILED)
+		{
+			cacheMap = NULL;
+			return FALSE;
+		}
+		cacheMapSize = cacheFileSize;
+	}
+	return TRUE;
+}
+
+//Must be called with the cache mutex locked
+void cache_file_close()
+{
+	cache_entry* entry;
+	cache_entry* next;
+
+	//Anything that is only in the file is gone once the file is
+	for(entry = cacheHead; entry; entry = next)
+	{
+		next = entry->next;
+		if(!entry->data)
+		{
+			cache_remove(entry);
+		}
+		else
+		{
+			entry->record = -1;
+		}
+	}
+
+	if(cacheMap)
+	{
+		munmap(cacheMap, cacheMapSize);
+		cacheMap = NULL;
+		cacheMapSize = 0;
+	}
+	if(cacheFile >= 0)
+	{
+		close(cacheFile);
+		cacheFile = -1;
+	}
+	bing_mem_free(cacheFilePath);
+	cacheFilePath = NULL;
+
+	cacheFileLoaded = FALSE;
+	cacheFileSize = 0;
+	cacheFileLive = 0;
+	cacheFileGeneration++;
+}
+
+//Open a cache file, returns -1 if it isn't a cache file, or is one written by a different version (it's left as it is, it could still be in use).
+int cache_file_open(const char* path, BOOL create)
+{
+	cache_file_header header;
+	int file = open(path, O_RDWR | O_APPEND | (create ? O_CREAT : 0), S_IRUSR | S_IWUSR);
+	ssize_t size;
+
+	if(file >= 0)
+	{
+		size = pread(file, &header, sizeof(cache_file_header), 0);
+		if(size == 0 && create)
+		{
+			//New file
+			header.magic = CACHE_FILE_MAGIC;
+			header.version = CACHE_FILE_VERSION;
+			size = write(file, &header, sizeof(cache_file_header));
+		}
+		if(size != sizeof(cache_file_header) || header.magic != CACHE_FILE_MAGIC || header.version != CACHE_FILE_VERSION)
+		{
+			close(file);
+			file = -1;
+		}
+	}
+	return file;
+}
+
+//Must be called with the cache mutex locked. Write the record for an entry, at the end of the file. Returns the position of the record, or -1 on error.
+off_t cache_file_write(int file, off_t offset, cache_entry* entry, const char* data)
+{
+	cache_record record;
+	struct iovec iov[4];
+	size_t keySize = strlen(entry->key);
+	size_t validatorSize = cache_validator_size(entry);
+	ssize_t size = (ssize_t)cache_record_size(entry);
+
+	record.magic = CACHE_RECORD_MAGIC;
+	record.keySize = (uint32_t)keySize;
+	record.validatorSize = (uint32_t)validatorSize;
+	record.dataSize = (uint32_t)entry->size;
+	record.checksum = cache_checksum(cache_checksum(cache_checksum(2166136261U, entry->key, keySize), entry->validators, validatorSize), data, entry->size);
+	record.type = (int32_t)entry->type;
+	record.stale = (int64_t)entry->stale;
+	record.expires = (int64_t)entry->expires;
+
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof(cache_record);
+	iov[1].iov_base = entry->key;
+	iov[1].iov_len = keySize;
+	iov[2].iov_base = entry->validators;
+	iov[2].iov_len = validatorSize;
+	iov[3].iov_base = (void*)data;
+	iov[3].iov_len = entry->size;
+
+	if(writev(file, iov, 4) != size)
+	{
+		//Don't leave part of a record, it would end the log
+		ftruncate(file, offset);
+		return -1;
+	}
+	return offset;
+}
+
+//Must be called with the cache mutex locked. Should the cache file be compacted? If so, the caller compacts it (with cache_file_compact) once the mutex is unlocked.
+BOOL cache_file_compactable()
+{
+	if(cacheFile >= 0 && cacheFileLoaded && !cacheCompacting && cacheFileSize > CACHE_COMPACT_MIN && cacheFileSize > cacheFileLive * 2)
+	{
+		//Only one compaction at a time
+		cacheCompacting = TRUE;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+int cache_compact_compare(const void* a, const void* b)
+{
+	off_t recordA = ((const cache_compact*)a)->record;
+	off_t recordB = ((const cache_compact*)b)->record;
+	return recordA < recordB ? -1 : (recordA > recordB ? 1 : 0);
+}
+
+//Copy a record from the cache file to the end of the new file, with the times the entry has now. Returns the position of the record, or -1 on error.
+off_t cache_file_copy(int file, off_t offset, const char* map, cache_compact* compact)
+{
+	cache_record record;
+	struct iovec iov[2];
+
+	memcpy(&record, map + compact->record, sizeof(cache_record));
+	record.stale = (int64_t)compact->stale;
+	record.expires = (int64_t)compact->expires;
+
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof(cache_record);
+	iov[1].iov_base = (void*)(map + compact->record + sizeof(cache_record));
+	iov[1].iov_len = compact->size - sizeof(cache_record);
+
+	if(writev(file, iov, 2) != (ssize_t)compact->size)
+	{
+		ftruncate(file, offset);
+		return -1;
+	}
+	return offset;
+}
+
+//Must be called with the cache mutex locked. Copy what was added to the cache file after it was compacted (from mapSize on) to the end of the new file.
+BOOL cache_file_copy_tail(int file, size_t mapSize)
+{
+	size_t size = cacheFileSize - mapSize;
+	char* data;
+	BOOL ret = FALSE;
+
+	if(size == 0)
+	{
+		return TRUE;
+	}
+
+	data = (char*)bing_mem_malloc(size);
+	if(data)
+	{
+		ret = pread(cacheFile, data, size, (off_t)mapSize) == (ssize_t)size && write(file, data, size) == (ssize_t)size;
+		bing_mem_free(data);
+	}
+	return ret;
+}
+
+//Must be called with the cache mutex locked. Use the new file that the cache file was compacted into (already renamed to the cache file).
+void cache_file_swap(int file, size_t mapSize, off_t tailRecord, cache_compact* compacts, unsigned int compactCount)
+{
+	cache_entry* entry;
+	cache_entry* next;
+	cache_compact key;
+	cache_compact* compact;
+
+	close(cacheFile);
+	cacheFile = file;
+
+	cacheFileLive = 0;
+	if(!cache_file_map())
+	{
+		//Keep what's in memory
+		cache_file_close();
+		return;
+	}
+
+	qsort(compacts, compactCount, sizeof(cache_compact), cache_compact_compare);
+
+	for(entry = cacheHead; entry; entry = next)
+	{
+		next = entry->next;
+		if(entry->record < 0)
+		{
+			continue;
+		}
+
+		if(entry->record >= (off_t)mapSize)
+		{
+			//Added while compacting
+			entry->record = entry->record - (off_t)mapSize + tailRecord;
+		}
+		else
+		{
+			key.record = entry->record;
+			compact = (cache_compact*)bsearch(&key, compacts, compactCount, sizeof(cache_compact), cache_compact_compare);
+			entry->record = compact ? compact->compactRecord : -1;
+			if(entry->record < 0)
+			{
+				//Expired, and only in the old file
+				if(!entry->data)
+				{
+					cache_remove(entry);
+				}
+				continue;
+			}
+		}
+
+		cacheFileLive += cache_record_size(entry);
+
+		//The data can be read from the file now
+		bing_mem_free(entry->data);
+		entry->data = NULL;
+	}
+}
+
+//Must be called with the cache mutex unlocked, after cache_file_compactable returned TRUE. Write the records still in use to a new file, then replace the cache file with it.
+//Only taking the list of records and replacing the file is done with the mutex locked, the records are copied (and the new file synced) without it.
+void cache_file_compact()
+{
+	cache_entry* entry;
+	cache_compact* compacts = NULL;
+	unsigned int compactCount = 0;
+	unsigned int i;
+	unsigned int generation;
+	char* tmpPath = NULL;
+	size_t pathSize;
+	char* map = MAP_FAILED;
+	size_t mapSize;
+	int file = -1;
+	off_t offset = sizeof(cache_file_header);
+	time_t now = time(NULL);
+	BOOL ret = FALSE;
+
+	pthread_mutex_lock(&cacheMutex);
+
+	generation = cacheFileGeneration;
+	mapSize = cacheFileSize;
+
+	//The cache file could have been closed since it was found to need compacting
+	if(cacheFile >= 0 && cacheFileLoaded)
+	{
+		pathSize = strlen(cacheFilePath) + 5;
+		tmpPath = (char*)bing_mem_malloc(pathSize);
+		compacts = (cache_compact*)bing_mem_malloc(sizeof(cache_compact) * (cacheEntries + 1));
+	}
+	if(tmpPath && compacts)
+	{
+		snprintf(tmpPath, pathSize, "%s.tmp", cacheFilePath);
+
+		//Least recently used first, so if the file is loaded into a smaller cache, the most recently used are kept
+		for(entry = cacheTail; entry; entry = entry->prev)
+		{
+			if(entry->record >= 0 && (entry->expires > now || cache_revalidatable(entry)))
+			{
+				compacts[compactCount].record = entry->record;
+				compacts[compactCount].compactRecord = -1;
+				compacts[compactCount].size = cache_record_size(entry);
+				compacts[compactCount].stale = entry->stale;
+				compacts[compactCount].expires = entry->expires;
+				compactCount++;
+			}
+		}
+
+		//The file is only appended to, so what is mapped now doesn't change (even if the cache file is closed)
+		map = (char*)mmap(NULL, mapSize, PROT_READ, MAP_SHARED, cacheFile, 0);
+	}
+
+	pthread_mutex_unlock(&cacheMutex);
+
+	if(map != MAP_FAILED)
+	{
+		//Anything left from an earlier compaction that didn't finish is replaced
+		unlink(tmpPath);
+		file = cache_file_open(tmpPath, TRUE);
+		if(file >= 0)
+		{
+			ret = TRUE;
+			for(i = 0; i < compactCount && ret; i++)
+			{
+				compacts[i].compactRecord = cache_file_copy(file, offset, map, &compacts[i]);
+				if(compacts[i].compactRecord < 0)
+				{
+					ret = FALSE;
+				}
+				else
+				{
+					offset += compacts[i].size;
+				}
+			}
+
+			//The new file must be complete before it replaces the old one
+			ret = ret && fsync(file) == 0;
+		}
+		munmap(map, mapSize);
+	}
+
+	pthread_mutex_lock(&cacheMutex);
+
+	//The cache file could have been closed, or caching turned off, while compacting
+	if(ret && generation == cacheFileGeneration && cacheFileLoaded &&
+			cache_file_copy_tail(file, mapSize) && rename(tmpPath, cacheFilePath) == 0)
+	{
+		cache_file_swap(file, mapSize, offset, compacts, compactCount);
+		file = -1;
+	}
+	else if(file >= 0)
+	{
+		unlink(tmpPath);
+	}
+
+	cacheCompacting = FALSE;
+
+	pthread_mutex_unlock(&cacheMutex);
+
+	if(file >= 0)
+	{
+		close(file);
+	}
+	bing_mem_free(compacts);
+	bing_mem_free(tmpPath);
+}
+
+//Must be called with the cache mutex locked. Read the index of the cache file (done the first time the cache is used).
+void cache_file_load()
+{
+	cache_record record;
+	cache_entry* entry;
+	size_t offset = sizeof(cache_file_header);
+	size_t recordSize;
+	const char* key;
+	time_t now = time(NULL);
+
+	cacheFileLoaded = TRUE;
+
+	if(!cache_file_map())
+	{
+		cache_file_close();
+		return;
+	}
+
+	while(offset + sizeof(cache_record) <= cacheFileSize)
+	{
+		//Records aren't aligned
+		memcpy(&record, cacheMap + offset, sizeof(cache_record));
+		key = cacheMap + offset + sizeof(cache_record);
+		recordSize = sizeof(cache_record) + (size_t)record.keySize + record.validatorSize + record.dataSize;
+		if(record.magic != CACHE_RECORD_MAGIC || record.keySize == 0 || recordSize > cacheFileSize - offset ||
+				record.checksum != cache_checksum(cache_checksum(cache_checksum(2166136261U, key, record.keySize), key + record.keySize, record.validatorSize),
+						key + record.keySize + record.validatorSize, record.dataSize))
+		{
+			//Not complete, this is the end of the log
+			break;
+		}
+
+		if(((time_t)record.expires > now || record.validatorSize > 0) && record.dataSize > 0 && record.dataSize <= cacheMaxBytes)
+		{
+			entry = (cache_entry*)bing_mem_malloc(sizeof(cache_entry));
+			if(entry)
+			{
+				memset(entry, 0, sizeof(cache_entry));
+				entry->key = (char*)bing_mem_malloc(record.keySize + 1);
+				if(record.validatorSize > 0)
+				{
+					entry->validators = (char*)bing_mem_malloc(record.validatorSize + 1);
+				}
+				if(entry->key && (entry->validators || record.validatorSize == 0))
+				{
+					memcpy(entry->key, key, record.keySize);
+					entry->key[record.keySize] = '\0';
+					if(entry->validators)
+					{
+						memcpy(entry->validators, key + record.keySize, record.validatorSize);
+						entry->validators[record.validatorSize] = '\0';
+					}
+					entry->hash = cache_hash(entry->key);
+					entry->size = record.dataSize;
+					entry->type = (enum BING_SOURCE_TYPE)record.type;
+					entry->stale = (time_t)record.stale;
+					entry->expires = (time_t)record.expires;
+					entry->record = (off_t)offset;
+
+					cache_insert(entry);
+				}
+				else
+				{
+					bing_mem_free(entry->key);
+					bing_mem_free(entry->validators);
+					bing_mem_free(entry);
+				}
+			}
+		}
+
+		offset += recordSize;
+	}
+
+	//Get rid of an incomplete record, so new records can be read
+	if(offset < cacheFileSize)
+	{
+		ftruncate(cacheFile, offset);
+		cacheFileSize = offset;
+	}
+}
+
+//Must be called with the cache mutex locked
+void cache_file_use()
+{
+	if(cacheFile >= 0 && !cacheFileLoaded && cacheTTL > 0 && cacheMaxBytes > 0)
+	{
+		cache_file_load();
+	}
+}
+
+size_t cache_limit()
+{
+	size_t ret;
+	BOOL compact;
+
+	pthread_mutex_lock(&cacheMutex);
+	cache_file_use();
+	ret = cacheTTL > 0 ? cacheMaxBytes : 0;
+	compact = cache_file_compactable();
+	pthread_mutex_unlock(&cacheMutex);
+
+	//The file could need compacting once it's loaded
+	if(compact)
+	{
+		cache_file_compact();
+	}
+
+	return ret;
+}
+
+char* cache_find(unsigned int bingID, const char* url, size_t* size, BOOL* refresh)
+{
+	char* ret = NULL;
+	char* key;
+	unsigned int hash;
+	cache_entry* entry;
+	time_t now;
+
+	*refresh = FALSE;
+
+	if(cache_limit() > 0 && (key = cache_key(bingID, url)))
+	{
+		hash = cache_hash(key);
+
+		pthread_mutex_lock(&cacheMutex);
+
+		now = time(NULL);
+		entry = cache_lookup(key, hash);
+		if(entry && entry->expires <= now)
+		{
+			//Expired data is kept if the server can say it hasn't changed
+			if(!cache_revalidatable(entry))
+			{
+				cache_remove(entry);
+				cacheExpirations++;
+			}
+			entry = NULL;
+		}
+
+		if(entry)
+		{
+			//The caller parses the data without holding the cache
+			ret = (char*)bing_mem_malloc(entry->size);
+			if(ret)
+			{
+				memcpy(ret, cache_data(entry), entry->size);
+				*size = entry->size;
+
+				cache_unlink(entry);
+				cache_link(entry);
+
+				cacheHits++;
+				cacheHitBytes += entry->size;
+
+				if(entry->stale <= now)
+				{
+					cacheStaleHits++;
+
+					//Only the first to see the stale data refreshes it
+					if(entry->refreshAfter <= now)
+					{
+						entry->refreshAfter = now + CACHE_REFRESH_RETRY;
+						*refresh = TRUE;
+						cacheRefreshes++;
+					}
+				}
+			}
+		}
+		else
+		{
+			cacheMisses++;
+		}
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		bing_mem_free(key);
+	}
+
+	return ret;
+}
+
+//Must be called with the cache mutex locked
+void cache_ttl(enum BING_SOURCE_TYPE type, unsigned int* softTTL, unsigned int* hardTTL)
+{
+	if((int)type >= 0 && type < BING_SOURCETYPE_TOTAL_COUNT && cacheHardTTLs[type] > 0)
+	{
+		*softTTL = cacheSoftTTLs[type];
+		*hardTTL = cacheHardTTLs[type];
+	}
+	else
+	{
+		//Never stale
+		*softTTL = cacheTTL;
+		*hardTTL = cacheTTL;
+	}
+}
+
+BOOL cache_validators(unsigned int bingID, const char* url, char** etag, char** modified)
+{
+	char* key;
+	char* modifiedStart;
+	cache_entry* entry;
+
+	*etag = NULL;
+	*modified = NULL;
+
+	if(cache_limit() > 0 && (key = cache_key(bingID, url)))
+	{
+		pthread_mutex_lock(&cacheMutex);
+
+		entry = cache_lookup(key, cache_hash(key));
+		if(entry && cache_revalidatable(entry) && (modifiedStart = strchr(entry->validators, '\n')))
+		{
+			if(modifiedStart != entry->validators)
+			{
+				*etag = (char*)bing_mem_malloc((size_t)(modifiedStart - entry->validators) + 1);
+				if(*etag)
+				{
+					memcpy(*etag, entry->validators, (size_t)(modifiedStart - entry->validators));
+					(*etag)[modifiedStart - entry->validators] = '\0';
+				}
+			}
+			if(*(++modifiedStart))
+			{
+				*modified = bing_mem_strdup(modifiedStart);
+			}
+		}
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		bing_mem_free(key);
+	}
+
+	return *etag || *modified;
+}
+
+BOOL cache_revalidate(unsigned int bingID, const char* url, char** data, size_t* size)
+{
+	BOOL ret = FALSE;
+	char* key;
+	cache_entry* entry;
+	unsigned int softTTL;
+	unsigned int hardTTL;
+	time_t now;
+
+	if(cache_limit() > 0 && (key = cache_key(bingID, url)))
+	{
+		pthread_mutex_lock(&cacheMutex);
+
+		entry = cache_lookup(key, cache_hash(key));
+		if(entry)
+		{
+			if(data)
+			{
+				*data = (char*)bing_mem_malloc(entry->size);
+				if(*data)
+				{
+					memcpy(*data, cache_data(entry), entry->size);
+					*size = entry->size;
+					cacheHitBytes += entry->size;
+				}
+			}
+			if(!data || *data)
+			{
+				ret = TRUE;
+
+				//Good for another TTL. The record in the cache file keeps the old times, so after a restart the data is revalidated again (compaction writes the new times).
+				cache_ttl(entry->type, &softTTL, &hardTTL);
+				now = time(NULL);
+				entry->stale = now + softTTL;
+				entry->expires = now + hardTTL;
+				entry->refreshAfter = 0;
+
+				cache_unlink(entry);
+				cache_link(entry);
+
+				cacheRevalidations++;
+			}
+		}
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		bing_mem_free(key);
+	}
+
+	return ret;
+}
+
+void cache_store(unsigned int bingID, const char* url, enum BING_SOURCE_TYPE type, const char* etag, const char* modified, char* data, size_t size)
+{
+	char* key = NULL;
+	char* shrunk;
+	cache_entry* entry;
+	size_t validatorSize;
+	BOOL stored = FALSE;
+	BOOL compact = FALSE;
+	unsigned int softTTL;
+	unsigned int hardTTL;
+	time_t now;
+
+	if(data && size > 0 && size <= cache_limit() && (key = cache_key(bingID, url)) &&
+			(entry = (cache_entry*)bing_mem_malloc(sizeof(cache_entry))))
+	{
+		//The data grew as it was received, so there is probably unused space at the end
+		shrunk = (char*)bing_mem_realloc(data, size);
+		if(shrunk)
+		{
+			data = shrunk;
+		}
+
+		memset(entry, 0, sizeof(cache_entry));
+		entry->key = key;
+		entry->hash = cache_hash(key);
+		entry->data = data;
+		entry->size = size;
+		entry->type = type;
+		entry->record = -1;
+
+		if(etag || modified)
+		{
+			validatorSize = (etag ? strlen(etag) : 0) + (modified ? strlen(modified) : 0) + 2;
+			entry->validators = (char*)bing_mem_malloc(validatorSize);
+			if(entry->validators)
+			{
+				snprintf(entry->validators, validatorSize, "%s\n%s", etag ? etag : "", modified ? modified : "");
+			}
+		}
+
+		pthread_mutex_lock(&cacheMutex);
+
+		//Caching could have been turned off, or made smaller, since the size was checked
+		if(cacheTTL > 0 && size <= cacheMaxBytes)
+		{
+			cache_ttl(type, &softTTL, &hardTTL);
+			now = time(NULL);
+			entry->stale = now + softTTL;
+			entry->expires = now + hardTTL;
+
+			if(cacheFile >= 0)
+			{
+				//The data stays in memory too, it's after the part of the file that is mapped
+				entry->record = cache_file_write(cacheFile, (off_t)cacheFileSize, entry, data);
+				if(entry->record >= 0)
+				{
+					cacheFileSize += cache_record_size(entry);
+				}
+			}
+
+			cache_insert(entry);
+
+			compact = cache_file_compactable();
+
+			stored = TRUE;
+		}
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		if(compact)
+		{
+			cache_file_compact();
+		}
+
+		if(!stored)
+		{
+			bing_mem_free(entry->validators);
+			bing_mem_free(entry);
+		}
+	}
+
+	if(!stored)
+	{
+		bing_mem_free(key);
+		bing_mem_free(data);
+	}
+}
+
+int bing_set_body_cache(unsigned int ttl, size_t max_bytes)
+{
+	pthread_mutex_lock(&cacheMutex);
+
+	cacheTTL = ttl;
+	cacheMaxBytes = ttl > 0 ? max_bytes : 0;
+
+	if(cacheMaxBytes == 0)
+	{
+		//Caching is off (if it's turned on again, the cache file is read again)
+		cache_clear();
+		cacheFileLoaded = FALSE;
+		cacheFileLive = 0;
+	}
+	else
+	{
+		//Make what's cached fit
+		cache_evict(0);
+	}
+
+	pthread_mutex_unlock(&cacheMutex);
+
+	return TRUE;
+}
+
+int bing_set_body_cache_ttl(enum BING_SOURCE_TYPE source_type, unsigned int soft_ttl, unsigned int hard_ttl)
+{
+	BOOL ret = FALSE;
+	if((int)source_type >= 0 && source_type < BING_SOURCETYPE_TOTAL_COUNT)
+	{
+		pthread_mutex_lock(&cacheMutex);
+
+		//Data can't be stale after it has expired
+		cacheSoftTTLs[source_type] = soft_ttl < hard_ttl ? soft_ttl : hard_ttl;
+		cacheHardTTLs[source_type] = hard_ttl;
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
+
+int bing_set_body_cache_file(const char* path)
+{
+	BOOL ret = TRUE;
+	int file;
+
+	pthread_mutex_lock(&cacheMutex);
+
+	cache_file_close();
+
+	if(path)
+	{
+		file = cache_file_open(path, TRUE);
+		cacheFilePath = bing_mem_strdup(path);
+		if(file >= 0 && cacheFilePath)
+		{
+			//What's in the file is read the first time the cache is used
+			cacheFile = file;
+		}
+		else
+		{
+			if(file >= 0)
+			{
+				close(file);
+			}
+			bing_mem_free(cacheFilePath);
+			cacheFilePath = NULL;
+
+			ret = FALSE;
+		}
+	}
+
+	pthread_mutex_unlock(&cacheMutex);
+
+	return ret;
+}
+
+int bing_get_body_cache_stats(bing_body_cache_stats_t stats)
+{
+	BOOL ret = FALSE;
+	if(stats)
+	{
+		pthread_mutex_lock(&cacheMutex);
+
+		stats->bodies = cacheEntries;
+		stats->body_bytes = cacheBytes;
+		stats->hit_bytes = cacheHitBytes;
+		stats->hits = cacheHits;
+		stats->misses = cacheMisses;
+		stats->evictions = cacheEvictions;
+		stats->expirations = cacheExpirations;
+		stats->stale_hits = cacheStaleHits;
+		stats->refreshes = cacheRefreshes;
+		stats->revalidations = cacheRevalidations;
+		stats->hit_rate = (cacheHits + cacheMisses) > 0 ? ((double)cacheHits / (double)(cacheHits + cacheMisses)) : 0.0;
+
+		pthread_mutex_unlock(&cacheMutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
@@ -0,0 +1,509 @@
+/*
+ * capture.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+//Record/replay. While recording, the response each transfer receives (status, headers, body, and how long it took) is appended to a capture file. While replaying, nothing is downloaded: each transfer is given a recorded response for its URL, after the recorded time (which can be scaled).
+
+//The file is a header followed by records, like the cache file. A record that isn't complete (the application stopped while writing it) ends the file.
+//A URL can have more then one record (the same search made again, or retried). They are replayed in the order they were recorded, starting over once all of them have been replayed.
+
+#define CAPTURE_BUCKETS 64
+
+#define CAPTURE_FILE_MAGIC 0x50584242 //BBXP
+#define CAPTURE_FILE_VERSION 1
+#define CAPTURE_RECORD_MAGIC 0x54584242 //BBXT
+
+typedef struct CAPTURE_FILE_HEADER_S
+{
+	uint32_t magic;
+	uint32_t version;
+} capture_file_header;
+
+typedef struct CAPTURE_RECORD_S
+{
+	uint32_t magic;
+	uint32_t urlSize;
+	uint32_t headerSize;
+	uint32_t bodySize;
+	uint32_t checksum; //Of the URL, headers, and body
+	int32_t status;
+	uint32_t firstByte;
+	uint32_t total;
+	uint64_t wireBytes;
+} capture_record;
+
+typedef struct CAPTURE_ENTRY_S
+{
+	char* url;
+	unsigned int hash;
+	BOOL replayed; //Replayed since the records of the URL started over
+	bing_capture capture;
+
+	struct CAPTURE_ENTRY_S* bucketNext; //In the order they were recorded
+} capture_entry;
+
+static pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+static capture_entry* captureBuckets[CAPTURE_BUCKETS];
+static capture_entry* captureBucketTails[CAPTURE_BUCKETS];
+
+//Settings
+static enum BING_CAPTURE_MODE captureMode = BING_CAPTURE_OFF;
+static double captureScale = 1.0;
+static int captureFile = -1; //Only open while recording
+
+//Stats
+static unsigned int captureRecords = 0;
+static unsigned int captureRecorded = 0;
+static unsigned int captureReplayed = 0;
+static unsigned int captureMisses = 0;
+
+uint32_t capture_checksum(uint32_t sum, const char* data, size_t size)
+{
+	//FNV-1a
+	while(size-- > 0)
+	{
+		sum = (sum ^ (unsigned char)*(data++)) * 16777619U;
+	}
+	return sum;
+}
+
+unsigned int capture_hash(const char* url)
+{
+	return (unsigned int)capture_checksum(2166136261U, url, strlen(url));
+}
+
+void capture_free(bing_capture* capture)
+{
+	bing_mem_free(capture->headers);
+	bing_mem_free(capture->body);
+	memset(capture, 0, sizeof(bing_capture));
+}
+
+BOOL capture_append(char** data, size_t* size, size_t* alloc, const char* add, size_t addSize)
+{
+	char* nData;
+	size_t nAlloc;
+
+	if(*size + addSize > *alloc)
+	{
+		nAlloc = *alloc > 0 ? *alloc : 1024;
+		while(nAlloc < *size + addSize)
+		{
+			nAlloc *= 2;
+		}
+		nData = (char*)bing_mem_realloc(*data, nAlloc);
+		if(!nData)
+		{
+			return FALSE;
+		}
+		*data = nData;
+		*alloc = nAlloc;
+	}
+
+	memcpy(*data + *size, add, addSize);
+	*size += addSize;
+	return TRUE;
+}
+
+//Must be called with the capture mutex locked
+void capture_clear()
+{
+	capture_entry* entry;
+	unsigned int i;
+
+	for(i = 0; i < CAPTURE_BUCKETS; i++)
+	{
+		while((entry = captureBuckets[i]))
+		{
+			captureBuckets[i] = entry->bucketNext;
+			bing_mem_free(entry->url);
+			capture_free(&entry->capture);
+			bing_mem_free(entry);
+		}
+		captureBucketTails[i] = NULL;
+	}
+
+	if(captureFile >= 0)
+	{
+		close(captureFile);
+		captureFile = -1;
+	}
+
+	captureMode = BING_CAPTURE_OFF;
+	captureRecords = 0;
+	captureRecorded = 0;
+	captureReplayed = 0;
+	captureMisses = 0;
+}
+
+BOOL capture_file_read(int file, void* buffer, size_t size)
+{
+	ssize_t got;
+
+	while(size > 0)
+	{
+		got = read(file, buffer, size);
+		if(got <= 0)
+		{
+			return FALSE;
+		}
+		buffer = (char*)buffer + got;
+		size -= (size_t)got;
+	}
+	return TRUE;
+}
+
+//Find where the last complete record ends (the file is already past the header). Returns -1 if the file can't be read.
+off_t capture_file_end(int file)
+{
+	capture_record record;
+	char buffer[4096];
+	off_t end = lseek(file, 0, SEEK_CUR);
+	uint64_t remaining;
+	uint32_t sum;
+	size_t size;
+
+	while(end >= 0 && capture_file_read(file, &record, sizeof(capture_record)) && record.magic == CAPTURE_RECORD_MAGIC)
+	{
+		//The checksum runs over the URL, headers, and body one after another, so they can be read in pieces
+		sum = 2166136261U;
+		remaining = (uint64_t)record.urlSize + record.headerSize + record.bodySize;
+		while(remaining > 0)
+		{
+			size = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
+			if(!capture_file_read(file, buffer, size))
+			{
+				break;
+			}
+			sum = capture_checksum(sum, buffer, size);
+			remaining -= size;
+		}
+		if(remaining > 0 || sum != record.checksum)
+		{
+			//Not complete, or not what was written
+			break;
+		}
+		end = lseek(file, 0, SEEK_CUR);
+	}
+	return end;
+}
+
+//Open a capture file, returns -1 if it isn't a capture file
+int capture_file_open(const char* path, BOOL record)
+{
+	capture_file_header header;
+	int file = open(path, record ? (O_RDWR | O_APPEND | O_CREAT) : O_RDONLY, S_IRUSR | S_IWUSR);
+	ssize_t size;
+	off_t end;
+
+	if(file >= 0)
+	{
+		size = pread(file, &header, sizeof(capture_file_header), 0);
+		if(size == 0 && record)
+		{
+			//New file
+			header.magic = CAPTURE_FILE_MAGIC;
+			header.version = CAPTURE_FILE_VERSION;
+			size = write(file, &header, sizeof(capture_file_header));
+		}
+		if(size != sizeof(capture_file_header) || header.magic != CAPTURE_FILE_MAGIC || header.version != CAPTURE_FILE_VERSION)
+		{
+			close(file);
+			file = -1;
+		}
+		else if(record)
+		{
+			//Records are appended. If an earlier run stopped while writing one, it's removed, otherwise every record after it would be lost when replayed.
+			if(lseek(file, sizeof(capture_file_header), SEEK_SET) < 0 || (end = capture_file_end(file)) < 0 || ftruncate(file, end) != 0)
+			{
+				close(file);
+				file = -1;
+			}
+		}
+	}
+	return file;
+}
+
+//Must be called with the capture mutex locked. Read every record in the file (the file is already past the header).
+void capture_file_load(int file)
+{
+	capture_record record;
+	capture_entry* entry;
+	unsigned int bucket;
+
+	while(capture_file_read(file, &record, sizeof(capture_record)) && record.magic == CAPTURE_RECORD_MAGIC)
+	{
+		entry = (capture_entry*)bing_mem_calloc(1, sizeof(capture_entry));
+		if(!entry)
+		{
+			break;
+		}
+		entry->url = (char*)bing_mem_malloc(record.urlSize + 1);
+		entry->capture.headers = (char*)bing_mem_malloc(record.headerSize + 1);
+		entry->capture.body = (char*)bing_mem_malloc(record.bodySize + 1);
+
+		if(!entry->url || !entry->capture.headers || !entry->capture.body ||
+				!capture_file_read(file, entry->url, record.urlSize) ||
+				!capture_file_read(file, entry->capture.headers, record.headerSize) ||
+				!capture_file_read(file, entry->capture.body, record.bodySize) ||
+				capture_checksum(capture_checksum(capture_checksum(2166136261U, entry->url, record.urlSize), entry->capture.headers, record.headerSize), entry->capture.body, record.bodySize) != record.checksum)
+		{
+			//Not complete, or not what was written
+			bing_mem_free(entry->url);
+			capture_free(&entry->capture);
+			bing_mem_free(entry);
+			break;
+		}
+
+		entry->url[record.urlSize] = '\0';
+		entry->hash = capture_hash(entry->url);
+		entry->capture.status = (long)record.status;
+		entry->capture.headerSize = record.headerSize;
+		entry->capture.bodySize = record.bodySize;
+		entry->capture.wireBytes = (size_t)record.wireBytes;
+		entry->capture.firstByte = record.firstByte;
+		entry->capture.total = record.total;
+
+		//Kept in the order they were recorded
+		bucket = entry->hash % CAPTURE_BUCKETS;
+		if(captureBucketTails[bucket])
+		{
+			captureBucketTails[bucket]->bucketNext = entry;
+		}
+		else
+		{
+			captureBuckets[bucket] = entry;
+		}
+		captureBucketTails[bucket] = entry;
+
+		captureRecords++;
+	}
+}
+
+enum BING_CAPTURE_MODE capture_mode()
+{
+	enum BING_CAPTURE_MODE ret;
+
+	pthread_mutex_lock(&captureMutex);
+
+	ret = captureMode;
+
+	pthread_mutex_unlock(&captureMutex);
+
+	return ret;
+}
+
+unsigned int capture_scale(unsigned int time)
+{
+	return (unsigned int)(((double)time * captureScale) + 0.5);
+}
+
+BOOL capture_take(const char* url, bing_capture* capture)
+{
+	capture_entry* entry;
+	capture_entry* found = NULL;
+	capture_entry* first = NULL;
+	unsigned int hash = capture_hash(url);
+	BOOL ret = FALSE;
+
+	memset(capture, 0, sizeof(bing_capture));
+
+	pthread_mutex_lock(&captureMutex);
+
+	if(captureMode == BING_CAPTURE_REPLAY)
+	{
+		for(entry = captureBuckets[hash % CAPTURE_BUCKETS]; entry; entry = entry->bucketNext)
+		{
+			if(entry->hash == hash && strcmp(entry->url, url) == 0)
+			{
+				if(!first)
+				{
+					first = entry;
+				}
+				if(!entry->replayed)
+				{
+					found = entry;
+					break;
+				}
+			}
+		}
+
+		if(!found && first)
+		{
+			//Every record of the URL was replayed, so they start over
+			for(entry = first; entry; entry = entry->bucketNext)
+			{
+				if(entry->hash == hash && strcmp(entry->url, url) == 0)
+				{
+					entry->replayed = FALSE;
+				}
+			}
+			found = first;
+		}
+
+		if(found)
+		{
+			*capture = found->capture;
+			capture->headers = (char*)bing_mem_malloc(found->capture.headerSize + 1);
+			capture->body = (char*)bing_mem_malloc(found->capture.bodySize + 1);
+			if(capture->headers && capture->body)
+			{
+				memcpy(capture->headers, found->capture.headers, found->capture.headerSize);
+				memcpy(capture->body, found->capture.body, found->capture.bodySize);
+				capture->headerAlloc = capture->headerSize + 1;
+				capture->bodyAlloc = capture->bodySize + 1;
+				capture->firstByte = capture_scale(found->capture.firstByte);
+				capture->total = capture_scale(found->capture.total);
+
+				found->replayed = TRUE;
+				captureReplayed++;
+				ret = TRUE;
+			}
+			else
+			{
+				capture_free(capture);
+			}
+		}
+		else
+		{
+			captureMisses++;
+		}
+	}
+
+	pthread_mutex_unlock(&captureMutex);
+
+	return ret;
+}
+
+void capture_store(const char* url, const bing_capture* capture)
+{
+	capture_record record;
+	struct iovec iov[4];
+	size_t urlSize = strlen(url);
+	ssize_t size = (ssize_t)(sizeof(capture_record) + urlSize + capture->headerSize + capture->bodySize);
+	off_t offset;
+
+	record.magic = CAPTURE_RECORD_MAGIC;
+	record.urlSize = (uint32_t)urlSize;
+	record.headerSize = (uint32_t)capture->headerSize;
+	record.bodySize = (uint32_t)capture->bodySize;
+	record.checksum = capture_checksum(capture_checksum(capture_checksum(2166136261U, url, urlSize), capture->headers, capture->headerSize), capture->body, capture->bodySize);
+	record.status = (int32_t)capture->status;
+	record.firstByte = (uint32_t)capture->firstByte;
+	record.total = (uint32_t)capture->total;
+	record.wireBytes = (uint64_t)capture->wireBytes;
+
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof(capture_record);
+	iov[1].iov_base = (void*)url;
+	iov[1].iov_len = urlSize;
+	iov[2].iov_base = capture->headers;
+	iov[2].iov_len = capture->headerSize;
+	iov[3].iov_base = capture->body;
+	iov[3].iov_len = capture->bodySize;
+
+	pthread_mutex_lock(&captureMutex);
+
+	if(captureMode == BING_CAPTURE_RECORD && captureFile >= 0 && (offset = lseek(captureFile, 0, SEEK_END)) >= 0)
+	{
+		if(writev(captureFile, iov, 4) == size)
+		{
+			captureRecorded++;
+		}
+		else
+		{
+			//Don't leave part of a record, it would end the file
+			if(ftruncate(captureFile, offset) != 0)
+			{
+				//Anything recorded after it would be lost, so recording stops
+#if defined(BING_DEBUG)
+				BING_MSG_PRINTOUT("CAPTURE: Could not remove an incomplete record, recording stopped\n");
+#endif
+				close(captureFile);
+				captureFile = -1;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&captureMutex);
+}
+
+int bing_set_capture(const char* path, enum BING_CAPTURE_MODE mode, double time_scale)
+{
+	BOOL ret = FALSE;
+	int file = -1;
+
+	if(time_scale >= 0.0 && (mode == BING_CAPTURE_OFF || path))
+	{
+		pthread_mutex_lock(&captureMutex);
+
+		capture_clear();
+
+		switch(mode)
+		{
+			case BING_CAPTURE_OFF:
+				ret = TRUE;
+				break;
+			case BING_CAPTURE_RECORD:
+				if((file = capture_file_open(path, TRUE)) >= 0)
+				{
+					//Records are added to the end
+					captureFile = file;
+					ret = TRUE;
+				}
+				break;
+			case BING_CAPTURE_REPLAY:
+				if((file = capture_file_open(path, FALSE)) >= 0 && lseek(file, sizeof(capture_file_header), SEEK_SET) >= 0)
+				{
+					capture_file_load(file);
+					ret = TRUE;
+				}
+				if(file >= 0)
+				{
+					close(file);
+				}
+				break;
+		}
+
+		if(ret)
+		{
+			captureMode = mode;
+			captureScale = time_scale;
+		}
+
+		pthread_mutex_unlock(&captureMutex);
+	}
+	return ret;
+}
+
+int bing_get_capture_stats(bing_capture_stats_t stats)
+{
+	BOOL ret = FALSE;
+	if(stats)
+	{
+		pthread_mutex_lock(&captureMutex);
+
+		stats->records = captureRecords;
+		stats->recorded = captureRecorded;
+		stats->replayed = captureReplayed;
+		stats->misses = captureMisses;
+
+		pthread_mutex_unlock(&captureMutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
@@ -0,0 +1,619 @@
+/*
+ * engine.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include <curl/curl.h>
+
+//The network engine. All asynchronous searches are run by a single thread driving a cURL multi handle, instead of a thread per search.
+
+//Longest time to wait for activity before checking for new transfers (ms)
+#define ENGINE_WAIT_MAX 1000
+
+//How long the engine stays around with nothing to do (seconds). Connections are cached by the multi handle, so this lets a burst of searches reuse them.
+#define ENGINE_IDLE_TIMEOUT 30
+
+typedef struct ENGINE_TRANSFER_S
+{
+	CURL* curl; //NULL if this is only a call to make on the engine thread
+	engine_done_func func;
+	void* data;
+	int curlCode;
+	unsigned long long due; //When a delayed call is made
+
+	struct ENGINE_TRANSFER_S* next;
+} engine_transfer;
+
+typedef struct BING_ENGINE_S
+{
+	CURLM* multi;
+	pthread_t thread;
+	int wakeup[2]; //Pipe, writing to it wakes the engine thread
+
+	//Protected by the engine mutex
+	engine_transfer* pending;
+	engine_transfer* delayed; //Soonest first
+	engine_transfer* cancelled; //Only the cURL handle and data are set
+
+	//Only used by the engine thread
+	unsigned int active;
+	engine_transfer* running;
+} bing_engine;
+
+static pthread_mutex_t engineMutex = PTHREAD_MUTEX_INITIALIZER;
+static bing_engine* engineCurrent = NULL;
+
+//Stats (last for the life of the application, not the engine)
+static volatile unsigned int engineTransfers = 0;
+static volatile unsigned int engineConnections = 0;
+static volatile unsigned int engineMultiplexed = 0;
+
+unsigned long long engine_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000ULL) + ((unsigned long long)ts.tv_nsec / 1000000ULL);
+}
+
+void engine_wake(bing_engine* engine)
+{
+	char b = 0;
+	write(engine->wakeup[1], &b, 1);
+}
+
+void engine_transfer_stats(CURL* curl)
+{
+	long value;
+
+	atomic_add(&engineTransfers, 1);
+
+	//Zero if an existing connection was reused
+	if(curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &value) == CURLE_OK && value > 0)
+	{
+		atomic_add(&engineConnections, (unsigned int)value);
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x073200
+	if(curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &value) == CURLE_OK && value == CURL_HTTP_VERSION_2_0)
+	{
+		atomic_add(&engineMultiplexed, 1);
+	}
+#endif
+}
+
+//Find a transfer that is running, and stop tracking it. Returns NULL if it's not running.
+engine_transfer* engine_running_remove(bing_engine* engine, CURL* curl, void* data)
+{
+	engine_transfer** transfer;
+	engine_transfer* ret = NULL;
+
+	for(transfer = &engine->running; *transfer; transfer = &(*transfer)->next)
+	{
+		if((*transfer)->curl == curl && (*transfer)->data == data)
+		{
+			ret = *transfer;
+			*transfer = ret->next;
+			ret->next = NULL;
+			break;
+		}
+	}
+	return ret;
+}
+
+BOOL engine_running_add(bing_engine* engine, engine_transfer* transfer)
+{
+	if(curl_multi_add_handle(engine->multi, transfer->curl) == CURLM_OK)
+	{
+		engine->active++;
+		transfer->next = engine->running;
+		engine->running = transfer;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+void engine_transfer_done(bing_engine* engine, engine_transfer* transfer, int curlCode)
+{
+	//If the transfer was setup again (such as for another URL), then it runs again
+	if(transfer->func(transfer->data, transfer->curl, curlCode))
+	{
+		//Setting up the handle again could have reset it
+		curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, (void*)transfer);
+
+		if(engine_running_add(engine, transfer))
+		{
+			return;
+		}
+		transfer->func(transfer->data, transfer->curl, CURLE_FAILED_INIT);
+	}
+	bing_mem_free(transfer);
+}
+
+//Stop the transfers that were cancelled. They are done with CURLE_ABORTED_BY_CALLBACK.
+void engine_cancelled(bing_engine* engine)
+{
+	engine_transfer* cancelled;
+	engine_transfer* request;
+	engine_transfer* transfer;
+	engine_transfer** pending;
+	engine_transfer* done = NULL;
+
+	pthread_mutex_lock(&engineMutex);
+
+	cancelled = engine->cancelled;
+	engine->cancelled = NULL;
+
+	//Transfers that haven't been added yet
+	for(request = cancelled; request; request = request->next)
+	{
+		for(pending = &engine->pending; *pending; pending = &(*pending)->next)
+		{
+			if((*pending)->curl == request->curl && (*pending)->data == request->data)
+			{
+				transfer = *pending;
+				*pending = transfer->next;
+				transfer->next = done;
+				done = transfer;
+
+				request->curl = NULL;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&engineMutex);
+
+	while((request = cancelled))
+	{
+		cancelled = request->next;
+
+		//A transfer that already completed isn't found
+		if(request->curl && (transfer = engine_running_remove(engine, request->curl, request->data)))
+		{
+			curl_multi_remove_handle(engine->multi, transfer->curl);
+			engine->active--;
+
+			transfer->next = done;
+			done = transfer;
+		}
+		bing_mem_free(request);
+	}
+
+	//Callbacks are never run while the engine is locked
+	while((transfer = done))
+	{
+		done = transfer->next;
+		transfer->func(transfer->data, transfer->curl, CURLE_ABORTED_BY_CALLBACK);
+		bing_mem_free(transfer);
+	}
+}
+
+void engine_wait(bing_engine* engine, long wait)
+{
+	long timeout = ENGINE_WAIT_MAX;
+	char buffer[32];
+	BOOL woken = FALSE;
+#if LIBCURL_VERSION_NUM >= 0x071C00
+	struct curl_waitfd wakeup;
+	int count;
+#else
+	fd_set readFds;
+	fd_set writeFds;
+	fd_set excFds;
+	int maxFd = -1;
+	long curlTimeout = -1;
+	struct timeval tv;
+#endif
+
+	if(wait >= 0 && wait < timeout)
+	{
+		//A delayed call is due
+		timeout = wait;
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x071C00
+	//QNX has no epoll. Waiting uses poll, so there is no limit on which sockets can be waited on (select can't use any past FD_SETSIZE). cURL uses its own timeout if it's sooner.
+	wakeup.fd = engine->wakeup[0];
+	wakeup.events = CURL_WAIT_POLLIN;
+	wakeup.revents = 0;
+	if(curl_multi_wait(engine->multi, &wakeup, 1, (int)timeout, &count) == CURLM_OK)
+	{
+		woken = (wakeup.revents & CURL_WAIT_POLLIN) != 0;
+	}
+#else
+	FD_ZERO(&readFds);
+	FD_ZERO(&writeFds);
+	FD_ZERO(&excFds);
+
+	//Sockets past FD_SETSIZE are left out by cURL, those transfers only run when the wait times out
+	curl_multi_fdset(engine->multi, &readFds, &writeFds, &excFds, &maxFd);
+	curl_multi_timeout(engine->multi, &curlTimeout);
+	if(curlTimeout >= 0 && curlTimeout < timeout)
+	{
+		timeout = curlTimeout;
+	}
+
+	//Can't be waited on with select, so the wakeup is only checked when the wait times out
+	if(engine->wakeup[0] < FD_SETSIZE)
+	{
+		FD_SET(engine->wakeup[0], &readFds);
+		if(engine->wakeup[0] > maxFd)
+		{
+			maxFd = engine->wakeup[0];
+		}
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	woken = select(maxFd + 1, &readFds, &writeFds, &excFds, &tv) >= 0;
+#endif
+
+	if(woken)
+	{
+		//Clear the wakeup
+		while(read(engine->wakeup[0], buffer, sizeof(buffer)) > 0);
+	}
+}
+
+void* engine_run(void* ctx)
+{
+	bing_engine* engine = (bing_engine*)ctx;
+	engine_transfer* transfer;
+	engine_transfer* ready;
+	CURLMsg* msg;
+	CURL* curl;
+	int curlCode;
+	int running;
+	int msgs;
+	long wait;
+	unsigned long long now;
+	time_t idleSince = time(NULL);
+
+	while(TRUE)
+	{
+		//Add new transfers
+		ready = NULL;
+		wait = -1;
+
+		pthread_mutex_lock(&engineMutex);
+
+		while((transfer = engine->pending))
+		{
+			engine->pending = transfer->next;
+			transfer->next = NULL;
+			if(!transfer->curl || !engine_running_add(engine, transfer))
+			{
+				//Calls are made right away, transfers that can't be added are done
+				transfer->curlCode = transfer->curl ? CURLE_FAILED_INIT : CURLE_OK;
+				transfer->next = ready;
+				ready = transfer;
+			}
+		}
+
+		//Delayed calls that are due are made with the rest
+		now = engine_time();
+		while((transfer = engine->delayed) && transfer->due <= now)
+		{
+			engine->delayed = transfer->next;
+			transfer->curlCode = CURLE_OK;
+			transfer->next = ready;
+			ready = transfer;
+		}
+		if(engine->delayed)
+		{
+			wait = (long)(engine->delayed->due - now);
+		}
+
+		if(engine->active > 0 || ready || engine->delayed)
+		{
+			idleSince = time(NULL);
+		}
+		else if((time(NULL) - idleSince) >= ENGINE_IDLE_TIMEOUT)
+		{
+			//Nothing has happened for a while, shutdown. New searches will start a new engine.
+			engineCurrent = NULL;
+			pthread_mutex_unlock(&engineMutex);
+			break;
+		}
+
+		pthread_mutex_unlock(&engineMutex);
+
+		//Callbacks are never run while the engine is locked
+		while((transfer = ready))
+		{
+			ready = transfer->next;
+			transfer->func(transfer->data, transfer->curl, transfer->curlCode);
+			bing_mem_free(transfer);
+		}
+
+		//Run transfers
+		while(curl_multi_perform(engine->multi, &running) == CURLM_CALL_MULTI_PERFORM);
+
+		//Transfers cancelled while running are stopped before any that completed are finished
+		engine_cancelled(engine);
+
+		//Finish completed transfers
+		while((msg = curl_multi_info_read(engine->multi, &msgs)))
+		{
+			if(msg->msg == CURLMSG_DONE)
+			{
+				//The message is invalid once the handle is removed
+				curl = msg->easy_handle;
+				curlCode = msg->data.result;
+
+				transfer = NULL;
+				curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&transfer);
+
+				//A cancelled transfer was already removed
+				if(!transfer || engine_running_remove(engine, curl, transfer->data))
+				{
+					curl_multi_remove_handle(engine->multi, curl);
+					engine->active--;
+
+					engine_transfer_stats(curl);
+
+					if(transfer)
+					{
+						engine_transfer_done(engine, transfer, curlCode);
+					}
+				}
+			}
+		}
+
+		engine_wait(engine, wait);
+	}
+
+	//Cleanup (anything cancelled was already done)
+	while((transfer = engine->cancelled))
+	{
+		engine->cancelled = transfer->next;
+		bing_mem_free(transfer);
+	}
+	curl_multi_cleanup(engine->multi);
+	close(engine->wakeup[0]);
+	close(engine->wakeup[1]);
+	bing_mem_free(engine);
+
+	search_release();
+
+	return NULL;
+}
+
+//Must be called with the engine mutex locked
+bing_engine* engine_start()
+{
+	bing_engine* engine = (bing_engine*)bing_mem_malloc(sizeof(bing_engine));
+	pthread_attr_t thread_atts;
+	BOOL ret = FALSE;
+
+	if(engine)
+	{
+		memset(engine, 0, sizeof(bing_engine));
+
+		//The engine keeps cURL setup for as long as it runs
+		search_setup();
+
+		if(pipe(engine->wakeup) == 0)
+		{
+			fcntl(engine->wakeup[0], F_SETFL, fcntl(engine->wakeup[0], F_GETFL) | O_NONBLOCK);
+			fcntl(engine->wakeup[1], F_SETFL, fcntl(engine->wakeup[1], F_GETFL) | O_NONBLOCK);
+
+			engine->multi = curl_multi_init();
+			if(engine->multi)
+			{
+#if defined(CURLPIPE_MULTIPLEX)
+				//Searches that use HTTP/2 share connections
+				curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071E00
+				//A burst of searches waits for connections instead of opening one each
+				curl_multi_setopt(engine->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)BING_ENGINE_MAX_CONNECTIONS);
+#endif
+
+				//Setup thread attributes
+				pthread_attr_init(&thread_atts);
+				pthread_attr_setdetachstate(&thread_atts, PTHREAD_CREATE_DETACHED);
+
+				//Create thread
+				ret = pthread_create(&engine->thread, &thread_atts, engine_run, engine) == EOK;
+
+				//Cleanup attributes
+				pthread_attr_destroy(&thread_atts);
+
+				if(!ret)
+				{
+					curl_multi_cleanup(engine->multi);
+				}
+			}
+			if(!ret)
+			{
+				close(engine->wakeup[0]);
+				close(engine->wakeup[1]);
+			}
+		}
+
+		if(!ret)
+		{
+#if defined(BING_DEBUG)
+			BING_MSG_PRINTOUT("ENGINE: Could not start\n");
+#endif
+			search_release();
+			bing_mem_free(engine);
+			engine = NULL;
+		}
+	}
+
+	return engine;
+}
+
+BOOL engine_queue(CURL* curl, engine_done_func func, void* data, unsigned int delay)
+{
+	BOOL ret = FALSE;
+	engine_transfer* transfer;
+	engine_transfer* end;
+	engine_transfer** delayed;
+
+	if(func)
+	{
+		transfer = (engine_transfer*)bing_mem_malloc(sizeof(engine_transfer));
+		if(transfer)
+		{
+			transfer->curl = curl;
+			transfer->func = func;
+			transfer->data = data;
+			transfer->curlCode = CURLE_OK;
+			transfer->due = delay > 0 ? engine_time() + delay : 0;
+			transfer->next = NULL;
+
+			if(curl)
+			{
+				curl_easy_setopt(curl, CURLOPT_PRIVATE, (void*)transfer);
+			}
+
+			pthread_mutex_lock(&engineMutex);
+
+			if(!engineCurrent)
+			{
+				engineCurrent = engine_start();
+			}
+			if(engineCurrent && delay > 0)
+			{
+				//Soonest first (calls due at the same time are made in the order they were posted)
+				for(delayed = &engineCurrent->delayed; *delayed && (*delayed)->due <= transfer->due; delayed = &(*delayed)->next);
+				transfer->next = *delayed;
+				*delayed = transfer;
+				engine_wake(engineCurrent);
+
+				ret = TRUE;
+			}
+			else if(engineCurrent)
+			{
+				//Keep the order searches were made in
+				if(engineCurrent->pending)
+				{
+					for(end = engineCurrent->pending; end->next; end = end->next);
+					end->next = transfer;
+				}
+				else
+				{
+					engineCurrent->pending = transfer;
+				}
+				engine_wake(engineCurrent);
+
+				ret = TRUE;
+			}
+
+			pthread_mutex_unlock(&engineMutex);
+
+			if(!ret)
+			{
+				bing_mem_free(transfer);
+			}
+		}
+	}
+
+	return ret;
+}
+
+BOOL engine_add(void* curl, engine_done_func func, void* data)
+{
+	return curl && engine_queue((CURL*)curl, func, data, 0);
+}
+
+BOOL engine_post(engine_done_func func, void* data)
+{
+	return engine_queue(NULL, func, data, 0);
+}
+
+BOOL engine_post_delayed(engine_done_func func, void* data, unsigned int delay)
+{
+	return engine_queue(NULL, func, data, delay);
+}
+
+BOOL engine_cancel_post(engine_done_func func, void* data)
+{
+	BOOL ret = FALSE;
+	engine_transfer** delayed;
+	engine_transfer* transfer = NULL;
+
+	pthread_mutex_lock(&engineMutex);
+
+	if(engineCurrent)
+	{
+		for(delayed = &engineCurrent->delayed; *delayed; delayed = &(*delayed)->next)
+		{
+			if((*delayed)->func == func && (*delayed)->data == data)
+			{
+				transfer = *delayed;
+				*delayed = transfer->next;
+				ret = TRUE;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&engineMutex);
+
+	bing_mem_free(transfer);
+
+	return ret;
+}
+
+void engine_cancel(void* curl, void* data)
+{
+	engine_transfer* request;
+
+	if(curl)
+	{
+		request = (engine_transfer*)bing_mem_malloc(sizeof(engine_transfer));
+		if(request)
+		{
+			memset(request, 0, sizeof(engine_transfer));
+			request->curl = (CURL*)curl;
+			request->data = data;
+
+			pthread_mutex_lock(&engineMutex);
+
+			if(engineCurrent)
+			{
+				request->next = engineCurrent->cancelled;
+				engineCurrent->cancelled = request;
+				engine_wake(engineCurrent);
+				request = NULL;
+			}
+
+			pthread_mutex_unlock(&engineMutex);
+
+			//Nothing is running without an engine
+			bing_mem_free(request);
+		}
+	}
+}
+
+void bing_get_connection_stats(unsigned int* searches, unsigned int* connections, unsigned int* multiplexed)
+{
+	if(searches)
+	{
+		*searches = engineTransfers;
+	}
+	if(connections)
+	{
+		*connections = engineConnections;
+	}
+	if(multiplexed)
+	{
+		*multiplexed = engineMultiplexed;
+	}
+}
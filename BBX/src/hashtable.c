@@ -18,12 +18,75 @@
 
 #define MIN_ALLOC 4
 
+//If this bit is set in the size of an item, the item doesn't contain the data. It contains a pointer to a string owned by the table's string pool.
+#define POOLED_ITEM ((size_t)1 << ((sizeof(size_t) * 8) - 1))
+//If this bit is set in the size of an item, the item was stored as a string (so it can be interned when copied to a table with a pool)
+#define STRING_ITEM ((size_t)1 << ((sizeof(size_t) * 8) - 2))
+
 typedef struct hashTable
 {
 	int alloc;
 	xmlHashTablePtr table;
+	bing_string_pool* pool;
 } ht;
 
+//Item functions
+size_t ht_item_size(const void* payload)
+{
+	return *((size_t*)payload) & ~(POOLED_ITEM | STRING_ITEM);
+}
+
+BOOL ht_item_string(const void* payload)
+{
+	return (*((size_t*)payload) & (POOLED_ITEM | STRING_ITEM)) != 0;
+}
+
+const void* ht_item_data(const void* payload)
+{
+	if(*((size_t*)payload) & POOLED_ITEM)
+	{
+		return *((const char**)(payload + sizeof(size_t)));
+	}
+	return payload + sizeof(size_t);
+}
+
+void* ht_item_create(ht* hash, const void* data, size_t data_size, BOOL string)
+{
+	void* ud;
+	const char* str;
+
+	//Only values stored as strings are interned (if they are larger then a pointer and the table has a pool), other data could contain anything
+	if(string && hash->pool && data_size > sizeof(const char*) && ((const char*)data)[data_size - 1] == '\0')
+	{
+		str = string_pool_intern(hash->pool, (const char*)data, data_size - 1);
+		if(str)
+		{
+			ud = bing_mem_malloc(sizeof(size_t) + sizeof(const char*));
+			if(ud)
+			{
+				*((size_t*)ud) = data_size | POOLED_ITEM;
+				*((const char**)(ud + sizeof(size_t))) = str;
+			}
+			return ud;
+		}
+	}
+
+	ud = bing_mem_malloc(data_size + sizeof(size_t));
+	if(ud)
+	{
+		*((size_t*)ud) = string ? (data_size | STRING_ITEM) : data_size;
+		memcpy(ud + sizeof(size_t), data, data_size);
+#if defined(BING_DEBUG)
+		if(memcmp(ud + sizeof(size_t), data, data_size) != 0)
+		{
+			bing_mem_free(ud);
+			ud = NULL;
+		}
+#endif
+	}
+	return ud;
+}
+
 //Internal functions
 hashtable_t* hashtable_create(int size)
 {
@@ -35,6 +98,7 @@ hashtable_t* hashtable_create(int size)
 	if(hash)
 	{
 		hash->alloc = size < MIN_ALLOC ? MIN_ALLOC : size;
+		hash->pool = NULL;
 		hash->table = xmlHashCreate(hash->alloc);
 		if(!hash->table)
 		{
@@ -47,6 +111,7 @@ hashtable_t* hashtable_create(int size)
 
 void ht_data_deallocator(void* payload, xmlChar* name)
 {
+	//Pooled strings are owned by the pool, only the item itself is freed
 	bing_mem_free(payload);
 }
 
@@ -59,10 +124,29 @@ void hashtable_free(hashtable_t* table)
 		xmlHashFree(hash->table, ht_data_deallocator);
 		hash->table = NULL;
 		hash->alloc = 0;
+		string_pool_release(hash->pool);
+		hash->pool = NULL;
 		bing_mem_free(hash);
 	}
 }
 
+void hashtable_set_string_pool(hashtable_t* table, bing_string_pool* pool)
+{
+	ht* hash;
+	if(table)
+	{
+		hash = (ht*)table;
+
+		//Only allow the pool to be changed on an empty table, existing items could reference strings in the old pool
+		if(xmlHashSize(hash->table) == 0)
+		{
+			string_pool_retain(pool);
+			string_pool_release(hash->pool);
+			hash->pool = pool;
+		}
+	}
+}
+
 BOOL hashtable_key_exists(hashtable_t* table, const char* key)
 {
 	BOOL ret = FALSE;
@@ -73,35 +157,29 @@ BOOL hashtable_key_exists(hashtable_t* table, const char* key)
 	return ret;
 }
 
-void* ht_copy(void* payload, xmlChar* name)
+void ht_dup_value(void* payload, void* data, xmlChar* name)
 {
+	ht* nHash = (ht*)data;
 	void* nd = NULL;
 
 	if(payload)
 	{
-		//Duplicate the data
-		size_t size = *((size_t*)payload) + sizeof(size_t); //We want the size of the data then we want to add the size of a "size_t".
-		nd = bing_mem_malloc(size);
-		memcpy(nd, payload, size);
+		//Duplicate the data (interned in the destination's pool, not the source's)
+		nd = ht_item_create(nHash, ht_item_data(payload), ht_item_size(payload), ht_item_string(payload));
 	}
 
-	return nd;
-}
-
-void ht_dup_value(void* payload, void* data, xmlChar* name)
-{
-	xmlHashTablePtr nTable = (xmlHashTablePtr)data;
-
-	void* nd = ht_copy(payload, name);
-
 	//Add new value
-	xmlHashAddEntry(nTable, name, nd);
+	if(nd && xmlHashAddEntry(nHash->table, name, nd) != 0)
+	{
+		bing_mem_free(nd);
+	}
 }
 
 BOOL hashtable_copy(hashtable_t* dstTable, const hashtable_t* srcTable)
 {
 	ht* dst;
 	xmlHashTablePtr src;
+	xmlHashTablePtr nTable;
 	int c;
 	BOOL ret = FALSE;
 	if(dstTable && srcTable)
@@ -110,61 +188,39 @@ BOOL hashtable_copy(hashtable_t* dstTable, const hashtable_t* srcTable)
 		src = ((ht*)srcTable)->table;
 
 		c = xmlHashSize(src);
-		//Duplicate the table
-		if(c > dst->alloc)
+		if(c > dst->alloc || xmlHashSize(dst->table) > 0)
 		{
-			//Need to expand the table, free the old one and create the new one
-
-			//First create the new one
-			src = xmlHashCopy(src, ht_copy);
-			if(src)
+			//Need to expand or erase the table (no existing function to clear it), create the new one first
+			nTable = xmlHashCreate(c > dst->alloc ? c : dst->alloc);
+			if(nTable)
 			{
 				//Free the old one
 				xmlHashFree(dst->table, ht_data_deallocator);
 
-				dst->table = src;
-				dst->alloc = xmlHashSize(dst->table); //Get the actual size
-
-				ret = TRUE;
-			}
-			else
-			{
-				//Copy it manually
-				src = xmlHashCreate(c);
-
-				if(src)
+				dst->table = nTable;
+				if(c > dst->alloc)
 				{
-					//Duplicate the table
-					xmlHashScan(((ht*)srcTable)->table, ht_dup_value, src);
-
-					dst->alloc = xmlHashSize(dst->table); //Get the actual size
-
-					ret = TRUE;
+					dst->alloc = c;
 				}
 			}
-		}
-		else
-		{
-			//Erase the current table (no existing function to clear it)
-			c = xmlHashSize(dst->table);
-			if(c > 0)
+			else
 			{
-				//Elements exist, need to erase it
-				xmlHashFree(dst->table, ht_data_deallocator);
-				dst->table = xmlHashCreate(c);
+				return ret;
 			}
+		}
 
-			//Can simply copy the table
-			xmlHashScan(src, ht_dup_value, dst->table);
+		//Duplicate the table
+		xmlHashScan(src, ht_dup_value, dst);
 
-			ret = TRUE;
-		}
+		ret = TRUE;
 	}
 	return ret;
 }
 
 BOOL resizeHashTableSize(ht* hash, int nAlloc)
 {
+	ht nHash;
+
 	//Create hashtable
 	xmlHashTablePtr nTable = xmlHashCreate(nAlloc);
 	if(!nTable)
@@ -173,7 +229,10 @@ BOOL resizeHashTableSize(ht* hash, int nAlloc)
 	}
 
 	//Duplicate the table
-	xmlHashScan(hash->table, ht_dup_value, nTable);
+	nHash.alloc = nAlloc;
+	nHash.table = nTable;
+	nHash.pool = hash->pool;
+	xmlHashScan(hash->table, ht_dup_value, &nHash);
 
 	//Free the old table
 	xmlHashFree(hash->table, ht_data_deallocator);
@@ -207,29 +266,17 @@ BOOL hashtable_compact(hashtable_t* table)
 	return FALSE;
 }
 
-BOOL hashtable_put_item(hashtable_t* table, const char* key, const void* data, size_t data_size)
+BOOL ht_put_item(hashtable_t* table, const char* key, const void* data, size_t data_size, BOOL string)
 {
 	BOOL ret = FALSE;
 	void* ud = NULL;
 	ht* hash;
 	if(table && key && data && data_size > 0)
 	{
-		ud = bing_mem_malloc(data_size + sizeof(size_t));
+		hash = (ht*)table;
+		ud = ht_item_create(hash, data, data_size, string);
 		if(ud)
 		{
-			*((size_t*)ud) = data_size;
-			memcpy(ud + sizeof(size_t), data, data_size);
-#if defined(BING_DEBUG)
-			if(memcmp(ud + sizeof(size_t), data, data_size) != 0)
-			{
-				bing_mem_free(ud);
-				ud = NULL;
-			}
-			else
-			{
-#endif
-
-			hash = (ht*)table;
 			if(hash->alloc <= xmlHashSize(hash->table))
 			{
 				//We need to resize the table
@@ -245,14 +292,21 @@ BOOL hashtable_put_item(hashtable_t* table, const char* key, const void* data, s
 			{
 				bing_mem_free(ud);
 			}
-#if defined(BING_DEBUG)
-			}
-#endif
 		}
 	}
 	return ret;
 }
 
+BOOL hashtable_put_item(hashtable_t* table, const char* key, const void* data, size_t data_size)
+{
+	return ht_put_item(table, key, data, data_size, FALSE);
+}
+
+BOOL hashtable_put_string(hashtable_t* table, const char* key, const char* value)
+{
+	return ht_put_item(table, key, value, value ? (strlen(value) + 1) : 0, TRUE);
+}
+
 size_t hashtable_get_item(hashtable_t* table, const char* name, void* data)
 {
 	size_t ret = 0;
@@ -262,12 +316,12 @@ size_t hashtable_get_item(hashtable_t* table, const char* name, void* data)
 		dat = xmlHashLookup(((ht*)table)->table, (xmlChar*)name);
 		if(dat)
 		{
-			ret = *((size_t*)dat);
+			ret = ht_item_size(dat);
 			if(data)
 			{
-				memcpy(data, dat + sizeof(size_t), ret);
+				memcpy(data, ht_item_data(dat), ret);
 #if defined(BING_DEBUG)
-				if(memcmp(data, dat + sizeof(size_t), ret) != 0)
+				if(memcmp(data, ht_item_data(dat), ret) != 0)
 				{
 					ret = 0;
 				}
@@ -385,6 +439,23 @@ BOOL hashtable_set_data(hashtable_t* table, const char* field, const void* value
 	return ret;
 }
 
+BOOL hashtable_set_string(hashtable_t* table, const char* field, const char* value)
+{
+	BOOL ret = FALSE;
+	if(table && field)
+	{
+		if(!value && hashtable_get_item(table, field, NULL) > 0)
+		{
+			hashtable_remove_item(table, field);
+		}
+		else if(value)
+		{
+			ret = hashtable_put_string(table, field, value);
+		}
+	}
+	return ret;
+}
+
 //Public functions
 int bing_dictionary_get_data(data_dictionary_t dict, const char* name, void* data)
 {
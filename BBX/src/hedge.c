@@ -0,0 +1,168 @@
+/*
+ * hedge.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <stdlib.h>
+
+//Hedged searches. If a search hasn't received anything after a delay (a percentile of how long recent searches took to start receiving), the same search is made again on another connection. Whichever starts receiving first is used, the other is cancelled.
+
+//Searches that need to be timed before there are enough to pick a delay from
+#define HEDGE_MIN_SAMPLES 16
+
+int hedge_compare(const void* a, const void* b)
+{
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+//Must be called with the Bing mutex locked
+unsigned int hedge_percentile(bing* bingI)
+{
+	unsigned int samples[BING_HEDGE_SAMPLES];
+	unsigned int index;
+
+	if(bingI->hedgePercentile == 0 || bingI->hedgeSampleCount < HEDGE_MIN_SAMPLES)
+	{
+		return 0;
+	}
+
+	memcpy(samples, bingI->hedgeSamples, bingI->hedgeSampleCount * sizeof(unsigned int));
+	qsort(samples, bingI->hedgeSampleCount, sizeof(unsigned int), hedge_compare);
+
+	index = ((bingI->hedgeSampleCount * bingI->hedgePercentile) + 99) / 100;
+	if(index > 0)
+	{
+		index--;
+	}
+
+	//Never zero, that means there is no delay to use
+	return samples[index] > 0 ? samples[index] : 1;
+}
+
+BOOL hedge_delay(unsigned int bingID, unsigned int* delay)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	*delay = 0;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		if(bingI->hedgePercentile > 0)
+		{
+			bingI->hedgeSearches++;
+			*delay = hedge_percentile(bingI);
+			ret = TRUE;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	return ret;
+}
+
+BOOL hedge_allow(unsigned int bingID)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		//Only a fraction of searches can be hedged, each hedge is another search made with the account
+		if(bingI->hedgePercentile > 0 && (double)(bingI->hedges + 1) <= bingI->hedgeMaxFraction * (double)bingI->hedgeSearches)
+		{
+			bingI->hedges++;
+			ret = TRUE;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	return ret;
+}
+
+void hedge_sample(unsigned int bingID, unsigned int time)
+{
+	bing* bingI = retrieveBing(bingID);
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		//The oldest sample is replaced
+		bingI->hedgeSamples[bingI->hedgeSampleNext] = time;
+		bingI->hedgeSampleNext = (bingI->hedgeSampleNext + 1) % BING_HEDGE_SAMPLES;
+		if(bingI->hedgeSampleCount < BING_HEDGE_SAMPLES)
+		{
+			bingI->hedgeSampleCount++;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+}
+
+void hedge_won(unsigned int bingID)
+{
+	bing* bingI = retrieveBing(bingID);
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->hedgeWins++;
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+}
+
+int bing_set_hedging(unsigned int bingID, unsigned int percentile, double max_fraction)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI && percentile <= 100 && max_fraction >= 0.0)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->hedgePercentile = percentile;
+		bingI->hedgeMaxFraction = max_fraction;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
+
+int bing_get_hedging_stats(unsigned int bingID, bing_hedging_stats_t stats)
+{
+	BOOL ret = FALSE;
+	bing* bingI = retrieveBing(bingID);
+	if(bingI && stats)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		stats->searches = bingI->hedgeSearches;
+		stats->hedges = bingI->hedges;
+		stats->wins = bingI->hedgeWins;
+		stats->delay = hedge_percentile(bingI);
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
@@ -0,0 +1,315 @@
+/*
+ * prefetch.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+//Next page prefetching. When a search completes, the next page is searched for in the background so that a request for the next page can be returned right away.
+
+typedef struct PREFETCH_REQUEST_S
+{
+	unsigned int bing;
+	char* url;
+} prefetch_request;
+
+//Must be called with the Bing mutex locked
+bing_prefetch* prefetch_find(bing* bingI, const char* url, bing_prefetch** prev)
+{
+	bing_prefetch* entry;
+	*prev = NULL;
+	for(entry = bingI->prefetch; entry; entry = entry->next)
+	{
+		if(strcmp(entry->url, url) == 0)
+		{
+			break;
+		}
+		*prev = entry;
+	}
+	return entry;
+}
+
+//Must be called with the Bing mutex locked
+void prefetch_unlink(bing* bingI, bing_prefetch* entry, bing_prefetch* prev)
+{
+	if(prev)
+	{
+		prev->next = entry->next;
+	}
+	else
+	{
+		bingI->prefetch = entry->next;
+	}
+	entry->next = NULL;
+
+	if(entry->response)
+	{
+		bingI->prefetchBytes -= entry->size;
+	}
+}
+
+void prefetch_entry_free(bing_prefetch* entry)
+{
+	bing_mem_free(entry->url);
+	bing_mem_free(entry);
+}
+
+void prefetch_start(unsigned int bingID, const char* url, unsigned int level)
+{
+	bing* bingI = retrieveBing(bingID);
+	bing_prefetch* entry = NULL;
+	bing_prefetch* prev;
+	prefetch_request* request;
+	char* searchUrl;
+	BOOL started = FALSE;
+
+	if(bingI && url)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		//Only prefetch if it's within the depth and there is room for it
+		if(level <= bingI->prefetchDepth && (bingI->prefetchMaxBytes == 0 || bingI->prefetchBytes < bingI->prefetchMaxBytes) &&
+				!prefetch_find(bingI, url, &prev))
+		{
+			entry = (bing_prefetch*)bing_mem_malloc(sizeof(bing_prefetch));
+			if(entry)
+			{
+				memset(entry, 0, sizeof(bing_prefetch));
+				entry->url = bing_mem_strdup(url);
+				entry->level = level;
+				if(entry->url)
+				{
+					//Oldest first
+					if(prev)
+					{
+						prev->next = entry;
+					}
+					else
+					{
+						bingI->prefetch = entry;
+					}
+					bingI->prefetchRequests++;
+				}
+				else
+				{
+					bing_mem_free(entry);
+					entry = NULL;
+				}
+			}
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		if(entry)
+		{
+			//The search modifies the URL it's given
+			searchUrl = bing_mem_strdup(url);
+			request = (prefetch_request*)bing_mem_malloc(sizeof(prefetch_request));
+			if(searchUrl && request)
+			{
+				request->bing = bingID;
+				request->url = bing_mem_strdup(url);
+				started = request->url && search_async_url_in(bingID, searchUrl, 0, request, FALSE, NULL, prefetch_done);
+			}
+			bing_mem_free(searchUrl);
+
+			if(!started)
+			{
+				if(request)
+				{
+					bing_mem_free(request->url);
+					bing_mem_free(request);
+				}
+
+				pthread_mutex_lock(&bingI->mutex);
+
+				if(prefetch_find(bingI, url, &prev) == entry)
+				{
+					prefetch_unlink(bingI, entry, prev);
+					prefetch_entry_free(entry);
+				}
+
+				pthread_mutex_unlock(&bingI->mutex);
+			}
+		}
+	}
+}
+
+void prefetch_next(bing_response* response, unsigned int level)
+{
+	if(response && response->nextUrl)
+	{
+		prefetch_start(response->bing, response->nextUrl, level + 1);
+	}
+}
+
+void prefetch_done(bing_response_t response, const void* user_data)
+{
+	prefetch_request* request = (prefetch_request*)user_data;
+	bing* bingI = retrieveBing(request->bing);
+	bing_response* res = (bing_response*)response;
+	bing_prefetch* entry = NULL;
+	bing_prefetch* prev;
+	bing_prefetch* evicted = NULL;
+	bing_prefetch* oldest;
+	bing_prefetch* oldestPrev;
+	char* nextUrl = NULL;
+	unsigned int level = 0;
+	BOOL kept;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		entry = prefetch_find(bingI, request->url, &prev);
+		if(entry && !entry->response)
+		{
+			if(res)
+			{
+				entry->response = res;
+				entry->size = res->decodedBytes;
+				bingI->prefetchBytes += entry->size;
+				level = entry->level;
+				kept = TRUE;
+
+				//Stay within budget by discarding the oldest responses
+				while(bingI->prefetchMaxBytes > 0 && bingI->prefetchBytes > bingI->prefetchMaxBytes)
+				{
+					oldestPrev = NULL;
+					for(oldest = bingI->prefetch; oldest && !oldest->response; oldest = oldest->next)
+					{
+						oldestPrev = oldest;
+					}
+					if(!oldest)
+					{
+						break;
+					}
+					if(oldest == entry)
+					{
+						kept = FALSE;
+					}
+					prefetch_unlink(bingI, oldest, oldestPrev);
+					oldest->next = evicted;
+					evicted = oldest;
+					bingI->prefetchDiscarded++;
+				}
+
+				if(kept && res->nextUrl)
+				{
+					//The response could be taken as soon as the mutex is unlocked
+					nextUrl = bing_mem_strdup(res->nextUrl);
+				}
+			}
+			else
+			{
+				//Search failed
+				prefetch_unlink(bingI, entry, prev);
+				prefetch_entry_free(entry);
+			}
+			res = NULL;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	//Not wanted anymore
+	bing_response_free((bing_response_t)res);
+
+	//Responses can only be freed when the Bing mutex isn't locked
+	while((entry = evicted))
+	{
+		evicted = entry->next;
+		bing_response_free((bing_response_t)entry->response);
+		prefetch_entry_free(entry);
+	}
+
+	//Keep going until the depth is reached
+	if(nextUrl)
+	{
+		prefetch_start(request->bing, nextUrl, level + 1);
+		bing_mem_free(nextUrl);
+	}
+
+	bing_mem_free(request->url);
+	bing_mem_free(request);
+}
+
+bing_response* prefetch_take(unsigned int bingID, const char* url)
+{
+	bing* bingI = retrieveBing(bingID);
+	bing_response* ret = NULL;
+	bing_prefetch* entry;
+	bing_prefetch* prev;
+
+	if(bingI && url)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		if(bingI->prefetchDepth > 0)
+		{
+			entry = prefetch_find(bingI, url, &prev);
+			if(entry && entry->response)
+			{
+				prefetch_unlink(bingI, entry, prev);
+				ret = entry->response;
+				prefetch_entry_free(entry);
+
+				bingI->prefetchHits++;
+			}
+			else
+			{
+				//Not prefetched, or still being searched for
+				bingI->prefetchMisses++;
+
+				if(entry)
+				{
+					//The caller searches for it instead (asynchronous searches share the transfer that is running), so the prefetched response won't be wanted
+					prefetch_unlink(bingI, entry, prev);
+					prefetch_entry_free(entry);
+				}
+			}
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	return ret;
+}
+
+void prefetch_free(bing* bingI)
+{
+	bing_prefetch* entry;
+
+	//The responses belong to the Bing instance, they are freed with it
+	while((entry = bingI->prefetch))
+	{
+		bingI->prefetch = entry->next;
+		prefetch_entry_free(entry);
+	}
+	bingI->prefetchBytes = 0;
+}
+
+int bing_get_prefetch_stats(unsigned int bingID, bing_prefetch_stats_t stats)
+{
+	BOOL ret = FALSE;
+	bing* bingI = retrieveBing(bingID);
+	if(bingI && stats)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		stats->prefetches = bingI->prefetchRequests;
+		stats->hits = bingI->prefetchHits;
+		stats->misses = bingI->prefetchMisses;
+		stats->discarded = bingI->prefetchDiscarded;
+		stats->hit_rate = (bingI->prefetchHits + bingI->prefetchMisses) > 0 ? ((double)bingI->prefetchHits / (double)(bingI->prefetchHits + bingI->prefetchMisses)) : 0.0;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
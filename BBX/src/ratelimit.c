@@ -0,0 +1,310 @@
+/*
+ * ratelimit.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+//Rate limiting. Each account key has a limited number of transactions, so each account key gets a token bucket. Every request made with the account key takes a token, and tokens are added at a steady rate up to the burst size.
+//When the bucket is empty, a request either waits for a token (it's given one that hasn't been added yet, so the bucket goes below zero and the requests that wait are made in order) or fails right away.
+//A Bing instance keeps the bucket of it's account key, so it only has to be looked up when the account key changes. The bucket is removed once no Bing instance uses it.
+
+#define RATE_BUCKETS 64
+
+typedef struct RATE_BUCKET_S
+{
+	char* accountKey;
+	unsigned int hash;
+	unsigned int users; //Bing instances using the bucket, it's removed when none are
+	double tokens; //Below zero if requests are waiting for tokens
+	unsigned long long updated; //When (engine_time) tokens were last added
+
+	//Stats
+	unsigned int requests;
+	unsigned int delayed;
+	unsigned int rejected;
+	unsigned long long waited; //Total wait (ms) of the requests that were delayed
+	unsigned int maxWait;
+
+	struct RATE_BUCKET_S* bucketNext;
+} rate_bucket;
+
+static pthread_mutex_t rateMutex = PTHREAD_MUTEX_INITIALIZER;
+static rate_bucket* rateBuckets[RATE_BUCKETS];
+static unsigned int rateGeneration = 0; //Changes every time the buckets are cleared, so Bing instances know the bucket they have is gone
+
+//Settings (there is no limit until a rate is set)
+static double rateRate = 0.0; //Tokens each second
+static unsigned int rateBurst = 0;
+static BOOL rateQueue = FALSE;
+
+unsigned int rate_hash(const char* accountKey)
+{
+	unsigned int hash = 5381;
+	while(*accountKey)
+	{
+		hash = ((hash << 5) + hash) + (unsigned char)*(accountKey++);
+	}
+	return hash;
+}
+
+//Must be called with the rate mutex locked
+rate_bucket** rate_bucket_find(const char* accountKey, unsigned int hash)
+{
+	rate_bucket** bucket;
+
+	for(bucket = &rateBuckets[hash % RATE_BUCKETS]; *bucket; bucket = &(*bucket)->bucketNext)
+	{
+		if((*bucket)->hash == hash && strcmp((*bucket)->accountKey, accountKey) == 0)
+		{
+			break;
+		}
+	}
+	return bucket;
+}
+
+void rate_bucket_free(rate_bucket* bucket)
+{
+	bing_mem_free(bucket->accountKey);
+	bing_mem_free(bucket);
+}
+
+//Must be called with the rate mutex locked. The Bing instance no longer uses it's bucket.
+void rate_bucket_release(bing* bingI)
+{
+	rate_bucket* bucket = (rate_bucket*)bingI->rateBucket;
+	rate_bucket** existing;
+
+	if(bucket && bingI->rateGeneration == rateGeneration && --bucket->users == 0)
+	{
+		existing = rate_bucket_find(bucket->accountKey, bucket->hash);
+		if(*existing == bucket)
+		{
+			*existing = bucket->bucketNext;
+		}
+		rate_bucket_free(bucket);
+	}
+	bingI->rateBucket = NULL;
+}
+
+//Must be called with the rate mutex locked. Get the bucket for the account key the Bing instance has now (the instance keeps it, so it's only looked up when the account key changes).
+rate_bucket* rate_bucket_use(bing* bingI, const char* accountKey)
+{
+	rate_bucket* bucket = (rate_bucket*)bingI->rateBucket;
+	rate_bucket** existing;
+	unsigned int hash;
+
+	if(bucket && bingI->rateGeneration == rateGeneration && strcmp(bucket->accountKey, accountKey) == 0)
+	{
+		return bucket;
+	}
+
+	rate_bucket_release(bingI);
+
+	hash = rate_hash(accountKey);
+	existing = rate_bucket_find(accountKey, hash);
+	bucket = *existing;
+	if(!bucket)
+	{
+		bucket = (rate_bucket*)bing_mem_malloc(sizeof(rate_bucket));
+		if(bucket)
+		{
+			memset(bucket, 0, sizeof(rate_bucket));
+			bucket->accountKey = bing_mem_strdup(accountKey);
+			if(bucket->accountKey)
+			{
+				bucket->hash = hash;
+
+				//Starts full
+				bucket->tokens = (double)rateBurst;
+				bucket->updated = engine_time();
+
+				*existing = bucket;
+			}
+			else
+			{
+				bing_mem_free(bucket);
+				bucket = NULL;
+			}
+		}
+	}
+
+	if(bucket)
+	{
+		bucket->users++;
+		bingI->rateBucket = bucket;
+		bingI->rateGeneration = rateGeneration;
+	}
+
+	return bucket;
+}
+
+//Must be called with the rate mutex locked
+void rate_bucket_fill(rate_bucket* bucket)
+{
+	unsigned long long now = engine_time();
+
+	bucket->tokens += ((double)(now - bucket->updated) * rateRate) / 1000.0;
+	if(bucket->tokens > (double)rateBurst)
+	{
+		bucket->tokens = (double)rateBurst;
+	}
+	bucket->updated = now;
+}
+
+//Must be called with the rate mutex locked
+void rate_clear()
+{
+	rate_bucket* bucket;
+	int i;
+
+	for(i = 0; i < RATE_BUCKETS; i++)
+	{
+		while((bucket = rateBuckets[i]))
+		{
+			rateBuckets[i] = bucket->bucketNext;
+			rate_bucket_free(bucket);
+		}
+	}
+
+	//Any bucket a Bing instance has is gone
+	rateGeneration++;
+}
+
+void rate_release(bing* bingI)
+{
+	pthread_mutex_lock(&rateMutex);
+	rate_bucket_release(bingI);
+	pthread_mutex_unlock(&rateMutex);
+}
+
+BOOL rate_take(unsigned int bingID, BOOL optional, unsigned int maxWait, unsigned int* wait)
+{
+	bing* bingI;
+	char* accountKey;
+	rate_bucket* bucket;
+	BOOL ret = TRUE;
+
+	*wait = 0;
+
+	pthread_mutex_lock(&rateMutex);
+
+	if(rateRate > 0.0 && (bingI = retrieveBing(bingID)) && (accountKey = retrieveAccountKey(bingID)))
+	{
+		bucket = rate_bucket_use(bingI, accountKey);
+		if(bucket)
+		{
+			rate_bucket_fill(bucket);
+
+			if(bucket->tokens >= 1.0)
+			{
+				bucket->tokens -= 1.0;
+			}
+			else if(rateQueue && !optional)
+			{
+				//Wait until the token is added
+				*wait = (unsigned int)((((1.0 - bucket->tokens) * 1000.0) / rateRate) + 0.5);
+				if(*wait == 0)
+				{
+					*wait = 1;
+				}
+
+				if(maxWait > 0 && *wait > maxWait)
+				{
+					//Not worth waiting for, so the token isn't taken
+					ret = FALSE;
+				}
+				else
+				{
+					bucket->tokens -= 1.0;
+					bucket->delayed++;
+					bucket->waited += *wait;
+					if(*wait > bucket->maxWait)
+					{
+						bucket->maxWait = *wait;
+					}
+				}
+			}
+			else
+			{
+				ret = FALSE;
+			}
+
+			if(ret)
+			{
+				bucket->requests++;
+			}
+			else
+			{
+				bucket->rejected++;
+			}
+		}
+
+		bing_mem_free(accountKey);
+	}
+
+	pthread_mutex_unlock(&rateMutex);
+
+	return ret;
+}
+
+int bing_set_rate_limit(double rate, unsigned int burst, int queue)
+{
+	BOOL ret = FALSE;
+	if(rate >= 0.0)
+	{
+		pthread_mutex_lock(&rateMutex);
+
+		rateRate = rate;
+		rateBurst = burst > 0 ? burst : 1;
+		rateQueue = queue ? TRUE : FALSE;
+
+		//Start over, with full buckets
+		rate_clear();
+
+		pthread_mutex_unlock(&rateMutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
+
+int bing_get_rate_limit_stats(unsigned int bingID, bing_rate_limit_stats_t stats)
+{
+	BOOL ret = FALSE;
+	char* accountKey;
+	rate_bucket* bucket;
+
+	if(stats && (accountKey = retrieveAccountKey(bingID)))
+	{
+		memset(stats, 0, sizeof(bing_rate_limit_stats_s));
+
+		pthread_mutex_lock(&rateMutex);
+
+		stats->tokens = (double)rateBurst;
+
+		bucket = *rate_bucket_find(accountKey, rate_hash(accountKey));
+		if(bucket)
+		{
+			rate_bucket_fill(bucket);
+
+			stats->requests = bucket->requests;
+			stats->delayed = bucket->delayed;
+			stats->rejected = bucket->rejected;
+			stats->max_wait = bucket->maxWait;
+			stats->average_wait = bucket->delayed > 0 ? ((double)bucket->waited / (double)bucket->delayed) : 0.0;
+			stats->tokens = bucket->tokens;
+		}
+
+		pthread_mutex_unlock(&rateMutex);
+
+		bing_mem_free(accountKey);
+
+		ret = TRUE;
+	}
+	return ret;
+}
@@ -9,6 +9,8 @@
 
 #include "bing_internal.h"
 
+#include <limits.h>
+
 #define REQ_MAX_TOTAL "maxTotal"
 #define REQ_OFFSET "offset"
 #define REQ_MARKET "market"
@@ -26,6 +28,8 @@
 #define REQ_WEB_FILETYPE "filetype"
 #define REQ_WEB_OPTIONS "weboptions"
 
+#define REQ_RESULT_LIMIT "resultLimit"
+
 //If a field is marked as BING_FIELD_SUPPORT_ALL_FIELDS, it will be removed when added to a composite request and/or blocked on that request afterwards
 static bing_field_search request_fields[] =
 {
@@ -48,7 +52,10 @@ static bing_field_search request_fields[] =
 
 		//Web
 		{{BING_REQUEST_FIELD_FILE_TYPE,				FIELD_TYPE_STRING,	REQ_WEB_FILETYPE,	1,	{BING_SOURCETYPE_WEB}},								&request_fields[12]},
-		{{BING_REQUEST_FIELD_WEB_OPTIONS,			FIELD_TYPE_STRING,	REQ_WEB_OPTIONS,	1,	{BING_SOURCETYPE_WEB}},								NULL}
+		{{BING_REQUEST_FIELD_WEB_OPTIONS,			FIELD_TYPE_STRING,	REQ_WEB_OPTIONS,	1,	{BING_SOURCETYPE_WEB}},								&request_fields[13]},
+
+		//Client side (never part of the URL)
+		{{BING_REQUEST_FIELD_RESULT_LIMIT,			FIELD_TYPE_LONG,	REQ_RESULT_LIMIT,	BING_FIELD_SUPPORT_ALL_FIELDS,	{}},					NULL}
 };
 
 #define DEFAULT_ELEMENT_COUNT 5
@@ -552,6 +559,16 @@ int request_set_str_data(bing_request_t request, enum BING_REQUEST_FIELD field,
 	return ret;
 }
 
+unsigned int request_get_result_limit(bing_request_t request)
+{
+	long long limit = 0;
+	if(!request_get_data(request, BING_REQUEST_FIELD_RESULT_LIMIT, FIELD_TYPE_LONG, &limit, sizeof(long long)) || limit <= 0)
+	{
+		return 0;
+	}
+	return limit > UINT_MAX ? UINT_MAX : (unsigned int)limit;
+}
+
 int bing_request_get_32bit_int(bing_request_t request, enum BING_REQUEST_FIELD field, int* value)
 {
 	return request_get_data(request, field, FIELD_TYPE_INT, value, sizeof(int));
@@ -1026,7 +1043,7 @@ int bing_request_custom_set_string(bing_request_t request, const char* field, co
 {
 	if(canSetField(request, field))
 	{
-		return hashtable_set_data(((bing_request*)request)->data, field, value, value ? (strlen(value) + 1) : 0);
+		return hashtable_set_string(((bing_request*)request)->data, field, value);
 	}
 	return FALSE;
 }
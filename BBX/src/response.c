@@ -100,7 +100,7 @@ BOOL response_def_create_standard_responses(bing_response_t response, data_dicti
 				//We don't want to save the data if it is a composite response
 				if(strcmp((char*)data, PARSE_COMPOSITE_IDENT) != 0)
 				{
-					hashtable_set_data(res->data, RESPONSE_QUERY_STR, data, strlen((char*)data) + 1);
+					hashtable_set_string(res->data, RESPONSE_QUERY_STR, (char*)data);
 				}
 
 				bing_mem_free((void*)data);
@@ -641,10 +641,25 @@ BOOL response_create(enum BING_SOURCE_TYPE type, bing_response_t* response, unsi
 			res->allocatedMemoryCount = 0;
 			res->allocatedMemory = NULL;
 
+			res->stream = NULL;
+
+			//Internal responses share the parent's string pool
+			if(responseParent)
+			{
+				res->pool = responseParent->pool;
+				string_pool_retain(res->pool);
+			}
+			else
+			{
+				res->pool = string_pool_create();
+			}
+
 			//Create hashtable
 			res->data = hashtable_create(tableSize);
 			if(res->data)
 			{
+				hashtable_set_string_pool(res->data, res->pool);
+
 				if(res->bing != 0)
 				{
 					//Add response to Bing object
@@ -664,12 +679,14 @@ BOOL response_create(enum BING_SOURCE_TYPE type, bing_response_t* response, unsi
 				else
 				{
 					hashtable_free(res->data);
+					string_pool_release(res->pool);
 					bing_mem_free(res);
 				}
 			}
 			else
 			{
 				//Hashtable couldn't be created
+				string_pool_release(res->pool);
 				bing_mem_free(res);
 			}
 		}
@@ -795,6 +812,13 @@ BOOL free_response_in(bing_response_t response, BOOL composite_free)
 			bing_mem_free(res->internalResults);
 			res->internalResults = NULL;
 
+			stream_release(res->stream);
+			res->stream = NULL;
+
+			//Release the string pool last, everything above could be using it
+			string_pool_release(res->pool);
+			res->pool = NULL;
+
 			bing_mem_free(res);
 
 			ret = TRUE;
@@ -803,6 +827,24 @@ BOOL free_response_in(bing_response_t response, BOOL composite_free)
 	return ret;
 }
 
+int bing_response_get_transfer_stats(bing_response_t response, bing_transfer_stats_t stats)
+{
+	BOOL ret = FALSE;
+	bing_response* res;
+	if(response && stats)
+	{
+		res = (bing_response*)response;
+
+		stats->wire_bytes = res->wireBytes;
+		stats->decoded_bytes = res->decodedBytes;
+		stats->compression_ratio = res->wireBytes > 0 ? ((double)res->decodedBytes / (double)res->wireBytes) : 1.0;
+		stats->attempts = res->attempts;
+
+		ret = TRUE;
+	}
+	return ret;
+}
+
 int bing_response_free(bing_response_t response)
 {
 	return free_response_in(response, FALSE);
@@ -993,7 +1035,7 @@ int bing_response_custom_set_p_64bit_int(bing_response_t response, const char* f
 
 int bing_response_custom_set_string(bing_response_t response, const char* field, const char* value)
 {
-	return hashtable_set_data(response ? ((bing_response*)response)->data : NULL, field, value, value ? (strlen(value) + 1) : 0);
+	return hashtable_set_string(response ? ((bing_response*)response)->data : NULL, field, value);
 }
 
 int bing_response_custom_set_p_double(bing_response_t response, const char* field, const double* value)
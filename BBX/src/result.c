@@ -48,7 +48,7 @@ int result_def_common_create(const char* name, bing_result_t result, data_dictio
 		}
 		if(str)
 		{
-			hashtable_set_data(table, BING_RESULT_TYPE_FIELD, str, strlen(str) + 1);
+			hashtable_set_string(table, BING_RESULT_TYPE_FIELD, str);
 		}
 	}
 	return ret;
@@ -129,18 +129,26 @@ void loadThumbnail(hashtable_t* resultData, hashtable_t* new_resultData, bing_re
 			thumbnail->media_url = NULL;
 		}
 
+		//Content types repeat across most thumbnails, so use the response's string pool
+		thumbnail->content_type = NULL;
 		size = hashtable_get_string(new_resultData, RES_IMAGE_CONTENTTYPE, NULL);
 		if(size > 0)
 		{
-			thumbnail->content_type = str = allocateMemory(size, pres);
+			str = bing_mem_malloc(size);
 			if(str)
 			{
 				hashtable_get_string(new_resultData, RES_IMAGE_CONTENTTYPE, str);
+				thumbnail->content_type = string_pool_intern(pres->pool, str, size - 1);
+				bing_mem_free(str);
+			}
+			if(!thumbnail->content_type)
+			{
+				thumbnail->content_type = str = allocateMemory(size, pres);
+				if(str)
+				{
+					hashtable_get_string(new_resultData, RES_IMAGE_CONTENTTYPE, str);
+				}
 			}
-		}
-		else
-		{
-			thumbnail->content_type = NULL;
 		}
 
 		hashtable_get_data_key(new_resultData, RES_IMAGE_HEIGHT, &thumbnail->height, sizeof(int));
@@ -278,10 +286,13 @@ BOOL result_create(enum BING_SOURCE_TYPE type, bing_result_t* result, bing_respo
 			res->type = type;
 			res->creation = creation;
 			res->additionalResult = additionalResult;
+			res->streamBytes = 0;
 
 			res->data = hashtable_create(tableSize);
 			if(res->data)
 			{
+				hashtable_set_string_pool(res->data, responseParent->pool);
+
 				//Add result to response
 				if(response_add_result(responseParent, res, RESULT_CREATE_DEFAULT_INTERNAL))
 				{
@@ -496,7 +507,7 @@ int bing_result_custom_set_p_64bit_int(bing_result_t result, const char* field,
 
 int bing_result_custom_set_string(bing_result_t result, const char* field, const char* value)
 {
-	return hashtable_set_data(result ? ((bing_result*)result)->data : NULL, field, value, value ? (strlen(value) + 1) : 0);
+	return hashtable_set_string(result ? ((bing_result*)result)->data : NULL, field, value);
 }
 
 int bing_result_custom_set_p_double(bing_result_t result, const char* field, const double* value)
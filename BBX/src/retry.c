@@ -0,0 +1,119 @@
+/*
+ * retry.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+//Retrying failed transfers. Failures that could go away on their own (the connection, timeouts, the server being busy) are retried, with a random delay that grows with each attempt (decorrelated jitter), so many searches failing at once don't retry at the same time.
+//Failures that would only happen again (parsing, the request being wrong) aren't retried.
+
+void retry_setup(unsigned int bingID, bing_retry* retry)
+{
+	bing* bingI = retrieveBing(bingID);
+
+	memset(retry, 0, sizeof(bing_retry));
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		retry->maxAttempts = bingI->retryMaxAttempts;
+		retry->baseDelay = bingI->retryBaseDelay;
+		retry->maxDelay = bingI->retryMaxDelay;
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	retry->seed = (unsigned int)engine_time() ^ (unsigned int)(size_t)retry;
+}
+
+BOOL retry_status(long httpStatus)
+{
+	//Too many requests, or the server had a problem
+	return httpStatus == 429 || (httpStatus >= 500 && httpStatus < 600);
+}
+
+BOOL retry_error(int curlCode)
+{
+	switch(curlCode)
+	{
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_SSL_CONNECT_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_PARTIAL_FILE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+BOOL retry_next(bing_retry* retry, int curlCode, long httpStatus)
+{
+	unsigned int low;
+	unsigned int high;
+
+	if(retry->attempts >= retry->maxAttempts || !(curlCode == CURLE_OK ? retry_status(httpStatus) : retry_error(curlCode)))
+	{
+		return FALSE;
+	}
+
+	//Decorrelated jitter: random between the base delay and three times the last delay, up to the max delay
+	low = retry->baseDelay;
+	high = retry->delay > 0 ? retry->delay * 3 : low;
+	if(high < low)
+	{
+		high = low;
+	}
+	retry->delay = low + (high > low ? (unsigned int)(rand_r(&retry->seed) % (high - low + 1)) : 0);
+	if(retry->maxDelay > 0 && retry->delay > retry->maxDelay)
+	{
+		retry->delay = retry->maxDelay;
+	}
+
+	return TRUE;
+}
+
+void retry_sleep(unsigned int delay)
+{
+	struct timespec ts;
+
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (long)(delay % 1000) * 1000000L;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+int bing_set_retry(unsigned int bingID, unsigned int max_attempts, unsigned int base_delay, unsigned int max_delay)
+{
+	bing* bingI = retrieveBing(bingID);
+	BOOL ret = FALSE;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		bingI->retryMaxAttempts = max_attempts;
+		bingI->retryBaseDelay = base_delay;
+		bingI->retryMaxDelay = max_delay;
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		ret = TRUE;
+	}
+
+	return ret;
+}
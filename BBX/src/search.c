@@ -10,6 +10,9 @@
 #include "bing_internal.h"
 
 #include <stdbool.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
 #include <bps/event.h>
 #include <bps/netstatus.h>
 
@@ -34,11 +37,6 @@
 #define PARSE_LINK_PROPERTY_HREF "href"
 #define PARSE_LINK_THIS_KEY "#thisLink"
 
-//Defines for cURL
-#define CURL_TRUE 1L
-#define CURL_FALSE 0L
-#define CURL_EMPTY_STRING ""
-
 enum PARSER_ERROR
 {
 	PE_NO_ERROR,
@@ -99,7 +97,13 @@ enum PARSER_ERROR
 	PE_CURL_OK_HTTP_RESPONSE_NOT_FOUND,
 	PE_CURL_OK_CONTEXT_NOT_OK,
 	PE_CURL_OK_HTTP_RESPONSE_CODE_FAIL,
-	PE_CURL_URL_PROC_RESET_FAIL
+	PE_CURL_URL_PROC_RESET_FAIL,
+
+	//Deadline
+	PE_DEADLINE_PASSED,
+
+	//Rate limit
+	PE_RATE_LIMITED
 };
 
 //Just some general codes
@@ -107,20 +111,31 @@ enum HTTP_CODES
 {
 	HTTP_NO_RESPONSE = 0,
 
+	HTTP_NOT_MODIFIED = 304,
+
 	HTTP_NOT_FOUND = 404
 };
 
+enum HEDGE_STATE
+{
+	HEDGE_NONE, //Not hedged
+	HEDGE_WAITING, //Waiting to see if the search needs to be hedged
+	HEDGE_RUNNING, //Both transfers are running, neither has received anything
+	HEDGE_DECIDED //Only one transfer is used
+};
+
 typedef struct PARSER_STACK_S
 {
 	void* value;
 	struct PARSER_STACK_S* prev;
 } pstack;
 
-typedef struct PARSER_URL_PROCESS
+typedef struct SEARCH_WAIT_S
 {
-	const char* url;
-	struct PARSER_URL_PROCESS* next;
-} p_url_process;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	BOOL done;
+} search_wait;
 
 typedef struct BING_PARSER_S
 {
@@ -128,20 +143,98 @@ typedef struct BING_PARSER_S
 	bing_response* response;
 	bing_response* current;
 
-	//Special processing
-	p_url_process* additionalUrlProcessing;
+	//Special processing (each additional URL is downloaded by it's own parser, at the same time as this one)
+	struct BING_PARSER_S* fanout; //In URL order
+	struct BING_PARSER_S* fanoutNext;
+	struct BING_PARSER_S* fanoutParent;
+	volatile unsigned int fanoutPending; //Transfers that haven't completed
+	search_wait* fanoutWait; //Set if a synchronous search is waiting for the transfers
+	int curlCode; //Result of the transfer
 
 	//State info
 	unsigned int bing;
-	CURL* curl;
-	pthread_t thread;
 	xmlParserCtxtPtr ctx; //Reciprocal pointer so we can pass the parser to get all the info and still get the context that the parser is contained in
 	receive_bing_response_func responseFunc;
 	const void* userData;
 	int bpsChannel;
 	enum PARSER_ERROR parseError;
+
+	//Streaming
+	receive_bing_result_func resultFunc;
+	bing_stream* stream;
+	BOOL streamHeaderDone;
+	size_t streamUndelivered; //Bytes received since the last result was delivered
+	bing_response* streamFailedResponse; //Results could still be in use when an error occurs, so the response is held until the search is done
+
+	//Memory for everything libxml allocates while parsing
+	bing_arena* arena;
+
+	//Result limit
+	unsigned int resultLimit;
+	unsigned int resultLimitCount; //Number of complete entries received
+	xmlNodePtr resultLimitNode; //Last entry counted
+	BOOL resultLimitReached;
+
+	//Transfer size, of all URLs
+	size_t wireBytes;
+	size_t decodedBytes;
+
+	//Coalescing (identical searches share one transfer)
+	char* flightUrl; //Set while other searches can join this one
+	char* flightAccountKey;
+	struct BING_PARSER_S* flightNext;
+	struct BING_PARSER_S* followers; //Searches that joined this one, in the order they joined. They are given the same data.
+	struct BING_PARSER_S* followerNext;
+
+	//Body cache
+	char* cacheUrl; //Set if the received data is being kept for the cache
+	char* cacheData; //Data being kept, or the cached data if cacheHit is set
+	size_t cacheSize;
+	size_t cacheAlloc;
+	size_t cacheLimit;
+	BOOL cacheHit;
+	BOOL cacheRefresh; //A background refresh of stale data, nobody is given it's response (other then searches that joined it)
+	BOOL cacheRefreshOnly; //The refresh only made the cached data good for another TTL, so there's nothing to parse
+	char* cacheEtag; //Validators received with the data
+	char* cacheModified;
+
+	//Hedging (only used on the engine thread, once the search starts)
+	enum HEDGE_STATE hedgeState;
+	unsigned int hedgeDelay; //Zero if the search is only being timed
+	unsigned long long hedgeStart;
+	BOOL hedgeWon; //The hedge is the transfer being used (it becomes the transfer's handle)
+
+	//Retrying
+	bing_retry retry;
+	BOOL retryDiscard; //The response will be retried, so what is received isn't used
+
+	//Deadline (the transfer has when it is)
+	BOOL timedOut;
+
+	//Rate limit
+	BOOL rateLimited; //A transfer couldn't be made, the account key is out of tokens
+
+	//Cancelling
+	int searchID; //Zero if the search can't be cancelled (the transfer is marked cancelled)
+
+	//Transport (see transport.c)
+	bing_transfer transfer;
+
+	//Record/replay
+	enum BING_CAPTURE_MODE captureMode;
+	BOOL captureRecording; //What the transfer receives is being kept, to be recorded
+	unsigned long long captureStart; //When (engine_time) the transfer was made
+	bing_capture capture; //The response being recorded
 } bing_parser;
 
+typedef struct SEARCH_HANDLE_S
+{
+	int id;
+	bing_parser* parser; //NULL if a prefetched response is being delivered
+	BOOL cancelled;
+	struct SEARCH_HANDLE_S* next;
+} search_handle;
+
 xmlAttrPtr nsXmlHasPropFind(xmlNodePtr node, const char* prefix, const char* name)
 {
 	//Based off libxml's xmlGetPropNodeInternal
@@ -241,7 +334,18 @@ BOOL canContinue(bing_parser* parser)
 		//Error, cleanup everything
 
 		//Now free the response (no stacks will exist if a response doesn't exist. Allocated memory, internal responses, and all results are associated with the parent response. Freeing the response will free everything.)
-		bing_response_free(parser->response);
+		if(parser->stream)
+		{
+			//Streamed results may still be in use by the developer, so we hold onto it until the search has completed
+			if(parser->response)
+			{
+				parser->streamFailedResponse = parser->response;
+			}
+		}
+		else
+		{
+			bing_response_free(parser->response);
+		}
 
 		//Mark everything as NULL to prevent errors later
 		parser->response = NULL;
@@ -366,7 +470,7 @@ bing_result* parseResult(xmlNodePtr resultNode, BOOL type, bing_response* parent
 								xmlFree((void*)xmlText);
 
 								xmlText = nsXmlGetProp(node, PARSE_LINK_PROPERTY_HREF);
-								if(!hashtable_put_item(data, PARSE_LINK_NEXT_KEY, xmlText, strlen((char*)xmlText) + 1))
+								if(!hashtable_put_string(data, PARSE_LINK_NEXT_KEY, (char*)xmlText))
 								{
 									//Failed to save "next" link
 									parser->parseError = PE_PRESULT_NODE_NEXT_SAVE_FAIL;
@@ -377,7 +481,7 @@ bing_result* parseResult(xmlNodePtr resultNode, BOOL type, bing_response* parent
 								xmlFree((void*)xmlText);
 
 								xmlText = nsXmlGetProp(node, PARSE_LINK_PROPERTY_HREF);
-								if(!hashtable_put_item(data, PARSE_LINK_THIS_KEY, xmlText, strlen((char*)xmlText) + 1))
+								if(!hashtable_put_string(data, PARSE_LINK_THIS_KEY, (char*)xmlText))
 								{
 									//Failed to save "this" link
 									parser->parseError = PE_PRESULT_NODE_SELF_SAVE_FAIL;
@@ -616,18 +720,19 @@ bing_result* parseResult(xmlNodePtr resultNode, BOOL type, bing_response* parent
 	return res;
 }
 
-bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parser* parser, xmlFreeFunc xmlFree)
+bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parser* parser, xmlFreeFunc xmlFree);
+
+//Returns the first entry node, if one exists. The response will have been created (and be "current") if this isn't NULL.
+xmlNodePtr parseResponseHeader(xmlNodePtr responseNode, BOOL composite, bing_parser* parser, xmlFreeFunc xmlFree)
 {
 	//Not really the greatest names, could probably change
 	bing_response* tmp;
 	xmlNodePtr node;
-	xmlNodePtr node2;
 	const xmlChar* xmlText;
 	char* text;
 	const char* nodeName;
 	hashtable_t* data = hashtable_create(DEFAULT_HASHTABLE_SIZE);
 	size_t size;
-	BOOL subResComp;
 
 	//Get general data
 	for(node = responseNode->children; node != NULL && canContinue(parser); node = node->next)
@@ -674,7 +779,7 @@ bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parse
 							xmlFree((void*)xmlText);
 
 							xmlText = nsXmlGetProp(node, PARSE_LINK_PROPERTY_HREF);
-							if(!hashtable_put_item(data, PARSE_LINK_NEXT_KEY, xmlText, strlen((char*)xmlText) + 1))
+							if(!hashtable_put_string(data, PARSE_LINK_NEXT_KEY, (char*)xmlText))
 							{
 								//Failed to save "next" link
 								parser->parseError = PE_PRESPONSE_NODE_NEXT_SAVE_FAIL;
@@ -685,7 +790,7 @@ bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parse
 							xmlFree((void*)xmlText);
 
 							xmlText = nsXmlGetProp(node, PARSE_LINK_PROPERTY_HREF);
-							if(!hashtable_put_item(data, PARSE_LINK_THIS_KEY, xmlText, strlen((char*)xmlText) + 1))
+							if(!hashtable_put_string(data, PARSE_LINK_THIS_KEY, (char*)xmlText))
 							{
 								//Failed to save "this" link
 								parser->parseError = PE_PRESPONSE_NODE_SELF_SAVE_FAIL;
@@ -797,134 +902,250 @@ bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parse
 		}
 	}
 
-	if(parser->current)
+	//Cleanup table
+	hashtable_free(data);
+
+	return parser->current ? node : NULL;
+}
+
+//Returns the result that was created, if the entry was a normal result
+bing_result* parseResponseEntry(xmlNodePtr node, bing_parser* parser, xmlFreeFunc xmlFree)
+{
+	bing_result* res = NULL;
+	xmlNodePtr node2;
+	const xmlChar* xmlText;
+	const char* nodeName;
+	BOOL subResComp;
+
+	nodeName = xmlGetQualifiedName(node);
+	if(nodeName)
 	{
-		//Parse entries
-		for(; node != NULL && canContinue(parser); node = node->next)
+		if(strcmp(nodeName, PARSE_NAME_ENTRY) == 0)
 		{
-			nodeName = xmlGetQualifiedName(node);
-			if(nodeName)
+			bing_mem_free((void*)nodeName);
+
+			//Result automatically added to response
+			if(!(res = parseResult(node, FALSE, parser->current, parser, xmlFree)))
 			{
-				if(strcmp(nodeName, PARSE_NAME_ENTRY) == 0)
+				//Check if composite (we find out first before processing because if it isn't, we have no way to... react. We also want to check a "link" node which requires additional checking)
+				subResComp = FALSE;
+				for(node2 = node->children; node2 != NULL && canContinue(parser); node2 = node2->next)
 				{
-					bing_mem_free((void*)nodeName);
-
-					//Result automatically added to response
-					if(!parseResult(node, FALSE, parser->current, parser, xmlFree))
+					nodeName = xmlGetQualifiedName(node2);
+					if(nodeName)
 					{
-						//Check if composite (we find out first before processing because if it isn't, we have no way to... react. We also want to check a "link" node which requires additional checking)
-						subResComp = FALSE;
-						for(node2 = node->children; node2 != NULL && canContinue(parser); node2 = node2->next)
+						//Check the "title"
+						if(strcmp(nodeName, PARSE_NAME_TITLE) == 0)
 						{
-							nodeName = xmlGetQualifiedName(node2);
-							if(nodeName)
+							bing_mem_free((void*)nodeName);
+
+							//Get the inner text
+							xmlText = xmlNodeGetContent(node2);
+							if(xmlText)
 							{
-								//Check the "title"
-								if(strcmp(nodeName, PARSE_NAME_TITLE) == 0)
+								if(strcmp((char*)xmlText, PARSE_COMPOSITE_IDENT) == 0)
 								{
-									bing_mem_free((void*)nodeName);
-
-									//Get the inner text
-									xmlText = xmlNodeGetContent(node2);
-									if(xmlText)
-									{
-										if(strcmp((char*)xmlText, PARSE_COMPOSITE_IDENT) == 0)
-										{
-											//Yep, it's a composite
-											subResComp = TRUE;
-										}
-										xmlFree((char*)xmlText);
-									}
-									break;
+									//Yep, it's a composite
+									subResComp = TRUE;
 								}
-
-								bing_mem_free((void*)nodeName);
-							}
-							else
-							{
-								//Could not create QName to determine type
-								parser->parseError = PE_PRESPONSE_ENTRY_CHECK_NO_QNAME;
-								subResComp = FALSE;
+								xmlFree((char*)xmlText);
 							}
+							break;
 						}
-						if(subResComp)
+
+						bing_mem_free((void*)nodeName);
+					}
+					else
+					{
+						//Could not create QName to determine type
+						parser->parseError = PE_PRESPONSE_ENTRY_CHECK_NO_QNAME;
+						subResComp = FALSE;
+					}
+				}
+				if(subResComp)
+				{
+					for(node2 = node->children; node2 != NULL && canContinue(parser); node2 = node2->next)
+					{
+						nodeName = xmlGetQualifiedName(node2);
+						if(nodeName)
 						{
-							for(node2 = node->children; node2 != NULL && canContinue(parser); node2 = node2->next)
+							//Find the "link" node
+							if(strcmp(nodeName, PARSE_LINK_NAME) == 0)
 							{
-								nodeName = xmlGetQualifiedName(node2);
-								if(nodeName)
+								//Get the "type" property of the link (if it's a composite, it will have a "type" property. Check anyway)
+								if(nsXmlHasProp(node2, PARSE_PROPERTY_TYPE))
 								{
-									//Find the "link" node
-									if(strcmp(nodeName, PARSE_LINK_NAME) == 0)
+									xmlText = nsXmlGetProp(node2, PARSE_PROPERTY_TYPE);
+									if(xmlText)
 									{
-										//Get the "type" property of the link (if it's a composite, it will have a "type" property. Check anyway)
-										if(nsXmlHasProp(node2, PARSE_PROPERTY_TYPE))
+										if(strcmp((char*)xmlText, "application/atom+xml;type=feed") == 0)
 										{
-											xmlText = nsXmlGetProp(node2, PARSE_PROPERTY_TYPE);
-											if(xmlText)
+											//Yep, this is a composite node (node2->children->children gets us straight to the internal response [as opposed to the "container" of the response])
+											if(parseResponse(node2->children->children, TRUE, parser, xmlFree))
 											{
-												if(strcmp((char*)xmlText, "application/atom+xml;type=feed") == 0)
-												{
-													//Yep, this is a composite node (node2->children->children gets us straight to the internal response [as opposed to the "container" of the response])
-													if(parseResponse(node2->children->children, TRUE, parser, xmlFree))
-													{
-														//Remove "query" from response (it is "current", which hasn't been overwritten). It would be the "response ID" instead of the query.
-														if(parser->current)
-														{
-															hashtable_remove_item(parser->current->data, RESPONSE_QUERY_STR);
-														}
-													}
-													//The only reason the response would be null is if the response was empty, otherwise normal error handling operations would occur
-												}
-												else
+												//Remove "query" from response (it is "current", which hasn't been overwritten). It would be the "response ID" instead of the query.
+												if(parser->current)
 												{
-													//The specified composite is not of the correct type
-													parser->parseError = PE_PRESPONSE_ENTRY_COMPOSITE_NOT_VALID;
+													hashtable_remove_item(parser->current->data, RESPONSE_QUERY_STR);
 												}
-												xmlFree((void*)xmlText);
-											}
-											else
-											{
-												//Type is supposed to exist, type doesn't exist
-												parser->parseError = PE_PRESPONSE_ENTRY_TYPE_MISSING;
 											}
+											//The only reason the response would be null is if the response was empty, otherwise normal error handling operations would occur
+										}
+										else
+										{
+											//The specified composite is not of the correct type
+											parser->parseError = PE_PRESPONSE_ENTRY_COMPOSITE_NOT_VALID;
 										}
+										xmlFree((void*)xmlText);
+									}
+									else
+									{
+										//Type is supposed to exist, type doesn't exist
+										parser->parseError = PE_PRESPONSE_ENTRY_TYPE_MISSING;
 									}
-
-									bing_mem_free((void*)nodeName);
-								}
-								else
-								{
-									//Could not create QName to process
-									parser->parseError = PE_PRESPONSE_ENTRY_PROCESS_NO_QNAME;
 								}
 							}
+
+							bing_mem_free((void*)nodeName);
 						}
-						else if(parser->parseError == PE_NO_ERROR)
+						else
 						{
-							//What we found, and thought was a composite, isn't a composite
-							parser->parseError = PE_PRESPONSE_ENTRY_COMPOSITE_NOT_COMPOSITE;
+							//Could not create QName to process
+							parser->parseError = PE_PRESPONSE_ENTRY_PROCESS_NO_QNAME;
 						}
 					}
 				}
-				else
+				else if(parser->parseError == PE_NO_ERROR)
 				{
-					bing_mem_free((void*)nodeName);
-
-					//One of the child nodes is not an entry node
-					parser->parseError = PE_PRESPONSE_ENTRY_NOT_ENTRY;
+					//What we found, and thought was a composite, isn't a composite
+					parser->parseError = PE_PRESPONSE_ENTRY_COMPOSITE_NOT_COMPOSITE;
 				}
 			}
-			else
-			{
-				//Could not create a QName to verify entry
-				parser->parseError = PE_PRESPONSE_ENTRY_NO_QNAME;
-			}
 		}
+		else
+		{
+			bing_mem_free((void*)nodeName);
+
+			//One of the child nodes is not an entry node
+			parser->parseError = PE_PRESPONSE_ENTRY_NOT_ENTRY;
+		}
+	}
+	else
+	{
+		//Could not create a QName to verify entry
+		parser->parseError = PE_PRESPONSE_ENTRY_NO_QNAME;
 	}
 
-	//Cleanup table
-	hashtable_free(data);
+	return res;
+}
+
+//Only entries produce results, so only they count towards the result limit
+BOOL resultLimitEntry(xmlNodePtr node)
+{
+	return node->type == XML_ELEMENT_NODE && strcmp((char*)node->name, PARSE_NAME_ENTRY) == 0;
+}
+
+bing_response* parseResponse(xmlNodePtr responseNode, BOOL composite, bing_parser* parser, xmlFreeFunc xmlFree)
+{
+	unsigned int count;
+	xmlNodePtr node = parseResponseHeader(responseNode, composite, parser, xmlFree);
+
+	if(!node)
+	{
+		//Empty response, or the response couldn't be created
+		return NULL;
+	}
+
+	//Parse entries (a limit only applies to the top level entries)
+	for(count = 0; node != NULL && canContinue(parser) && (composite || parser->resultLimit == 0 || count < parser->resultLimit); node = node->next)
+	{
+		parseResponseEntry(node, parser, xmlFree);
+		if(resultLimitEntry(node))
+		{
+			count++;
+		}
+	}
+
+	return parser->current;
+}
+
+//Process everything that has been parsed so far. Once a node has a sibling after it, it's complete and can be converted and freed. When final, everything is processed.
+bing_response* streamProcess(bing_parser* parser, BOOL final, xmlFreeFunc xmlFree)
+{
+	xmlNodePtr root;
+	xmlNodePtr node;
+	xmlNodePtr header;
+	bing_result* res;
+
+	if(!parser->ctx->myDoc || !(root = xmlDocGetRootElement(parser->ctx->myDoc)) || !canContinue(parser))
+	{
+		return NULL;
+	}
+
+	if(!parser->streamHeaderDone)
+	{
+		//Header data is complete once the first entry shows up
+		for(node = root->children; node != NULL && !resultLimitEntry(node); node = node->next);
+		if(!node && !final)
+		{
+			return NULL;
+		}
+		parser->streamHeaderDone = TRUE;
+
+		if(!parseResponseHeader(root, FALSE, parser, xmlFree))
+		{
+			//Empty response, or the response couldn't be created
+			return NULL;
+		}
+
+		//Results will be released through the stream
+		parser->current->stream = parser->stream;
+		stream_retain(parser->stream);
+
+		//Header has been processed, it's not needed anymore
+		while((header = root->children) != node)
+		{
+			xmlUnlinkNode(header);
+			xmlFreeNode(header);
+		}
+	}
+
+	//Parse entries
+	while(parser->current && (node = root->children) != NULL && (final || node->next != NULL) && !parser->resultLimitReached && canContinue(parser))
+	{
+		//The response is shared with bing_result_stream_release
+		pthread_mutex_lock(&parser->stream->mutex);
+
+		res = parseResponseEntry(node, parser, xmlFree);
+		if(res && canContinue(parser))
+		{
+			res->streamBytes = parser->streamUndelivered;
+			parser->streamUndelivered = 0;
+
+			parser->stream->pendingBytes += res->streamBytes;
+			parser->stream->pendingResults++;
+		}
+		else
+		{
+			res = NULL;
+		}
+
+		pthread_mutex_unlock(&parser->stream->mutex);
+
+		if(parser->resultLimit > 0 && resultLimitEntry(node) && ++parser->resultLimitCount >= parser->resultLimit)
+		{
+			parser->resultLimitReached = TRUE;
+		}
+
+		//Entry has been converted, it's not needed anymore
+		xmlUnlinkNode(node);
+		xmlFreeNode(node);
+
+		if(res && parser->resultFunc && !parser->transfer.cancelled)
+		{
+			parser->resultFunc((bing_result_t)res, parser->userData);
+		}
+	}
 
 	return parser->current;
 }
@@ -990,6 +1211,16 @@ static const xmlSAXHandler parserHandler=
         serrorCallback					//serror
 };
 
+//Searches that haven't received any data yet, which identical searches can join
+static pthread_mutex_t searchFlightMutex = PTHREAD_MUTEX_INITIALIZER;
+static bing_parser* searchFlights = NULL;
+static volatile unsigned int searchCoalesced = 0;
+
+//Asynchronous searches that can be cancelled
+static pthread_mutex_t searchHandleMutex = PTHREAD_MUTEX_INITIALIZER;
+static search_handle* searchHandles = NULL;
+static volatile unsigned int searchHandleNext = 0;
+
 void search_setup()
 {
 	xmlSAXHandler* handler;
@@ -999,358 +1230,1588 @@ void search_setup()
 	if(atomic_add_value(&searchCount, 1) == 0)
 	{
 		//Setup XML
+#if defined(BING_NO_SEARCH_ARENA)
 		xmlGcMemSetup(bing_mem_free, bing_mem_malloc, bing_mem_malloc, bing_mem_realloc, bing_mem_strdup);
+#else
+		xmlGcMemSetup(arena_xml_free, arena_xml_malloc, arena_xml_malloc, arena_xml_realloc, arena_xml_strdup);
+#endif
 
 		//On first run, setup the parser
 		xmlInitParser();
 
 		//Setup cURL
-		curl_global_init_mem(CURL_GLOBAL_ALL, bing_mem_malloc, bing_mem_free, bing_mem_realloc, bing_mem_strdup, bing_mem_calloc); //THIS IS NOT THREAD SAFE!!
+		transport_global_setup();
 	}
 }
 
-void search_cleanup(bing_parser* parser)
+//Releases the global setup. Every search_setup needs a release, and so does a non-empty cURL pool (otherwise cURL could be cleaned up while pooled handles still exist).
+void search_release()
 {
-	xmlParserCtxtPtr ctx;
-	p_url_process* urlProcess;
-	if(parser)
+	if(atomic_sub_value(&searchCount, 1) == 1)
 	{
-#if defined(BING_DEBUG)
-		lastErrorCode = (int)parser->parseError; //For devs
-		if(parser->parseError != PE_NO_ERROR)
-		{
-			BING_MSG_PRINTOUT("Parser error: %d\n", (int)parser->parseError);
-		}
-#endif
-
-		ctx = parser->ctx;
-		if(ctx)
-		{
-			ctx->userData = NULL;
-		}
+		xmlCleanupParser();
 
-		//Shutdown cURL
-		curl_easy_cleanup(parser->curl);
+		//Cleanup cURL
+		transport_global_cleanup();
+	}
+}
 
-		//Now get rid of the bing context
-		parser->bing = 0;
+//Get a search ID that hasn't been used. It's never zero (or negative), so it can be returned where success used to be returned.
+int search_handle_id()
+{
+	int ret;
+	do
+	{
+		ret = (int)((atomic_add_value(&searchHandleNext, 1) + 1) & 0x7FFFFFFF);
+	} while(ret == 0);
+	return ret;
+}
 
-		//Close thread (if used)
-		parser->thread = NULL; //pthread_exit (called implicitly at end of execution) frees the thread
+//Let an asynchronous search be cancelled, until it's done. Returns the search ID, zero on error.
+int search_handle_add(bing_parser* parser)
+{
+	search_handle* handle = (search_handle*)bing_mem_malloc(sizeof(search_handle));
+	int ret = 0;
 
-		//Cleanup additional URL processes
-		while((urlProcess = parser->additionalUrlProcessing))
+	if(handle)
+	{
+		memset(handle, 0, sizeof(search_handle));
+		handle->id = ret = search_handle_id();
+		handle->parser = parser;
+		if(parser)
 		{
-			bing_mem_free((void*)urlProcess->url);
-			parser->additionalUrlProcessing = urlProcess->next;
-			bing_mem_free((void*)urlProcess);
+			parser->searchID = ret;
 		}
 
-		//Free the bing parser
-		bing_mem_free(parser);
+		pthread_mutex_lock(&searchHandleMutex);
 
-		//Free the document
-		if(ctx)
-		{
-			xmlFreeDoc(ctx->myDoc);
-		}
+		handle->next = searchHandles;
+		searchHandles = handle;
 
-		//Free the actual context
-		xmlFreeParserCtxt(ctx);
-	}
-#if defined(BING_DEBUG)
-	else
-	{
-		BING_MSG_PRINTOUT("Parser cleanup-parser is NULL\n");
+		pthread_mutex_unlock(&searchHandleMutex);
 	}
-#endif
-
-	//Not desired to do this if parser is NULL (as the call shouldn't have happened with a NULL parser), but it's still a cleanup operation
-	if(atomic_sub_value(&searchCount, 1) == 1)
-	{
-		xmlCleanupParser();
 
-		//Cleanup cURL
-		curl_global_cleanup(); //THIS IS NOT THREAD SAFE!!
-	}
+	return ret;
 }
 
-size_t getxmldata(char* ptr, size_t size, size_t nmemb, void* userdata)
+//Must be called with the search handle mutex locked
+search_handle** search_handle_find(int id)
 {
-	bing_parser* parser = (bing_parser*)userdata;
-	size_t atcsize = size * nmemb;
-
-	//Check if we have a parser, otherwise we need to create one
-	if(parser->ctx)
+	search_handle** handle;
+	for(handle = &searchHandles; *handle; handle = &(*handle)->next)
 	{
-		//Only write data if no error has occurred
-		if(parser->parseError == PE_NO_ERROR)
+		if((*handle)->id == id)
 		{
-			xmlParseChunk(parser->ctx, ptr, atcsize, FALSE);
+			break;
 		}
 	}
-	else
+	return handle;
+}
+
+//The search is done, so it can't be cancelled anymore. Returns TRUE if it was cancelled, in which case the developer isn't told it's done.
+BOOL search_handle_remove(int id)
+{
+	search_handle** find;
+	search_handle* handle = NULL;
+	BOOL ret = FALSE;
+
+	if(id != 0)
 	{
-		//Create parser
-		parser->ctx = xmlCreatePushParserCtxt(/*(xmlSAXHandlerPtr)&parserHandler*/NULL, parser, ptr, atcsize, NULL); //XXX
-		parser->parseError = PE_NO_ERROR;
-		if(!parser->ctx)
+		pthread_mutex_lock(&searchHandleMutex);
+
+		find = search_handle_find(id);
+		if(*find)
 		{
-			//If an error occurs, it will ignore writing any data
-			parser->parseError = PE_GETXMLDATA_CTX_CREATE_FAIL;
+			handle = *find;
+			*find = handle->next;
+			ret = handle->cancelled;
 		}
-	}
 
-	//If an error occurred, we want to let cURL know there was an error
-	if(parser->parseError != PE_NO_ERROR)
-	{
-		atcsize = 0;
+		pthread_mutex_unlock(&searchHandleMutex);
+
+		bing_mem_free(handle);
 	}
 
-	return atcsize;
+	return ret;
 }
 
-BOOL setCurl(unsigned int bingID, const char* url, CURL* curl, bing_parser* parser)
+//Let identical searches join this one, until it receives data
+void flight_open(bing_parser* parser, const char* url)
 {
-	BOOL ret = FALSE;
-	bing* bingI = retrieveBing(bingID);
-
-	if(bingI && curl)
+	parser->flightUrl = bing_mem_strdup(url);
+	parser->flightAccountKey = retrieveAccountKey(parser->bing);
+	if(parser->flightUrl && parser->flightAccountKey)
 	{
-		curl_easy_reset(curl);
-
-		pthread_mutex_lock(&bingI->mutex);
+		pthread_mutex_lock(&searchFlightMutex);
 
-		if(bingI->accountKey)
-		{
-			//Set the URL
-			if(curl_easy_setopt(curl, CURLOPT_URL, url) == CURLE_OK &&							//The URL, required
-					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, getxmldata) == CURLE_OK &&		//The function to handle the data, required
-					curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)parser) == CURLE_OK &&		//The "userdata" to be passed into the write function, required
-					curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CURL_FALSE) == CURLE_OK &&	//We don't have a SSL cert for verification, so skip it
-					curl_easy_setopt(curl, CURLOPT_USERNAME, CURL_EMPTY_STRING) == CURLE_OK &&	//For basic HTTP authentication, this is the "user ID", which is ignored right now
-					curl_easy_setopt(curl, CURLOPT_PASSWORD, bingI->accountKey) == CURLE_OK)		//For basic HTTP authentication, this is the "account key"
-			{
-				//We don't want any progress meters
-				curl_easy_setopt(curl, CURLOPT_NOPROGRESS, CURL_TRUE);
+		parser->flightNext = searchFlights;
+		searchFlights = parser;
 
-				ret = TRUE;
-			}
-		}
-		pthread_mutex_unlock(&bingI->mutex);
+		pthread_mutex_unlock(&searchFlightMutex);
+	}
+	else
+	{
+		bing_mem_free(parser->flightUrl);
+		bing_mem_free(parser->flightAccountKey);
+		parser->flightUrl = NULL;
+		parser->flightAccountKey = NULL;
 	}
-	return ret;
 }
 
-CURL* setupCurl(unsigned int bingID, const char* url, bing_parser* parser)
+//Stop searches from joining this one. Once closed, the followers don't change.
+void flight_close(bing_parser* parser)
 {
-	CURL* ret = curl_easy_init();
+	bing_parser** flight;
 
-	if(ret)
+	if(parser->flightUrl)
 	{
-		if(!setCurl(bingID, url, ret, parser))
+		pthread_mutex_lock(&searchFlightMutex);
+
+		for(flight = &searchFlights; *flight; flight = &(*flight)->flightNext)
 		{
-			curl_easy_cleanup(ret);
-			ret = NULL;
+			if(*flight == parser)
+			{
+				*flight = parser->flightNext;
+				break;
+			}
 		}
-	}
+		parser->flightNext = NULL;
 
-	return ret;
+		bing_mem_free(parser->flightUrl);
+		bing_mem_free(parser->flightAccountKey);
+		parser->flightUrl = NULL;
+		parser->flightAccountKey = NULL;
+
+		pthread_mutex_unlock(&searchFlightMutex);
+	}
 }
 
-BOOL setupParser(bing_parser* parser, unsigned int bingID, const char* url)
+//Join an identical search that is running, instead of downloading the same thing again. Returns the search ID if it was joined, zero if it wasn't.
+int flight_join(unsigned int bingID, const char* url, unsigned int resultLimit, const void* userData, BOOL userDataIsParser, receive_bing_response_func responseFunc)
 {
-	char* addUrl;
-	char* turl;
-	p_url_process* urlProc;
-
-	memset(parser, 0, sizeof(bing_parser));
+	int ret = 0;
+	char* accountKey = retrieveAccountKey(bingID);
+	bing_parser* leader;
+	bing_parser* follower;
+	bing_parser** end;
 
-	//See if we have additional URLs to process
-	addUrl = strchr(url, ' ');
-	if(addUrl)
+	if(accountKey)
 	{
-		//Terminate the original URL, get the next URL
-		*(addUrl++) = '\0';
+		pthread_mutex_lock(&searchFlightMutex);
 
-		//Run until all URLs are processed
-		while(addUrl)
+		//The account key is part of the search, the same URL could return something different for a different account
+		for(leader = searchFlights; leader; leader = leader->flightNext)
 		{
-			//Get the start of the next URL
-			turl = strchr(addUrl, ' ');
-			if(turl)
+			if(leader->resultLimit == resultLimit && strcmp(leader->flightUrl, url) == 0 && strcmp(leader->flightAccountKey, accountKey) == 0)
 			{
-				//Terminate it, if it exists
-				*turl = '\0';
+				break;
 			}
+		}
 
-			//Create a new process structure
-			urlProc = bing_mem_malloc(sizeof(p_url_process));
-			if(urlProc)
-			{
-				//Set data
-				urlProc->next = parser->additionalUrlProcessing;
-				urlProc->url = bing_mem_strdup(addUrl);
-				parser->additionalUrlProcessing = urlProc;
-			}
-			else
+		if(leader)
+		{
+			//The follower parses the same data into a response of it's own
+			follower = bing_mem_malloc(sizeof(bing_parser));
+			if(follower)
 			{
-				//Error, need to cleanup
-				while((urlProc = parser->additionalUrlProcessing))
+				memset(follower, 0, sizeof(bing_parser));
+				follower->bing = bingID;
+				follower->responseFunc = responseFunc;
+				follower->userData = userDataIsParser ? follower : userData;
+				follower->bpsChannel = userDataIsParser ? bps_channel_get_active() : -1;
+				follower->resultLimit = resultLimit;
+				follower->transfer.search = follower;
+				follower->transfer.bing = bingID;
+				follower->transfer.deadline = leader->transfer.deadline; //Done when the search it joined is
+				follower->transfer.transport = leader->transfer.transport; //Doesn't make a transfer, but is finished like one
+
+				ret = search_handle_add(follower);
+				if(ret)
 				{
-					bing_mem_free((void*)urlProc->url);
-					parser->additionalUrlProcessing = urlProc->next;
-					bing_mem_free((void*)urlProc);
+					for(end = &leader->followers; *end; end = &(*end)->followerNext);
+					*end = follower;
+				}
+				else
+				{
+					bing_mem_free(follower);
 				}
-				return FALSE;
 			}
+		}
 
-			//Make sure the next URL is the new URL
-			addUrl = ++turl;
+		pthread_mutex_unlock(&searchFlightMutex);
+
+		bing_mem_free(accountKey);
+
+		if(ret)
+		{
+			atomic_add(&searchCoalesced, 1);
 		}
 	}
 
-	parser->bing = bingID;
-	parser->curl = setupCurl(bingID, url, parser);
-	return parser->curl != NULL;
+	return ret;
 }
 
-BOOL check_for_connection()
+unsigned int bing_get_coalesced_search_count()
 {
-#if defined(BING_IGNORE_CONNECTION_STATUS)
-	return TRUE;
-#else
-#ifdef BBNDK_VERSION_AT_LEAST
-#if BBNDK_VERSION_AT_LEAST(10,2,0)
-#define NETSTAT_TENTWO //netstatus_get_availability was depreciated in 10.2.0
+	return searchCoalesced;
+}
+
+//Free a parser, and the parsers of any additional URLs
+void parser_free(bing_parser* parser)
+{
+	xmlParserCtxtPtr ctx;
+	bing_parser* sub;
+	bing_arena* arena;
+
+	//Cleanup additional URL parsers
+	while((sub = parser->fanout))
+	{
+		parser->fanout = sub->fanoutNext;
+		parser_free(sub);
+	}
+
+	//Followers are always finished before the search they joined
+	flight_close(parser);
+
+	ctx = parser->ctx;
+	if(ctx)
+	{
+		ctx->userData = NULL;
+	}
+	arena = parser->arena;
+
+	transport_free(&parser->transfer);
+
+	//Now get rid of the bing context
+	parser->bing = 0;
+
+	//Cleanup streaming (a failed response is only freed now, after the developer has been told the search failed)
+	bing_response_free(parser->streamFailedResponse);
+	stream_set_search(parser->stream, NULL);
+	stream_release(parser->stream);
+
+	bing_mem_free(parser->cacheUrl);
+	bing_mem_free(parser->cacheData);
+	bing_mem_free(parser->cacheEtag);
+	bing_mem_free(parser->cacheModified);
+
+	capture_free(&parser->capture);
+
+	//Free the bing parser
+	bing_mem_free(parser);
+
+	//Free the document (if it was allocated from the arena, it's freed with the arena)
+	if(ctx && !arena)
+	{
+		xmlFreeDoc(ctx->myDoc);
+	}
+
+	//Free the actual context (anything it allocated from the arena is ignored), then the arena (if there is one)
+	xmlFreeParserCtxt(ctx);
+	arena_free(arena);
+}
+
+void search_cleanup(bing_parser* parser)
+{
+	if(parser)
+	{
+#if defined(BING_DEBUG)
+		lastErrorCode = (int)parser->parseError; //For devs
+		if(parser->parseError != PE_NO_ERROR)
+		{
+			BING_MSG_PRINTOUT("Parser error: %d\n", (int)parser->parseError);
+		}
 #endif
+
+		parser_free(parser);
+	}
+#if defined(BING_DEBUG)
+	else
+	{
+		BING_MSG_PRINTOUT("Parser cleanup-parser is NULL\n");
+	}
 #endif
-	bool av;
-#ifdef NETSTAT_TENTWO
-	netstatus_info_t* netinfo;
-	if(netstatus_get_info(&netinfo) == BPS_SUCCESS)
+
+	//Not desired to do this if parser is NULL (as the call shouldn't have happened with a NULL parser), but it's still a cleanup operation
+	search_release();
+}
+
+//Count the entries that have been completely received, so the transfer can be stopped once there are enough
+void resultLimitCheck(bing_parser* parser)
+{
+	xmlNodePtr root;
+	xmlNodePtr node;
+	if(parser->ctx->myDoc && (root = xmlDocGetRootElement(parser->ctx->myDoc)))
 	{
-		av = netstatus_info_get_availability(netinfo);
-		netstatus_free_info(&netinfo);
-		return CPP_BOOL_TO_BOOL(av);
+		for(node = parser->resultLimitNode ? parser->resultLimitNode->next : root->children; node != NULL && !parser->resultLimitReached; node = node->next)
+		{
+			//A node is complete once something comes after it, or the parser is no longer inside it
+			if(!node->next && parser->ctx->node && parser->ctx->node != root)
+			{
+				break;
+			}
+			parser->resultLimitNode = node;
+
+			if(resultLimitEntry(node) && ++parser->resultLimitCount >= parser->resultLimit)
+			{
+				parser->resultLimitReached = TRUE;
+			}
+		}
 	}
-#else
-	if(netstatus_get_availability(&av) == BPS_SUCCESS)
+}
+
+//Everything libxml allocates between entering and leaving is from the search's arena (if it has one)
+void parserArena(bing_parser* parser, BOOL enter)
+{
+	if(parser->arena)
 	{
-		return CPP_BOOL_TO_BOOL(av);
+		//Any error libxml saved while the arena is enabled is in the arena, so it can't be kept once the arena is disabled. Doing this first also creates libxml's state for the thread (the first time it's used), which has to outlive the arena.
+		xmlResetLastError();
+
+		arena_enable(parser->arena, enter);
+	}
+}
+
+//Keep the data received, so it can be cached once the search is done
+void cacheRecord(bing_parser* parser, const char* data, size_t size)
+{
+	char* nData;
+	size_t nAlloc;
+
+	if(parser->cacheSize + size > parser->cacheLimit)
+	{
+		//Too big to cache
+		nData = NULL;
+	}
+	else if(parser->cacheSize + size > parser->cacheAlloc)
+	{
+		nAlloc = parser->cacheAlloc > 0 ? parser->cacheAlloc : CURL_MAX_WRITE_SIZE;
+		while(nAlloc < parser->cacheSize + size)
+		{
+			nAlloc *= 2;
+		}
+		if(nAlloc > parser->cacheLimit)
+		{
+			nAlloc = parser->cacheLimit;
+		}
+		nData = (char*)bing_mem_realloc(parser->cacheData, nAlloc);
+		if(nData)
+		{
+			parser->cacheData = nData;
+			parser->cacheAlloc = nAlloc;
+		}
+	}
+	else
+	{
+		nData = parser->cacheData;
+	}
+
+	if(nData)
+	{
+		memcpy(parser->cacheData + parser->cacheSize, data, size);
+		parser->cacheSize += size;
+	}
+	else
+	{
+		//Stop keeping data
+		bing_mem_free(parser->cacheUrl);
+		bing_mem_free(parser->cacheData);
+		parser->cacheUrl = NULL;
+		parser->cacheData = NULL;
+		parser->cacheSize = 0;
+		parser->cacheAlloc = 0;
+	}
+}
+
+//Keep what the transfer receives, so it can be recorded once it's done
+void captureKeep(bing_parser* parser, BOOL header, const char* data, size_t size)
+{
+	bing_capture* capture = &parser->capture;
+	BOOL kept;
+
+	if(header)
+	{
+		if(capture->headerSize == 0)
+		{
+			capture->firstByte = (unsigned int)(engine_time() - parser->captureStart);
+		}
+		kept = capture_append(&capture->headers, &capture->headerSize, &capture->headerAlloc, data, size);
+	}
+	else
+	{
+		kept = capture_append(&capture->body, &capture->bodySize, &capture->bodyAlloc, data, size);
+	}
+
+	if(!kept)
+	{
+		//Not recorded at all, rather then recorded wrong
+		parser->captureRecording = FALSE;
+	}
+}
+
+//Keep the value of a header, if it's the header with name
+void cacheHeader(char** value, const char* name, const char* header, size_t size)
+{
+	size_t nameSize = strlen(name);
+
+	if(size > nameSize && strncasecmp(header, name, nameSize) == 0)
+	{
+		header += nameSize;
+		size -= nameSize;
+
+		//Trim whitespace and the line ending
+		while(size > 0 && (*header == ' ' || *header == '\t'))
+		{
+			header++;
+			size--;
+		}
+		while(size > 0 && (header[size - 1] == ' ' || header[size - 1] == '\t' || header[size - 1] == '\r' || header[size - 1] == '\n'))
+		{
+			size--;
+		}
+
+		bing_mem_free(*value);
+		*value = NULL;
+		if(size > 0)
+		{
+			*value = (char*)bing_mem_malloc(size + 1);
+			if(*value)
+			{
+				memcpy(*value, header, size);
+				(*value)[size] = '\0';
+			}
+		}
+	}
+}
+
+//Get the status of the response, and keep the validators sent with data that is being cached
+size_t getheader(bing_parser* parser, char* buffer, size_t hsize)
+{
+	size_t i;
+	long status = 0;
+
+	if(hsize > 5 && memcmp(buffer, "HTTP/", 5) == 0)
+	{
+		//The status line (the header isn't null terminated)
+		for(i = 5; i < hsize && buffer[i] != ' '; i++);
+		for(i++; i < hsize && buffer[i] >= '0' && buffer[i] <= '9'; i++)
+		{
+			status = (status * 10) + (buffer[i] - '0');
+		}
+
+		parser->transfer.httpStatus = status;
+
+		//If the response will be retried, there is no point parsing it
+		parser->retryDiscard = retry_status(status) && (parser->retry.attempts + 1) < parser->retry.maxAttempts;
+	}
+
+	if(parser->cacheUrl)
+	{
+		cacheHeader(&parser->cacheEtag, "ETag:", buffer, hsize);
+		cacheHeader(&parser->cacheModified, "Last-Modified:", buffer, hsize);
+	}
+
+	if(parser->captureRecording)
+	{
+		captureKeep(parser, TRUE, buffer, hsize);
+	}
+
+	return hsize;
+}
+
+size_t getxmldata(bing_parser* parser, char* ptr, size_t atcsize)
+{
+	xmlFreeFunc xmlFreeF;
+	bing_parser* follower;
+
+	if(parser->retryDiscard)
+	{
+		//Searches can still join, they get the response of the retry
+		if(parser->captureRecording)
+		{
+			captureKeep(parser, FALSE, ptr, atcsize);
+		}
+		return atcsize;
+	}
+
+	//Searches can't join once data has been received (they would miss it)
+	flight_close(parser);
+
+	//Searches that joined this one get the same data
+	for(follower = parser->followers; follower; follower = follower->followerNext)
+	{
+		if(!follower->transfer.cancelled)
+		{
+			getxmldata(follower, ptr, atcsize);
+		}
+	}
+
+	if(parser->cacheUrl)
+	{
+		cacheRecord(parser, ptr, atcsize);
+	}
+
+	//Data is already decompressed
+	parser->decodedBytes += atcsize;
+
+	//If too many streamed results are waiting to be released, stop receiving data until they are
+	if(parser->stream && parser->parseError == PE_NO_ERROR && stream_pause(parser->stream))
+	{
+		return CURL_WRITEFUNC_PAUSE;
+	}
+
+	//Only once it won't be received again
+	if(parser->captureRecording)
+	{
+		captureKeep(parser, FALSE, ptr, atcsize);
+	}
+
+	//Check if we have a parser, otherwise we need to create one
+	if(parser->ctx)
+	{
+		//Only write data if no error has occurred
+		if(parser->parseError == PE_NO_ERROR)
+		{
+			parserArena(parser, TRUE);
+			xmlParseChunk(parser->ctx, ptr, atcsize, FALSE);
+			parserArena(parser, FALSE);
+		}
 	}
+	else
+	{
+#if !defined(BING_NO_SEARCH_ARENA)
+		//The document is only allocated from the arena if it's not being streamed (streamed documents free nodes as they go, so memory stays bounded)
+		if(!parser->stream && !parser->arena)
+		{
+			parser->arena = arena_create();
+		}
 #endif
-	return FALSE; //Return false as a precaution because if we can't get netstatus, well, we might not be able to use the network in general.
+
+		//Create parser
+		parserArena(parser, TRUE);
+		parser->ctx = xmlCreatePushParserCtxt(/*(xmlSAXHandlerPtr)&parserHandler*/NULL, parser, ptr, atcsize, NULL); //XXX
+		parserArena(parser, FALSE);
+		parser->parseError = PE_NO_ERROR;
+		if(!parser->ctx)
+		{
+			//If an error occurs, it will ignore writing any data
+			parser->parseError = PE_GETXMLDATA_CTX_CREATE_FAIL;
+		}
+	}
+
+	//Hand off any results that have been completed
+	if(parser->stream && parser->parseError == PE_NO_ERROR)
+	{
+		parser->streamUndelivered += atcsize;
+
+		xmlGcMemGet(&xmlFreeF, NULL, NULL, NULL, NULL);
+		streamProcess(parser, FALSE, xmlFreeF);
+	}
+
+	//If an error occurred, we want to let cURL know there was an error
+	if(parser->parseError != PE_NO_ERROR)
+	{
+		atcsize = 0;
+	}
+	else if(parser->resultLimit > 0 && parser->ctx)
+	{
+		//Streamed searches count as they process results
+		if(!parser->stream)
+		{
+			resultLimitCheck(parser);
+		}
+
+		//Stop the transfer, search_transfer_done knows this isn't an error
+		if(parser->resultLimitReached)
+		{
+			atcsize = 0;
+		}
+	}
+
+	return atcsize;
+}
+
+BOOL search_hedge(void* data, void* curl, int curlCode);
+
+//The search doesn't need to be hedged anymore
+void hedgeStop(bing_parser* parser)
+{
+	parser->hedgeState = HEDGE_DECIDED;
+	if(parser->hedgeDelay > 0 && engine_cancel_post(search_hedge, parser))
+	{
+		//The wait was counted as something the search is waiting for (the transfer that is running is also counted, so this is never the last)
+		atomic_sub(&parser->fanoutPending, 1);
+	}
+}
+
+//The first transfer to receive anything is used. Returns FALSE if hedge (or the original transfer) isn't the one being used.
+BOOL hedgeClaim(bing_parser* parser, BOOL hedge)
+{
+	if(parser->hedgeState == HEDGE_WAITING || parser->hedgeState == HEDGE_RUNNING)
+	{
+		hedge_sample(parser->bing, (unsigned int)(engine_time() - parser->hedgeStart));
+
+		if(parser->hedgeState == HEDGE_RUNNING)
+		{
+			if(hedge)
+			{
+				transport_swap(&parser->transfer);
+				parser->hedgeWon = TRUE;
+
+				hedge_won(parser->bing);
+			}
+
+			//Callbacks can't stop a transfer, the engine does it once this returns
+			parser->transfer.transport->stop(&parser->transfer, parser->transfer.hedgeHandle);
+		}
+		hedgeStop(parser);
+	}
+	return parser->hedgeWon == hedge;
+}
+
+size_t search_transfer_header(bing_transfer* transfer, char* header, size_t size)
+{
+	return getheader((bing_parser*)transfer->search, header, size);
+}
+
+size_t search_transfer_data(bing_transfer* transfer, char* data, size_t size)
+{
+	return getxmldata((bing_parser*)transfer->search, data, size);
+}
+
+BOOL search_transfer_claim(bing_transfer* transfer, BOOL hedge)
+{
+	return hedgeClaim((bing_parser*)transfer->search, hedge);
+}
+
+void freeFanout(bing_parser* parser)
+{
+	bing_parser* sub;
+	while((sub = parser->fanout))
+	{
+		parser->fanout = sub->fanoutNext;
+		parser_free(sub);
+	}
+}
+
+//When (engine_time) a search made now has to be done by, zero if there is no limit
+unsigned long long search_deadline(unsigned int bingID)
+{
+	bing* bingI = retrieveBing(bingID);
+	unsigned long long ret = 0;
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		if(bingI->timeout > 0)
+		{
+			ret = engine_time() + bingI->timeout;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+
+	return ret;
+}
+
+BOOL setupParser(bing_parser* parser, unsigned int bingID, const char* url)
+{
+	char* addUrl;
+	char* turl;
+	bing_parser* sub;
+	bing_parser* last = NULL;
+
+	memset(parser, 0, sizeof(bing_parser));
+
+	//See if we have additional URLs to process
+	addUrl = strchr(url, ' ');
+	if(addUrl)
+	{
+		//Terminate the original URL, get the next URL
+		*(addUrl++) = '\0';
+
+		//Run until all URLs are processed
+		while(addUrl)
+		{
+			//Get the start of the next URL
+			turl = strchr(addUrl, ' ');
+			if(turl)
+			{
+				//Terminate it, if it exists
+				*(turl++) = '\0';
+			}
+
+			//Each additional URL gets a parser of its own, so all of them can be downloaded at the same time
+			sub = bing_mem_malloc(sizeof(bing_parser));
+			if(sub && setupParser(sub, bingID, addUrl))
+			{
+				//Keep them in order, so they are merged in order
+				sub->fanoutParent = parser;
+				if(last)
+				{
+					last->fanoutNext = sub;
+				}
+				else
+				{
+					parser->fanout = sub;
+				}
+				last = sub;
+			}
+			else
+			{
+				//Error, need to cleanup
+				bing_mem_free(sub);
+				freeFanout(parser);
+				return FALSE;
+			}
+
+			//Make sure the next URL is the new URL
+			addUrl = turl;
+		}
+	}
+
+	parser->bing = bingID;
+	parser->captureMode = capture_mode();
+	if(!transport_setup(&parser->transfer, parser, bingID, url, parser->captureMode == BING_CAPTURE_REPLAY))
+	{
+		freeFanout(parser);
+		return FALSE;
+	}
+	parser->transfer.deadline = search_deadline(bingID);
+	retry_setup(bingID, &parser->retry);
+
+	//The transport sets up anything else it needs once the transfer is made (cached searches never make one)
+	return TRUE;
+}
+
+BOOL check_for_connection()
+{
+#if defined(BING_IGNORE_CONNECTION_STATUS)
+	return TRUE;
+#else
+#ifdef BBNDK_VERSION_AT_LEAST
+#if BBNDK_VERSION_AT_LEAST(10,2,0)
+#define NETSTAT_TENTWO //netstatus_get_availability was depreciated in 10.2.0
+#endif
+#endif
+	bool av;
+#ifdef NETSTAT_TENTWO
+	netstatus_info_t* netinfo;
+	if(netstatus_get_info(&netinfo) == BPS_SUCCESS)
+	{
+		av = netstatus_info_get_availability(netinfo);
+		netstatus_free_info(&netinfo);
+		return CPP_BOOL_TO_BOOL(av);
+	}
+#else
+	if(netstatus_get_availability(&av) == BPS_SUCCESS)
+	{
+		return CPP_BOOL_TO_BOOL(av);
+	}
+#endif
+	return FALSE; //Return false as a precaution because if we can't get netstatus, well, we might not be able to use the network in general.
+#endif
+}
+
+//Finish parsing, once all the data is received
+int search_parse_done(bing_parser* parser, int curlCode)
+{
+	if(curlCode == CURLE_WRITE_ERROR && parser->resultLimitReached)
+	{
+		//The transfer was stopped on purpose, enough results were received
+		curlCode = CURLE_OK;
+	}
+
+	//Finish parsing (unless the transfer was stopped, in which case the rest of the document is never coming)
+	if(curlCode == CURLE_OK && parser->ctx && !parser->resultLimitReached)
+	{
+		parserArena(parser, TRUE);
+		xmlParseChunk(parser->ctx, NULL, 0, TRUE);
+		parserArena(parser, FALSE);
+	}
+
+	return curlCode;
+}
+
+//Parse the cached data, as if it was received
+int search_cache_replay(bing_parser* parser)
+{
+	size_t offset;
+	size_t size;
+	int curlCode = CURLE_OK;
+
+	for(offset = 0; offset < parser->cacheSize; offset += size)
+	{
+		size = parser->cacheSize - offset;
+		if(size > CURL_MAX_WRITE_SIZE)
+		{
+			size = CURL_MAX_WRITE_SIZE;
+		}
+		if(getxmldata(parser, parser->cacheData + offset, size) != size)
+		{
+			//Same as cURL, the result limit was reached or an error occurred
+			curlCode = CURLE_WRITE_ERROR;
+			break;
+		}
+	}
+
+	return search_parse_done(parser, curlCode);
+}
+
+//The server said the cached data hasn't changed, so the cached data is taken to be parsed instead. Returns FALSE if it was evicted while the server was being asked.
+BOOL search_cache_revalidate(bing_parser* parser)
+{
+	if(!parser->cacheHit && !parser->cacheRefreshOnly)
+	{
+		bing_mem_free(parser->cacheData);
+		parser->cacheData = NULL;
+		parser->cacheSize = 0;
+		parser->cacheAlloc = 0;
+
+		//Nobody can join a refresh once it's closed, so if nobody did, the cached data only has to be good for another TTL
+		if(parser->cacheRefresh)
+		{
+			flight_close(parser);
+			parser->cacheRefreshOnly = !parser->followers;
+		}
+		if(!cache_revalidate(parser->bing, parser->cacheUrl, parser->cacheRefreshOnly ? NULL : &parser->cacheData, &parser->cacheSize))
+		{
+			parser->cacheRefreshOnly = FALSE;
+			return FALSE;
+		}
+
+		//Nothing was received, and the data doesn't need to be cached again
+		bing_mem_free(parser->cacheUrl);
+		parser->cacheUrl = NULL;
+		parser->cacheHit = !parser->cacheRefreshOnly;
+	}
+	return TRUE;
+}
+
+//Finish a transfer (the document is complete, but not converted to a response)
+int search_transfer_done(bing_parser* parser, int curlCode)
+{
+	//Size of the body that was received (followers didn't receive anything themselves)
+	parser->wireBytes += parser->transfer.transport->wireBytes(&parser->transfer);
+
+	//Only asked for the data if it changed, and it hasn't
+	if(curlCode == CURLE_OK && (parser->transfer.ifNoneMatch || parser->transfer.ifModifiedSince) && parser->transfer.transport->status(&parser->transfer) == HTTP_NOT_MODIFIED)
+	{
+		if(search_cache_revalidate(parser))
+		{
+			return parser->cacheRefreshOnly ? CURLE_OK : search_cache_replay(parser);
+		}
+
+		//It was evicted, and the data couldn't be asked for again, so there is nothing to parse
+#if defined(BING_DEBUG)
+		BING_MSG_PRINTOUT("CACHE: Revalidated data is gone\n");
+#endif
+	}
+
+	return search_parse_done(parser, curlCode);
+}
+
+//Convert the document downloaded by source into responses for parser (source is either the parser or one of it's additional URL parsers)
+int search_parse_doc(bing_parser* parser, bing_parser* source, int curlCode, xmlFreeFunc xmlFree)
+{
+	if(source != parser && source->parseError != PE_NO_ERROR)
+	{
+		//The additional URL failed while downloading
+		parser->parseError = source->parseError;
+		return curlCode;
+	}
+
+	if(curlCode == CURLE_OK && source->cacheRefreshOnly)
+	{
+		//Nothing was received, and nobody wants a response
+		return curlCode;
+	}
+
+	if(curlCode == CURLE_OK)
+	{
+		//No errors (so we hope)
+		if(source->ctx)
+		{
+			if(source->ctx->myDoc && source->ctx->myDoc->children)
+			{
+				//Parse document (or whatever is left of it, if streaming)
+				if((source == parser && parser->stream) ? streamProcess(parser, TRUE, xmlFree) : parseResponse(source->ctx->myDoc->children, FALSE, parser, xmlFree))
+				{
+					if(parser->response && parser->response->type == BING_SOURCETYPE_COMPOSITE)
+					{
+						if(hashtable_get_item(parser->response->data, RESPONSE_COMPOSITE_SUBRES_STR, NULL) == 0)
+						{
+							parser->parseError = PE_COMPOSITE_NO_INTERNAL_RESPONSES;
+						}
+					}
+				}
+				else
+				{
+					parser->parseError = PE_SEARCH_OK_NO_RESPONSE;
+				}
+			}
+			else
+			{
+				//Somehow parsing completed successfully (or was stopped before the document even started), but there are no children (responses) to process
+				parser->parseError = PE_NO_RESPONSES;
+			}
+		}
+		else
+		{
+#if defined(BING_DEBUG)
+			//Search finished, but didn't work. What happened?
+			if(source->transfer.transport)
+			{
+				switch(curlCode = (int)source->transfer.transport->status(&source->transfer))
+				{
+					case HTTP_NO_RESPONSE:
+						//No response was received from server
+						parser->parseError = PE_CURL_OK_HTTP_RESPONSE_NO_RESPONSE;
+						break;
+					case HTTP_NOT_FOUND:
+						parser->parseError = PE_CURL_OK_HTTP_RESPONSE_NOT_FOUND;
+						break;
+					default:
+#endif
+						//Umm, a... what? How did this succeed?
+						parser->parseError = PE_CURL_OK_CONTEXT_NOT_OK;
+#if defined(BING_DEBUG)
+						break;
+				}
+			}
+			else
+			{
+				//cURL succeeded, but it didn't get any data. On top of that, we couldn't get the HTTP status code
+				parser->parseError = PE_CURL_OK_HTTP_RESPONSE_CODE_FAIL;
+			}
+			curlCode = CURLE_OK; //Reset code
+#endif
+		}
+	}
+
+	return curlCode;
+}
+
+//Produce the response, once every transfer is done
+int search_finish(bing_parser* parser, int curlCode, xmlFreeFunc xmlFree)
+{
+	bing_parser* sub;
+	size_t wireBytes = parser->wireBytes;
+	size_t decodedBytes = parser->decodedBytes;
+	unsigned int attempts = parser->retry.attempts;
+
+	//Out of time, what was received isn't parsed
+	if(curlCode == CURLE_OK && parser->transfer.deadline > 0 && engine_time() >= parser->transfer.deadline)
+	{
+		curlCode = CURLE_OPERATION_TIMEDOUT;
+	}
+
+	curlCode = search_parse_doc(parser, parser, curlCode, xmlFree);
+
+	//Merge the additional URLs in order (the first additional response turns the response into a composite response)
+	for(sub = parser->fanout; sub && curlCode == CURLE_OK && canContinue(parser); sub = sub->fanoutNext)
+	{
+		curlCode = search_parse_doc(parser, sub, sub->curlCode, xmlFree);
+		parser->timedOut |= sub->timedOut;
+		parser->rateLimited |= sub->rateLimited;
+
+		wireBytes += sub->wireBytes;
+		decodedBytes += sub->decodedBytes;
+		attempts += sub->retry.attempts;
+	}
+
+	if(parser->response)
+	{
+		parser->response->wireBytes = wireBytes;
+		parser->response->decodedBytes = decodedBytes;
+		parser->response->attempts = attempts;
+	}
+
+	//cURL only times out if the search has a deadline, and a transfer is only given the time the search has left
+	if(parser->transfer.deadline > 0 && (parser->timedOut || curlCode == CURLE_OPERATION_TIMEDOUT))
+	{
+		parser->timedOut = TRUE;
+		parser->parseError = PE_DEADLINE_PASSED;
+	}
+	else if(parser->rateLimited)
+	{
+		parser->parseError = PE_RATE_LIMITED;
+	}
+
+	//Cache the data (only if all of it was received, and it produced a response)
+	if(parser->cacheUrl && curlCode == CURLE_OK && !parser->resultLimitReached && canContinue(parser) && parser->response)
+	{
+		cache_store(parser->bing, parser->cacheUrl, parser->response->type, parser->cacheEtag, parser->cacheModified, parser->cacheData, parser->cacheSize);
+		parser->cacheData = NULL;
+	}
+
+	return curlCode;
+}
+
+void async_search_complete(bing_parser* parser, int curlCode);
+
+//Take the searches that joined this one (so they can be finished after it)
+bing_parser* flight_take(bing_parser* parser)
+{
+	bing_parser* ret;
+
+	flight_close(parser);
+
+	ret = parser->followers;
+	parser->followers = NULL;
+	return ret;
+}
+
+//Finish the searches that joined another search, with the same result
+void flight_finish(bing_parser* followers, int curlCode)
+{
+	bing_parser* follower;
+	xmlFreeFunc xmlFreeF;
+
+	xmlGcMemGet(&xmlFreeF, NULL, NULL, NULL, NULL);
+
+	while((follower = followers))
+	{
+		followers = follower->followerNext;
+		follower->followerNext = NULL;
+
+		follower->curlCode = search_transfer_done(follower, follower->transfer.cancelled ? CURLE_ABORTED_BY_CALLBACK : curlCode);
+		async_search_complete(follower, search_finish(follower, follower->curlCode, xmlFreeF));
+	}
+}
+
+//Something the search was waiting for is done (a transfer, or the wait to hedge it). Once everything is done, the response is produced.
+void search_pending_done(bing_parser* root)
+{
+	xmlFreeFunc xmlFreeF;
+
+	if(atomic_sub_value(&root->fanoutPending, 1) == 1)
+	{
+		if(root->fanoutWait)
+		{
+			//A synchronous search is waiting
+			pthread_mutex_lock(&root->fanoutWait->mutex);
+			root->fanoutWait->done = TRUE;
+			pthread_cond_signal(&root->fanoutWait->cond);
+			pthread_mutex_unlock(&root->fanoutWait->mutex);
+		}
+		else
+		{
+			//Get memory function
+			xmlGcMemGet(&xmlFreeF, NULL, NULL, NULL, NULL);
+
+			async_search_complete(root, search_finish(root, root->curlCode, xmlFreeF));
+		}
+	}
+}
+
+//Called when either transfer of a hedged search is done. Returns FALSE if it's the transfer that isn't used.
+BOOL search_hedge_done(bing_parser* parser, void* handle, int curlCode)
+{
+	if(parser->hedgeState == HEDGE_RUNNING && curlCode != CURLE_ABORTED_BY_CALLBACK)
+	{
+		//Failed before anything was received, the other transfer is used
+		if(handle == parser->transfer.handle)
+		{
+			transport_swap(&parser->transfer);
+			parser->hedgeWon = TRUE;
+
+			hedge_won(parser->bing);
+		}
+	}
+	if(parser->hedgeState != HEDGE_DECIDED)
+	{
+		hedgeStop(parser);
+	}
+
+	if(handle != parser->transfer.handle)
+	{
+		//Cancelled (or failed)
+		parser->transfer.transport->release(&parser->transfer, handle);
+		parser->transfer.hedgeHandle = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+//Count a transfer attempt, and see if it should be attempted again. Returns TRUE if it should be retried (after parser->retry.delay).
+BOOL search_retry_check(bing_parser* parser, int curlCode)
+{
+	long httpStatus = 0;
+
+	parser->retry.attempts++;
+
+	//Anything that was parsed can't be taken back, a hedged search could still get a response from the other transfer, and a cancelled search isn't wanted (unless other searches joined it)
+	if(parser->ctx || parser->transfer.hedgeHandle || (parser->transfer.cancelled && !parser->followers))
+	{
+		return FALSE;
+	}
+	if(curlCode == CURLE_OK)
+	{
+		httpStatus = parser->transfer.transport->status(&parser->transfer);
+
+		//The server said the cached data hasn't changed, but it was evicted while the server was being asked. The data itself is asked for straight away, whether or not failed searches are retried.
+		if(httpStatus == HTTP_NOT_MODIFIED && (parser->transfer.ifNoneMatch || parser->transfer.ifModifiedSince) && !search_cache_revalidate(parser))
+		{
+			transport_unconditional(&parser->transfer);
+			parser->retry.delay = 0;
+			parser->retryDiscard = FALSE;
+#if defined(BING_DEBUG)
+			BING_MSG_PRINTOUT("CACHE: Revalidated data is gone, asking for it again\n");
+#endif
+			return parser->transfer.transport->deadline(&parser->transfer, 0);
+		}
+	}
+	if(!retry_next(&parser->retry, curlCode, httpStatus))
+	{
+		return FALSE;
+	}
+
+	//Only retried if there's time left once the delay is over (the transfer then gets whatever is left)
+	if(!parser->transfer.transport->deadline(&parser->transfer, parser->retry.delay))
+	{
+		return FALSE;
+	}
+
+#if defined(BING_DEBUG)
+	BING_MSG_PRINTOUT("SEARCH: Retrying (cURL %d, HTTP %ld) in %u ms\n", curlCode, httpStatus, parser->retry.delay);
+#endif
+	parser->retryDiscard = FALSE;
+	return TRUE;
+}
+
+//Called by the engine once a streamed search that was paused can continue (data is the stream, which was retained for this)
+BOOL search_stream_resume(void* data, void* curl, int curlCode)
+{
+	bing_stream* stream = (bing_stream*)data;
+	bing_parser* parser;
+
+	//Searches are only finished on the engine thread, so if it's still set it can't go away
+	pthread_mutex_lock(&stream->mutex);
+
+	parser = (bing_parser*)stream->search;
+	stream->resumePosted = FALSE;
+
+	pthread_mutex_unlock(&stream->mutex);
+
+	if(parser && parser->transfer.transport->resume && stream_resume(stream))
+	{
+		parser->transfer.transport->resume(&parser->transfer);
+	}
+
+	stream_release(stream);
+
+	return FALSE;
+}
+
+//Wait for the rate limit to allow a transfer (added to delay, the time the transfer already has to wait), and give the transfer the time the search has left once it's made. Returns CURLE_OK if the transfer can be made.
+int search_permit(bing_parser* parser, unsigned int* delay)
+{
+	unsigned long long now = engine_time();
+	unsigned int maxWait = 0;
+	unsigned int wait;
+
+	if(parser->transfer.deadline > 0)
+	{
+		if(now + *delay >= parser->transfer.deadline)
+		{
+			parser->timedOut = TRUE;
+			return CURLE_OPERATION_TIMEDOUT;
+		}
+		maxWait = (unsigned int)(parser->transfer.deadline - (now + *delay));
+	}
+
+	if(!rate_take(parser->bing, FALSE, maxWait, &wait))
+	{
+		if(wait > 0)
+		{
+			//The token would come too late
+			parser->timedOut = TRUE;
+			return CURLE_OPERATION_TIMEDOUT;
+		}
+		parser->rateLimited = TRUE;
+		return CURLE_FAILED_INIT;
+	}
+	*delay += wait;
+
+	if(!parser->transfer.transport->deadline(&parser->transfer, *delay))
+	{
+		parser->timedOut = TRUE;
+		return CURLE_OPERATION_TIMEDOUT;
+	}
+	return CURLE_OK;
+}
+
+//Add the transfer of a search to the engine, once the rate limit allows it (and it has waited for delay). Returns CURLE_OK if it was added (or will be).
+int search_add(bing_parser* parser, unsigned int delay)
+{
+	int ret = search_permit(parser, &delay);
+
+	if(ret == CURLE_OK)
+	{
+		if(parser->captureMode == BING_CAPTURE_RECORD)
+		{
+			//Each attempt is recorded
+			capture_free(&parser->capture);
+			parser->captureRecording = TRUE;
+			parser->captureStart = engine_time() + delay;
+		}
+		if(!parser->transfer.transport->start(&parser->transfer, delay))
+		{
+			parser->captureRecording = FALSE;
+			ret = CURLE_FAILED_INIT;
+		}
+	}
+	return ret;
+}
+
+//Why a search failed, as an errno value. Zero if there is no particular reason.
+int search_errno(bing_parser* parser)
+{
+	if(parser->timedOut)
+	{
+		return ETIMEDOUT;
+	}
+	if(parser->rateLimited)
+	{
+		return EAGAIN;
+	}
+	return 0;
+}
+
+//Called by the engine when a transfer completes
+BOOL search_engine_done(void* data, void* curl, int curlCode)
+{
+	bing_parser* parser = (bing_parser*)data;
+	bing_parser* root = parser->fanoutParent ? parser->fanoutParent : parser;
+	bing_parser* followers;
+	int addCode;
+
+	if(parser->hedgeState != HEDGE_NONE && !search_hedge_done(parser, curl, curlCode))
+	{
+		//The search is finished by the other transfer
+		search_pending_done(root);
+		return FALSE;
+	}
+
+	//Only responses that were received completely can be replayed
+	if(parser->captureRecording)
+	{
+		parser->captureRecording = FALSE;
+		if(curlCode == CURLE_OK && (parser->capture.status = parser->transfer.transport->status(&parser->transfer)) > 0)
+		{
+			parser->capture.total = (unsigned int)(engine_time() - parser->captureStart);
+			parser->capture.wireBytes = parser->transfer.transport->wireBytes(&parser->transfer);
+			capture_store(parser->transfer.url, &parser->capture);
+		}
+		capture_free(&parser->capture);
+	}
+
+	//The same search is still running, so nothing else changes
+	if(search_retry_check(parser, curlCode))
+	{
+		if((addCode = search_add(parser, parser->retry.delay)) == CURLE_OK)
+		{
+			return FALSE;
+		}
+		curlCode = addCode;
+	}
+
+	//If the cached data is used, the followers are given it as it's parsed
+	parser->curlCode = search_transfer_done(parser, curlCode);
+	followers = flight_take(parser);
+
+	//Once the last transfer is done, the response can be produced
+	search_pending_done(root);
+
+	//The searches that joined are finished in the order they were made
+	flight_finish(followers, curlCode);
+
+	return FALSE;
+}
+
+//Make the hedge of a transfer: the same search again, on another connection
+void search_transfer_hedge(bing_parser* parser)
+{
+	unsigned int wait;
+
+	atomic_add(&parser->fanoutPending, 1);
+	//Hedges are only made if they can be made now
+	if(hedge_allow(parser->bing) && rate_take(parser->bing, TRUE, 0, &wait) && parser->transfer.transport->hedge(&parser->transfer))
+	{
+		parser->hedgeState = HEDGE_RUNNING;
+	}
+	else
+	{
+		//The original transfer is still running, so this isn't the last
+		atomic_sub(&parser->fanoutPending, 1);
+	}
+}
+
+//Called by the engine once a search has waited long enough to be hedged
+BOOL search_hedge(void* data, void* curl, int curlCode)
+{
+	bing_parser* parser = (bing_parser*)data;
+
+	if(parser->hedgeState == HEDGE_WAITING && !parser->transfer.cancelled)
+	{
+		parser->hedgeState = HEDGE_DECIDED;
+		search_transfer_hedge(parser);
+	}
+
+	//The wait is over
+	search_pending_done(parser);
+
+	return FALSE;
+}
+
+//Setup a search to be hedged, if hedging is on. Returns TRUE if it is (even if it's only being timed).
+BOOL search_hedge_setup(bing_parser* parser)
+{
+	//Searches with additional URLs aren't hedged, and only some transports have connections to race (the transport sets up the transfer for hedging once it's made)
+	if(parser->hedgeState == HEDGE_NONE && !parser->fanout && !parser->fanoutParent && parser->transfer.transport->hedge && hedge_delay(parser->bing, &parser->hedgeDelay))
+	{
+		parser->hedgeState = HEDGE_WAITING;
+		parser->transfer.hedged = TRUE;
+	}
+	return parser->hedgeState != HEDGE_NONE;
+}
+
+//Called by the engine to stop the transfers of a search that was cancelled
+BOOL search_abort(void* data, void* curl, int curlCode)
+{
+	search_handle* handle;
+	bing_parser* parser = NULL;
+	bing_parser* followers;
+	bing_parser* transfer;
+
+	//Searches are only finished on the engine thread (other then searches that joined another), so if it's found it can't go away
+	pthread_mutex_lock(&searchHandleMutex);
+
+	handle = *search_handle_find((int)(intptr_t)data);
+	if(handle)
+	{
+		parser = handle->parser;
+	}
+
+	pthread_mutex_unlock(&searchHandleMutex);
+
+	if(parser)
+	{
+		//Searches that joined this one still want the response, so it keeps going for them
+		followers = flight_take(parser);
+		if(followers)
+		{
+			parser->followers = followers;
+			return FALSE;
+		}
+
+		for(transfer = parser; transfer; transfer = (transfer == parser) ? parser->fanout : transfer->fanoutNext)
+		{
+			transfer->transfer.cancelled = TRUE;
+			transfer->transfer.transport->cancel(&transfer->transfer);
+		}
+	}
+
+	return FALSE;
+}
+
+//Called by the engine to produce the response of a cached search
+BOOL search_cache_done(void* data, void* curl, int curlCode)
+{
+	bing_parser* parser = (bing_parser*)data;
+	xmlFreeFunc xmlFreeF;
+
+	xmlGcMemGet(&xmlFreeF, NULL, NULL, NULL, NULL);
+
+	async_search_complete(parser, search_finish(parser, parser->transfer.cancelled ? CURLE_ABORTED_BY_CALLBACK : search_cache_replay(parser), xmlFreeF));
+
+	return FALSE;
+}
+
+//Run the search, and the additional URLs, on the network engine. Returns FALSE if nothing could be started.
+BOOL search_start(bing_parser* parser)
+{
+	bing_parser* sub;
+	BOOL hedged;
+	int curlCode;
+
+	parser->fanoutPending = 1;
+	for(sub = parser->fanout; sub; sub = sub->fanoutNext)
+	{
+		sub->resultLimit = parser->resultLimit;
+		parser->fanoutPending++;
+	}
+
+	//The wait to hedge the search is counted like another transfer, so the search isn't finished while the wait could still end
+	hedged = search_hedge_setup(parser) && parser->hedgeDelay > 0 && (parser->transfer.deadline == 0 || engine_time() + parser->hedgeDelay < parser->transfer.deadline);
+	if(hedged)
+	{
+		parser->fanoutPending++;
+	}
+	parser->hedgeStart = engine_time();
+
+	if(search_add(parser, 0) != CURLE_OK)
+	{
+		return FALSE;
+	}
+	if(hedged && !engine_post_delayed(search_hedge, parser, parser->hedgeDelay))
+	{
+		//Not hedged after all (the transfer could already be done)
+		search_pending_done(parser);
+	}
+	for(sub = parser->fanout; sub; sub = sub->fanoutNext)
+	{
+		if((curlCode = search_add(sub, 0)) != CURLE_OK)
+		{
+			//Still needs to be counted as done
+			search_engine_done(sub, sub->transfer.handle, curlCode);
+		}
+	}
+	return TRUE;
+}
+
+//If the data was cached before, ask the server to only send it if it changed
+void cacheConditional(bing_parser* parser)
+{
+	//Given to the transport, which asks the server once the transfer is made
+	cache_validators(parser->bing, parser->cacheUrl, &parser->transfer.ifNoneMatch, &parser->transfer.ifModifiedSince);
+}
+
+//Search for data that is in the cache, but stale, so the cache has fresh data. The response isn't returned to anyone.
+void search_cache_refresh(unsigned int bingID, const char* url)
+{
+	bing_parser* parser;
+
+	if(check_for_connection())
+	{
+		search_setup();
+
+		parser = bing_mem_malloc(sizeof(bing_parser));
+		if(parser && setupParser(parser, bingID, url))
+		{
+			parser->cacheRefresh = TRUE;
+			parser->cacheLimit = cache_limit();
+			parser->cacheUrl = bing_mem_strdup(url);
+			if(parser->cacheUrl)
+			{
+				cacheConditional(parser);
+			}
+
+#if !defined(BING_NO_COALESCING)
+			//Searches for the same thing, that can't use the stale data, can join
+			flight_open(parser, url);
+#endif
+
+			if(!search_start(parser))
+			{
+#if defined(BING_DEBUG)
+				BING_MSG_PRINTOUT("CACHE: Could not start refresh\n");
 #endif
+				flight_finish(flight_take(parser), CURLE_FAILED_INIT);
+				search_cleanup(parser);
+			}
+		}
+		else
+		{
+			bing_mem_free(parser);
+			search_release();
+		}
+	}
 }
 
-int single_search_in(bing_parser* parser, xmlFreeFunc xmlFree)
+//Setup the parser to use the cache. Returns TRUE if the data for the search is cached.
+BOOL search_cache_setup(bing_parser* parser, const char* url)
 {
-	int curlCode;
+	BOOL refresh;
 
-	//Invoke cURL
-	if((curlCode = curl_easy_perform(parser->curl)) == CURLE_OK)
+	//Only single URL, non-streamed, searches are cached
+	if(!parser->fanout && !parser->stream)
 	{
-		//No errors (so we hope)
-		if(parser->ctx)
+		parser->cacheData = cache_find(parser->bing, url, &parser->cacheSize, &refresh);
+		if(parser->cacheData)
 		{
-			//Finish parsing
-			xmlParseChunk(parser->ctx, NULL, 0, TRUE);
+			parser->cacheHit = TRUE;
 
-			if(parser->ctx->myDoc->children)
-			{
-				//Parse document
-				if(parseResponse(parser->ctx->myDoc->children, FALSE, parser, xmlFree))
-				{
-					if(parser->response && parser->response->type == BING_SOURCETYPE_COMPOSITE)
-					{
-						if(hashtable_get_item(parser->response->data, RESPONSE_COMPOSITE_SUBRES_STR, NULL) == 0)
-						{
-							parser->parseError = PE_COMPOSITE_NO_INTERNAL_RESPONSES;
-						}
-					}
-				}
-				else
-				{
-					parser->parseError = PE_SEARCH_OK_NO_RESPONSE;
-				}
-			}
-			else
+			//The data is used anyway, and refreshed in the background
+			if(refresh)
 			{
-				//Somehow parsing completed successfully, but there are no children (responses) to process
-				parser->parseError = PE_NO_RESPONSES;
+				search_cache_refresh(parser->bing, url);
 			}
 		}
-		else
+		else if((parser->cacheLimit = cache_limit()) > 0 && (parser->cacheUrl = bing_mem_strdup(url)))
 		{
-#if defined(BING_DEBUG)
-			//Search finished, but didn't work. What happened?
-			curlCode = 0;
-			if(curl_easy_getinfo(parser->curl, CURLINFO_RESPONSE_CODE, &curlCode) == CURLE_OK)
-			{
-				switch(curlCode)
-				{
-					case HTTP_NO_RESPONSE:
-						//No response was received from server
-						parser->parseError = PE_CURL_OK_HTTP_RESPONSE_NO_RESPONSE;
-						break;
-					case HTTP_NOT_FOUND:
-						parser->parseError = PE_CURL_OK_HTTP_RESPONSE_NOT_FOUND;
-						break;
-					default:
-#endif
-						//Umm, a... what? How did this succeed?
-						parser->parseError = PE_CURL_OK_CONTEXT_NOT_OK;
-#if defined(BING_DEBUG)
-						break;
-				}
-			}
-			else
-			{
-				//cURL succeeded, but it didn't get any data. On top of that, we couldn't get the HTTP status code
-				parser->parseError = PE_CURL_OK_HTTP_RESPONSE_CODE_FAIL;
-			}
-			curlCode = CURLE_OK; //Reset code
-#endif
+			cacheConditional(parser);
 		}
 	}
-
-	return curlCode;
+	return parser->cacheHit;
 }
 
 int search_in(bing_parser* parser)
 {
 	int curlCode;
-	p_url_process* urlProcess;
 	xmlFreeFunc xmlFreeF;
+	search_wait wait;
+	unsigned int delay;
 
 	//Get memory function
 	xmlGcMemGet(&xmlFreeF, NULL, NULL, NULL, NULL);
 
-	//Run main search
-	curlCode = single_search_in(parser, xmlFreeF);
-
-	//Handle additional parsing operations
-	urlProcess = parser->additionalUrlProcessing;
-	while(urlProcess && curlCode == CURLE_OK && canContinue(parser)) //Only run if everything else was successful
+	if(parser->cacheHit)
+	{
+		//Nothing to download
+		curlCode = search_cache_replay(parser);
+	}
+	else if(parser->fanout || !parser->transfer.transport->perform || parser->captureMode != BING_CAPTURE_OFF || search_hedge_setup(parser))
 	{
-		//Modify cURL for the new URL
-		if(setCurl(parser->bing, urlProcess->url, parser->curl, parser))
+		//Download every URL at the same time (or hedge the search, record it, or use another transport), then wait for all of them
+		pthread_mutex_init(&wait.mutex, NULL);
+		pthread_cond_init(&wait.cond, NULL);
+		wait.done = FALSE;
+		parser->fanoutWait = &wait;
+
+		if(search_start(parser))
 		{
-			curlCode = single_search_in(parser, xmlFreeF);
-			urlProcess = urlProcess->next;
+			pthread_mutex_lock(&wait.mutex);
+			while(!wait.done)
+			{
+				pthread_cond_wait(&wait.cond, &wait.mutex);
+			}
+			pthread_mutex_unlock(&wait.mutex);
+
+			curlCode = parser->curlCode;
 		}
 		else
 		{
-			//Resetting the URL failed
-			parser->parseError = PE_CURL_URL_PROC_RESET_FAIL;
+			curlCode = CURLE_FAILED_INIT;
 		}
+
+		parser->fanoutWait = NULL;
+		pthread_cond_destroy(&wait.cond);
+		pthread_mutex_destroy(&wait.mutex);
 	}
-	return curlCode;
+	else
+	{
+		//Make the transfer (again, if it fails in a way that can be retried), once the rate limit allows it
+		delay = 0;
+		while((curlCode = search_permit(parser, &delay)) == CURLE_OK)
+		{
+			retry_sleep(delay);
+			if(!search_retry_check(parser, (curlCode = parser->transfer.transport->perform(&parser->transfer))))
+			{
+				break;
+			}
+			delay = parser->retry.delay;
+		}
+		curlCode = search_transfer_done(parser, curlCode);
+	}
+
+	return search_finish(parser, curlCode, xmlFreeF);
 }
 
 //Search functions
-bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
+bing_response_t search_sync_url_in(unsigned int bingID, const char* url, unsigned int result_limit)
 {
 	bing_parser* parser;
 	bing_response_t ret = NULL;
@@ -1358,7 +2819,7 @@ bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
 	int curlCode;
 #endif
 
-	if(check_for_connection() && url)
+	if(url)
 	{
 		search_setup();
 
@@ -1369,7 +2830,10 @@ bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
 			//Setup the parser
 			if(setupParser(parser, bingID, url))
 			{
-				if(check_for_connection())
+				parser->resultLimit = result_limit;
+
+				//Cached searches don't need a connection
+				if(search_cache_setup(parser, url) || check_for_connection())
 				{
 					//Perform search
 					if((
@@ -1382,6 +2846,9 @@ bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
 						if(canContinue(parser))
 						{
 							ret = parser->response;
+
+							//Search for the next page while the developer looks at this one
+							prefetch_next(ret, 0);
 						}
 #if defined(BING_DEBUG)
 						else
@@ -1398,6 +2865,12 @@ bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
 #endif
 				}
 
+				//Let the developer know why there is no response
+				if(!ret && search_errno(parser))
+				{
+					errno = search_errno(parser);
+				}
+
 				//Cleanup
 				search_cleanup(parser);
 			}
@@ -1421,29 +2894,31 @@ bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
 	return ret;
 }
 
+bing_response_t bing_search_url_sync(unsigned int bingID, const char* url)
+{
+	return search_sync_url_in(bingID, url, 0);
+}
+
 bing_response_t bing_search_sync(unsigned int bingID, const char* query, const bing_request_t request)
 {
 	const char* url;
 	bing_response_t ret = NULL;
 
-	if(check_for_connection())
+	//Get the URL (the connection is checked by the search, a cached search doesn't need one)
+	url = bing_request_url(query, request);
+	if(url)
 	{
-		//Get the URL
-		url = bing_request_url(query, request);
-		if(url)
-		{
-			ret = bing_search_url_sync(bingID, url);
+		ret = search_sync_url_in(bingID, url, request_get_result_limit(request));
 
-			//Free URL
-			bing_mem_free((void*)url);
-		}
+		//Free URL
+		bing_mem_free((void*)url);
+	}
 #if defined(BING_DEBUG)
-		else
-		{
-			BING_MSG_PRINTOUT("SYNC: Could not create URL\n");
-		}
-#endif
+	else
+	{
+		BING_MSG_PRINTOUT("SYNC: Could not create URL\n");
 	}
+#endif
 
 	return ret;
 }
@@ -1453,63 +2928,87 @@ bing_response_t bing_search_next_sync(const bing_response_t pre_response)
 	bing_response_t ret = NULL;
 	bing_response* res = (bing_response*)pre_response;
 
-	if(check_for_connection() && bing_response_has_next_results(pre_response))
+	if(bing_response_has_next_results(pre_response))
 	{
-		ret = bing_search_url_sync(res->bing, res->nextUrl);
+		ret = prefetch_take(res->bing, res->nextUrl);
+		if(ret)
+		{
+			prefetch_next(ret, 0);
+		}
+		else
+		{
+			ret = bing_search_url_sync(res->bing, res->nextUrl);
+		}
 	}
 
 	return ret;
 }
 
-void* async_search(void* ctx)
+void async_search_complete(bing_parser* parser, int curlCode)
 {
-#if defined(BING_DEBUG)
-	int curlCode;
-#endif
 	receive_bing_response_func responseFunc = NULL;
 	bing_response* response = NULL;
 	const void* userData = NULL;
-	bing_parser* parser = (bing_parser*)ctx;
+	BOOL cancelled;
 
-	if(check_for_connection())
+	//It's done, so it can't be cancelled anymore (if it was, the developer isn't told it's done)
+	cancelled = search_handle_remove(parser->searchID);
+
+	//Check the search
+	if(curlCode == CURLE_OK)
 	{
-		//Perform search
-		if((
+		//We check for an error
 #if defined(BING_DEBUG)
-				curlCode =
+		if(!
 #endif
-						search_in(parser)) == CURLE_OK)
-		{
-			//We check for an error
+			canContinue(parser)
 #if defined(BING_DEBUG)
-			if(!
+		)
+		{
+			BING_MSG_PRINTOUT("ASYNC: Parser error\n");
+		}
+#else
+		;
 #endif
-				canContinue(parser)
+
+		//Get response (do this so we can free before any error might occur)
+		responseFunc = parser->responseFunc;
+		response = parser->response;
+		userData = parser->userData;
+	}
+	else
+	{
 #if defined(BING_DEBUG)
-			)
+		BING_MSG_PRINTOUT("ASYNC: Error invoking cURL: %s\n", curl_easy_strerror(curlCode));
+#endif
+		if(parser->stream)
+		{
+			//Some results may have been streamed before the transfer failed, so let the developer know they are no longer valid
+			if(!parser->streamFailedResponse)
 			{
-				BING_MSG_PRINTOUT("ASYNC: Parser error\n");
+				parser->streamFailedResponse = parser->response;
 			}
-#else
-			;
-#endif
-
-			//Get response (do this so we can free before any error might occur)
-			responseFunc = parser->responseFunc;
-			response = parser->response;
-			userData = parser->userData;
 		}
-#if defined(BING_DEBUG)
 		else
 		{
-			BING_MSG_PRINTOUT("ASYNC: Error invoking cURL: %s\n", curl_easy_strerror(curlCode));
+			bing_response_free(parser->response);
 		}
-#endif
+		parser->response = NULL;
+
+		//Let the developer know the search failed (and if it was because it ran out of time)
+		responseFunc = parser->responseFunc;
+		userData = parser->userData;
+		errno = search_errno(parser);
 	}
 
+	//Search for the next page while the developer looks at this one (prefetched responses do this themselves, and nobody looks at refreshes)
+	if(response && responseFunc && responseFunc != prefetch_done && !cancelled)
+	{
+		prefetch_next(response, 0);
+	}
 
 	//Return response (NULL is fine for a response)
-	if(responseFunc)
+	if(responseFunc && !cancelled)
 	{
 		responseFunc(response, userData);
 	}
@@ -1520,8 +3019,6 @@ void* async_search(void* ctx)
 
 	//Cleanup, must be done after in order to prevent a memory leak when doing an async (event) search
 	search_cleanup(parser);
-
-	return NULL;
 }
 
 //We need to free the event because the event could be seen by multiple applications and we don't want them all freeing it
@@ -1532,19 +3029,18 @@ void event_done(bps_event_t *event)
 	payload->data1 = NULL;
 }
 
-void event_invocation(bing_response_t response, const void* user_data)
+void event_push(bing_response_t response, unsigned int code, int bpsChannel)
 {
 	bps_event_t* event = NULL;
 	bps_event_payload_t payload;
-	bing_parser* parser = (bing_parser*)user_data;
-	if(response) //We only want to push an event if we have something to push.
+	if(response || code != BING_EVENT_RESPONSE) //We only want to push an event if we have something to push.
 	{
 		memset(&payload, 0, sizeof(bps_event_payload_t));
 		payload.data1 = (uintptr_t)response;
 
 		//Create the event
-		if((bps_event_create(&event, bing_get_domain(), 0, &payload, event_done) != BPS_SUCCESS | //Create event
-				(parser->bpsChannel >= 0 ? bps_channel_push_event(parser->bpsChannel, event) : bps_push_event(event))) != BPS_SUCCESS) //Push event (if we have a BPS channel, use it)
+		if((bps_event_create(&event, bing_get_domain(), code, &payload, event_done) != BPS_SUCCESS | //Create event
+				(bpsChannel >= 0 ? bps_channel_push_event(bpsChannel, event) : bps_push_event(event))) != BPS_SUCCESS) //Push event (if we have a BPS channel, use it)
 		{
 			//Since the event will never be pushed, free it
 			if(event)
@@ -1561,16 +3057,111 @@ void event_invocation(bing_response_t response, const void* user_data)
 	}
 }
 
-int search_async_url_in(unsigned int bingID, const char* url, const void* user_data, BOOL user_data_is_parser, receive_bing_response_func response_func)
+void event_invocation(bing_response_t response, const void* user_data)
+{
+	bing_parser* parser = (bing_parser*)user_data;
+
+	unsigned int code = BING_EVENT_RESPONSE;
+
+	//A search that ran out of time (or couldn't be made) has no response, but the developer still needs to know
+	if(!response)
+	{
+		if(parser->timedOut)
+		{
+			code = BING_EVENT_TIMED_OUT;
+		}
+		else if(parser->rateLimited)
+		{
+			code = BING_EVENT_RATE_LIMITED;
+		}
+	}
+	event_push(response, code, parser->bpsChannel);
+}
+
+//Prefetched responses have no parser, the channel to push the event to is the user data
+void event_channel_invocation(bing_response_t response, const void* user_data)
+{
+	event_push(response, BING_EVENT_RESPONSE, (int)(intptr_t)user_data);
+}
+
+typedef struct PREFETCH_DELIVERY_S
+{
+	bing_response* response;
+	receive_bing_response_func responseFunc;
+	const void* userData;
+	int searchID;
+} prefetch_delivery;
+
+//Prefetched responses are still returned on the network thread, like any other asynchronous search
+BOOL prefetch_deliver(void* data, void* curl, int curlCode)
+{
+	prefetch_delivery* delivery = (prefetch_delivery*)data;
+
+	if(search_handle_remove(delivery->searchID))
+	{
+		//Cancelled
+		bing_response_free((bing_response_t)delivery->response);
+	}
+	else
+	{
+		delivery->responseFunc((bing_response_t)delivery->response, delivery->userData);
+	}
+	bing_mem_free(delivery);
+
+	return FALSE;
+}
+
+//Returns the search ID of the delivery, zero if it couldn't be delivered
+int prefetch_deliver_async(bing_response* response, const void* user_data, receive_bing_response_func response_func)
+{
+	prefetch_delivery* delivery;
+
+	if(response_func)
+	{
+		delivery = (prefetch_delivery*)bing_mem_malloc(sizeof(prefetch_delivery));
+		if(delivery)
+		{
+			delivery->response = response;
+			delivery->responseFunc = response_func;
+			delivery->userData = user_data;
+			delivery->searchID = search_handle_add(NULL);
+			if(delivery->searchID)
+			{
+				if(engine_post(prefetch_deliver, delivery))
+				{
+					return delivery->searchID;
+				}
+				search_handle_remove(delivery->searchID);
+			}
+			bing_mem_free(delivery);
+		}
+	}
+	return 0;
+}
+
+int search_async_url_in(unsigned int bingID, const char* url, unsigned int result_limit, const void* user_data, BOOL user_data_is_parser, receive_bing_result_func result_func, receive_bing_response_func response_func)
 {
 	bing_parser* parser;
-	pthread_attr_t thread_atts;
-	BOOL ret = FALSE;
+	bing* bingI;
+	int ret = 0;
+	BOOL started = FALSE;
+#if !defined(BING_NO_COALESCING)
+	BOOL coalesce;
+#endif
 
-	if(check_for_connection() && url)
+	if(url)
 	{
 		search_setup();
 
+#if !defined(BING_NO_COALESCING)
+		//Only single URL, non-streamed, searches can share a transfer
+		coalesce = !result_func && !strchr(url, ' ');
+		if(coalesce && check_for_connection() && (ret = flight_join(bingID, url, result_limit, user_data, user_data_is_parser, response_func)))
+		{
+			return ret;
+		}
+#endif
+
 		//Create the parser
 		parser = bing_mem_malloc(sizeof(bing_parser));
 		if(parser)
@@ -1582,16 +3173,77 @@ int search_async_url_in(unsigned int bingID, const char* url, const void* user_d
 				parser->responseFunc = response_func;
 				parser->userData = user_data_is_parser ? parser : user_data;
 				parser->bpsChannel = user_data_is_parser ? bps_channel_get_active() : -1;
+				parser->resultLimit = result_limit;
+
+				//Setup streaming
+				if(result_func)
+				{
+					parser->resultFunc = result_func;
+					if((bingI = retrieveBing(bingID)))
+					{
+						pthread_mutex_lock(&bingI->mutex);
+						parser->stream = stream_create(bingI->streamMaxPendingBytes, bingI->streamMaxPendingResults);
+						pthread_mutex_unlock(&bingI->mutex);
+					}
+					if(!parser->stream)
+					{
+#if defined(BING_DEBUG)
+						BING_MSG_PRINTOUT("ASYNC: Could not setup stream\n");
+#endif
+						search_cleanup(parser);
+						return FALSE;
+					}
+
+					//Releasing results resumes the search, if it was paused
+					stream_set_search(parser->stream, parser);
+				}
+
+				//Cached searches don't need a connection
+				if(!search_cache_setup(parser, url) && !check_for_connection())
+				{
+#if defined(BING_DEBUG)
+					BING_MSG_PRINTOUT("ASYNC: No connection\n");
+#endif
+					search_cleanup(parser);
+					return FALSE;
+				}
+
+#if !defined(BING_NO_COALESCING)
+				if(coalesce && !parser->cacheHit)
+				{
+					flight_open(parser, url);
+				}
+#endif
 
-				//Setup thread attributes
-				pthread_attr_init(&thread_atts);
-				pthread_attr_setdetachstate(&thread_atts, PTHREAD_CREATE_DETACHED);
+				//Once it's started, the search can be cancelled with it's ID
+				ret = search_handle_add(parser);
+				if(ret && parser->cacheHit)
+				{
+					//Already have the data, it's parsed on the network thread like any other search
+					started = engine_post(search_cache_done, parser);
+				}
+				else if(ret)
+				{
+					//Run the search on the network engine
+					started = search_start(parser);
+				}
+				if(!started)
+				{
+					search_handle_remove(ret);
+					ret = 0;
 
-				//Create thread
-				ret = pthread_create(&parser->thread, &thread_atts, async_search, parser) == EOK;
+#if defined(BING_DEBUG)
+					BING_MSG_PRINTOUT("ASYNC: Could not start search\n");
+#endif
+					if(search_errno(parser))
+					{
+						errno = search_errno(parser);
+					}
 
-				//Cleanup attributes
-				pthread_attr_destroy(&thread_atts);
+					//Anything that joined has already been told the search started
+					flight_finish(flight_take(parser), CURLE_FAILED_INIT);
+					search_cleanup(parser);
+				}
 			}
 			else
 			{
@@ -1613,46 +3265,66 @@ int search_async_url_in(unsigned int bingID, const char* url, const void* user_d
 	return ret;
 }
 
-int search_async_in(unsigned int bingID, const char* query, const bing_request_t request, const void* user_data, BOOL user_data_is_parser, receive_bing_response_func response_func)
+int search_async_in(unsigned int bingID, const char* query, const bing_request_t request, const void* user_data, BOOL user_data_is_parser, receive_bing_result_func result_func, receive_bing_response_func response_func)
 {
 	const char* url;
-	BOOL ret = FALSE;
+	int ret = 0;
 
-	if(check_for_connection())
+	//Get the URL (the connection is checked by the search, a cached search doesn't need one)
+	url = bing_request_url(query, request);
+	if(url)
 	{
-		//Get the URL
-		url = bing_request_url(query, request);
-		if(url)
-		{
-			ret = search_async_url_in(bingID, url, user_data, user_data_is_parser, response_func);
+		ret = search_async_url_in(bingID, url, request_get_result_limit(request), user_data, user_data_is_parser, result_func, response_func);
 
-			//Free URL
-			bing_mem_free((void*)url);
-		}
+		//Free URL
+		bing_mem_free((void*)url);
+	}
 #if defined(BING_DEBUG)
-		else
-		{
-			BING_MSG_PRINTOUT("ASYNC: Could not create URL\n");
-		}
-#endif
+	else
+	{
+		BING_MSG_PRINTOUT("ASYNC: Could not create URL\n");
 	}
+#endif
 
 	return ret;
 }
 
 int bing_search_async(unsigned int bingID, const char* query, const bing_request_t request, const void* user_data, receive_bing_response_func response_func)
 {
-	return search_async_in(bingID, query, request, user_data, FALSE, response_func);
+	return search_async_in(bingID, query, request, user_data, FALSE, NULL, response_func);
+}
+
+int bing_search_stream_async(unsigned int bingID, const char* query, const bing_request_t request, const void* user_data, receive_bing_result_func result_func, receive_bing_response_func response_func)
+{
+	if(!result_func)
+	{
+		return FALSE;
+	}
+	return search_async_in(bingID, query, request, user_data, FALSE, result_func, response_func);
 }
 
 int bing_search_next_async(const bing_response_t pre_response, const void* user_data, receive_bing_response_func response_func)
 {
-	BOOL ret = FALSE;
+	int ret = 0;
 	bing_response* res = (bing_response*)pre_response;
+	bing_response* prefetched;
 
-	if(check_for_connection() && bing_response_has_next_results(pre_response))
+	if(bing_response_has_next_results(pre_response) && response_func)
 	{
-		ret = search_async_url_in(res->bing, res->nextUrl, user_data, FALSE, response_func);
+		prefetched = prefetch_take(res->bing, res->nextUrl);
+		if(prefetched)
+		{
+			prefetch_next(prefetched, 0);
+			ret = prefetch_deliver_async(prefetched, user_data, response_func);
+			if(!ret)
+			{
+				bing_response_free(prefetched);
+			}
+		}
+		if(!ret)
+		{
+			ret = search_async_url_in(res->bing, res->nextUrl, 0, user_data, FALSE, NULL, response_func);
+		}
 	}
 
 	return ret;
@@ -1660,17 +3332,64 @@ int bing_search_next_async(const bing_response_t pre_response, const void* user_
 
 int bing_search_event_async(unsigned int bingID, const char* query, const bing_request_t request)
 {
-	return search_async_in(bingID, query, request, NULL, TRUE, event_invocation);
+	return search_async_in(bingID, query, request, NULL, TRUE, NULL, event_invocation);
 }
 
-int bing_search_event_next_async(const bing_response_t pre_response)
+int bing_search_cancel(int search)
 {
+	search_handle* handle;
 	BOOL ret = FALSE;
+	BOOL abort = FALSE;
+
+	pthread_mutex_lock(&searchHandleMutex);
+
+	handle = *search_handle_find(search);
+	if(handle && !handle->cancelled)
+	{
+		handle->cancelled = TRUE;
+		if(handle->parser)
+		{
+			//Searches that joined another search don't have a transfer (or URL) of their own, they just stop being given data
+			handle->parser->transfer.cancelled = TRUE;
+			abort = handle->parser->transfer.url != NULL;
+		}
+		ret = TRUE;
+	}
+
+	pthread_mutex_unlock(&searchHandleMutex);
+
+	//Transfers can only be stopped on the engine thread
+	if(abort)
+	{
+		engine_post(search_abort, (void*)(intptr_t)search);
+	}
+
+	return ret;
+}
+
+int bing_search_event_next_async(const bing_response_t pre_response)
+{
+	int ret = 0;
 	bing_response* res = (bing_response*)pre_response;
+	bing_response* prefetched;
 
-	if(check_for_connection() && bing_response_has_next_results(pre_response))
+	if(bing_response_has_next_results(pre_response))
 	{
-		ret = search_async_url_in(res->bing, res->nextUrl, NULL, TRUE, event_invocation);
+		prefetched = prefetch_take(res->bing, res->nextUrl);
+		if(prefetched)
+		{
+			//Already have the response, it's delivered like any other asynchronous search (so it can still be cancelled until the event is pushed)
+			prefetch_next(prefetched, 0);
+			ret = prefetch_deliver_async(prefetched, (const void*)(intptr_t)bps_channel_get_active(), event_channel_invocation);
+			if(!ret)
+			{
+				bing_response_free(prefetched);
+			}
+		}
+		if(!ret)
+		{
+			ret = search_async_url_in(res->bing, res->nextUrl, 0, NULL, TRUE, NULL, event_invocation);
+		}
 	}
 
 	return ret;
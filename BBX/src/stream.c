@@ -0,0 +1,153 @@
+/*
+ * stream.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+//Stream state, shared between the search that produces results and the response that holds them (so results can be released after the search completes)
+
+bing_stream* stream_create(size_t maxPendingBytes, unsigned int maxPendingResults)
+{
+	bing_stream* stream = (bing_stream*)bing_mem_malloc(sizeof(bing_stream));
+	if(stream)
+	{
+		memset(stream, 0, sizeof(bing_stream));
+
+		pthread_mutex_init(&stream->mutex, NULL);
+
+		stream->refCount = 1;
+		stream->maxPendingBytes = maxPendingBytes;
+		stream->maxPendingResults = maxPendingResults;
+	}
+	return stream;
+}
+
+void stream_retain(bing_stream* stream)
+{
+	if(stream)
+	{
+		atomic_add(&stream->refCount, 1);
+	}
+}
+
+void stream_release(bing_stream* stream)
+{
+	if(stream && atomic_sub_value(&stream->refCount, 1) == 1)
+	{
+		pthread_mutex_destroy(&stream->mutex);
+		bing_mem_free(stream);
+	}
+}
+
+//Must be called with the mutex locked
+BOOL stream_over_budget(bing_stream* stream)
+{
+	return (stream->maxPendingBytes > 0 && stream->pendingBytes >= stream->maxPendingBytes) ||
+			(stream->maxPendingResults > 0 && stream->pendingResults >= stream->maxPendingResults);
+}
+
+BOOL stream_pause(bing_stream* stream)
+{
+	BOOL ret = FALSE;
+	if(stream)
+	{
+		pthread_mutex_lock(&stream->mutex);
+
+		if(stream_over_budget(stream))
+		{
+			stream->paused = TRUE;
+			ret = TRUE;
+		}
+
+		pthread_mutex_unlock(&stream->mutex);
+	}
+	return ret;
+}
+
+BOOL stream_resume(bing_stream* stream)
+{
+	BOOL ret = FALSE;
+	if(stream)
+	{
+		pthread_mutex_lock(&stream->mutex);
+
+		if(stream->paused && !stream_over_budget(stream))
+		{
+			stream->paused = FALSE;
+			ret = TRUE;
+		}
+
+		pthread_mutex_unlock(&stream->mutex);
+	}
+	return ret;
+}
+
+void stream_set_search(bing_stream* stream, void* search)
+{
+	if(stream)
+	{
+		pthread_mutex_lock(&stream->mutex);
+
+		stream->search = search;
+
+		pthread_mutex_unlock(&stream->mutex);
+	}
+}
+
+int bing_result_stream_release(bing_result_t result)
+{
+	BOOL ret = FALSE;
+	BOOL resume = FALSE;
+	bing_result* res;
+	bing_response* response;
+	bing_stream* stream;
+	if(result)
+	{
+		res = (bing_result*)result;
+		response = res->parent;
+		stream = response->stream;
+		if(stream)
+		{
+			//The search could still be adding results to the response, so this needs to be locked
+			pthread_mutex_lock(&stream->mutex);
+
+			if(response_remove_result(response, res, FALSE, FALSE))
+			{
+				stream->pendingResults--;
+				stream->pendingBytes -= res->streamBytes;
+
+				free_result(res);
+
+				//The search is waiting for this, so don't wait for anything else to notice
+				if(stream->paused && stream->search && !stream->resumePosted && !stream_over_budget(stream))
+				{
+					stream->resumePosted = TRUE;
+					resume = TRUE;
+				}
+
+				ret = TRUE;
+			}
+
+			pthread_mutex_unlock(&stream->mutex);
+
+			if(resume)
+			{
+				stream_retain(stream);
+				if(!engine_post(search_stream_resume, stream))
+				{
+					pthread_mutex_lock(&stream->mutex);
+					stream->resumePosted = FALSE;
+					pthread_mutex_unlock(&stream->mutex);
+
+					stream_release(stream);
+				}
+			}
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,113 @@
+/*
+ * stringpool.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <libxml/dict.h>
+
+//A pool of interned strings, shared by a response and everything it contains (internal responses, results, types). Many values repeat within a feed (display URLs, news sources, content types), so they only need to be stored once.
+//Results can be used (and custom values set) on another thread while the response is still being parsed, so the dictionary is only used with the pool's mutex locked.
+
+bing_string_pool* string_pool_create()
+{
+	bing_string_pool* pool = (bing_string_pool*)bing_mem_malloc(sizeof(bing_string_pool));
+	if(pool)
+	{
+		memset(pool, 0, sizeof(bing_string_pool));
+
+		pool->dict = xmlDictCreate();
+		if(pool->dict)
+		{
+			pthread_mutex_init(&pool->mutex, NULL);
+			pool->refCount = 1;
+		}
+		else
+		{
+			bing_mem_free(pool);
+			pool = NULL;
+		}
+	}
+	return pool;
+}
+
+void string_pool_retain(bing_string_pool* pool)
+{
+	if(pool)
+	{
+		atomic_add(&pool->refCount, 1);
+	}
+}
+
+void string_pool_release(bing_string_pool* pool)
+{
+	if(pool && atomic_sub_value(&pool->refCount, 1) == 1)
+	{
+		//Last reference, everything that was interned goes away at once
+		xmlDictFree(pool->dict);
+		pool->dict = NULL;
+		pthread_mutex_destroy(&pool->mutex);
+		bing_mem_free(pool);
+	}
+}
+
+const char* string_pool_intern(bing_string_pool* pool, const char* str, int len)
+{
+	const char* ret = NULL;
+	int size;
+	if(pool && str)
+	{
+		if(len < 0)
+		{
+			len = strlen(str);
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+
+		//If the dictionary grows, then this is a new string. Otherwise it already existed and we get the existing copy.
+		size = xmlDictSize(pool->dict);
+		ret = (const char*)xmlDictLookup(pool->dict, (const xmlChar*)str, len);
+		if(ret)
+		{
+			pool->lookups++;
+			pool->requestedBytes += len + 1;
+			if(xmlDictSize(pool->dict) != size)
+			{
+				pool->storedBytes += len + 1;
+			}
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return ret;
+}
+
+int bing_response_get_string_pool_stats(bing_response_t response, bing_string_pool_stats_t stats)
+{
+	BOOL ret = FALSE;
+	bing_string_pool* pool;
+	if(response && stats)
+	{
+		pool = ((bing_response*)response)->pool;
+		if(pool)
+		{
+			pthread_mutex_lock(&pool->mutex);
+
+			stats->lookups = pool->lookups;
+			stats->unique_strings = xmlDictSize(pool->dict);
+			stats->requested_bytes = pool->requestedBytes;
+			stats->stored_bytes = pool->storedBytes;
+			stats->dedupe_ratio = pool->storedBytes > 0 ? ((double)pool->requestedBytes / (double)pool->storedBytes) : 1.0;
+
+			pthread_mutex_unlock(&pool->mutex);
+
+			ret = TRUE;
+		}
+	}
+	return ret;
+}
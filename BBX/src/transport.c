@@ -0,0 +1,1063 @@
+/*
+ * transport.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+#include "bing_internal.h"
+
+#include <limits.h>
+
+#include <curl/curl.h>
+
+//Transports. Searches make their transfers with cURL, unless another transport is set: the memory transport (responses that were given to it, without any delay) or a custom transport (any other HTTP stack). Replayed searches (see capture.c) are given recorded responses.
+//Each transport gives what it receives to the search (search_transfer_header and search_transfer_data), then calls search_engine_done on the engine thread. Search.c doesn't know how the transfer is made.
+
+//Defines for cURL
+#define CURL_TRUE 1L
+#define CURL_FALSE 0L
+#define CURL_EMPTY_STRING ""
+
+//How long (ms) a replayed response that is paused (by streaming) waits, it's resumed once enough results are released (or the deadline ends the wait)
+#define REPLAY_PAUSE_WAIT UINT_MAX
+
+#define MEMORY_BUCKETS 64
+
+typedef struct MEMORY_RESPONSE_S
+{
+	char* url;
+	unsigned int hash;
+	long status;
+	char* body;
+	size_t size;
+	unsigned int etag; //Hash of the body, so it only changes if the body does
+
+	struct MEMORY_RESPONSE_S* bucketNext;
+} memory_response;
+
+static pthread_mutex_t transportMutex = PTHREAD_MUTEX_INITIALIZER;
+static enum BING_TRANSPORT transportType = BING_TRANSPORT_CURL;
+static bing_transport_s transportCustom;
+static memory_response* memoryBuckets[MEMORY_BUCKETS];
+
+//DNS and TLS session cache shared by every search (from every Bing instance)
+static CURLSH* transportShare = NULL;
+static pthread_mutex_t transportShareMutex[CURL_LOCK_DATA_LAST];
+
+void shareLock(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+	pthread_mutex_lock(&transportShareMutex[data]);
+}
+
+void shareUnlock(CURL* curl, curl_lock_data data, void* userptr)
+{
+	pthread_mutex_unlock(&transportShareMutex[data]);
+}
+
+void transport_global_setup()
+{
+	int i;
+
+	curl_global_init_mem(CURL_GLOBAL_ALL, bing_mem_malloc, bing_mem_free, bing_mem_realloc, bing_mem_strdup, bing_mem_calloc); //THIS IS NOT THREAD SAFE!!
+
+	for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+	{
+		pthread_mutex_init(&transportShareMutex[i], NULL);
+	}
+
+	transportShare = curl_share_init();
+	if(transportShare)
+	{
+		curl_share_setopt(transportShare, CURLSHOPT_LOCKFUNC, shareLock);
+		curl_share_setopt(transportShare, CURLSHOPT_UNLOCKFUNC, shareUnlock);
+
+		//Connections aren't shared. Synchronous searches make their transfers on the thread that called them while the engine makes the others, and cURL doesn't support sharing connections between threads. Asynchronous searches already share the engine's connections.
+		curl_share_setopt(transportShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(transportShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+}
+
+void transport_global_cleanup()
+{
+	int i;
+
+	//Every handle using the share is gone by now (pooled handles hold the setup)
+	curl_share_cleanup(transportShare);
+	transportShare = NULL;
+
+	for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+	{
+		pthread_mutex_destroy(&transportShareMutex[i]);
+	}
+
+	curl_global_cleanup(); //THIS IS NOT THREAD SAFE!!
+}
+
+//cURL handle pool
+
+CURL* curl_pool_take(unsigned int bingID)
+{
+	CURL* curl = NULL;
+	BOOL emptied = FALSE;
+	bing* bingI = retrieveBing(bingID);
+
+	if(bingI)
+	{
+		pthread_mutex_lock(&bingI->mutex);
+
+		if(bingI->curlPoolCount > 0)
+		{
+			curl = (CURL*)bingI->curlPool[--bingI->curlPoolCount];
+			bingI->curlPool[bingI->curlPoolCount] = NULL;
+			emptied = bingI->curlPoolCount == 0;
+		}
+
+		pthread_mutex_unlock(&bingI->mutex);
+
+		//The pool no longer holds anything
+		if(emptied)
+		{
+			search_release();
+		}
+	}
+
+	return curl ? curl : curl_easy_init();
+}
+
+void curl_pool_return(unsigned int bingID, CURL* curl)
+{
+	bing* bingI;
+
+	if(curl)
+	{
+		bingI = retrieveBing(bingID);
+		if(bingI)
+		{
+			pthread_mutex_lock(&bingI->mutex);
+
+			if(bingI->curlPoolCount < BING_CURL_POOL_SIZE)
+			{
+				//Keep the setup alive while the pool holds handles
+				if(bingI->curlPoolCount == 0)
+				{
+					search_setup();
+				}
+
+				bingI->curlPool[bingI->curlPoolCount++] = curl;
+				curl = NULL;
+			}
+
+			pthread_mutex_unlock(&bingI->mutex);
+		}
+
+		//Pool is full, or the Bing instance is gone
+		curl_easy_cleanup(curl);
+	}
+}
+
+void transport_free_curl_pool(bing* bingI)
+{
+	if(bingI->curlPoolCount > 0)
+	{
+		while(bingI->curlPoolCount > 0)
+		{
+			curl_easy_cleanup((CURL*)bingI->curlPool[--bingI->curlPoolCount]);
+			bingI->curlPool[bingI->curlPoolCount] = NULL;
+		}
+		search_release();
+	}
+}
+
+//Shared by the transports
+
+//Does the search have time left for a transfer made once it has waited (ms)? Transports without a timeout of their own only check, the deadline is checked again as the response is given.
+BOOL transport_time_left(bing_transfer* transfer, unsigned int wait)
+{
+	return transfer->deadline == 0 || engine_time() + wait < transfer->deadline;
+}
+
+//Called by the engine to finish a transfer that was cancelled while it was waiting to be made
+BOOL transport_aborted(void* data, void* curl, int curlCode)
+{
+	bing_transfer* transfer = (bing_transfer*)data;
+
+	return search_engine_done(transfer->search, transfer->handle, CURLE_ABORTED_BY_CALLBACK);
+}
+
+void transport_swap(bing_transfer* transfer)
+{
+	void* handle = transfer->handle;
+	transfer->handle = transfer->hedgeHandle;
+	transfer->hedgeHandle = handle;
+}
+
+//cURL transport
+
+size_t curl_transport_data(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+	return search_transfer_data((bing_transfer*)userdata, ptr, size * nmemb);
+}
+
+size_t curl_transport_header(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+	return search_transfer_header((bing_transfer*)userdata, buffer, size * nitems);
+}
+
+//The first transfer of a hedged search to receive anything is used
+size_t curl_transport_primary_data(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+	return search_transfer_claim((bing_transfer*)userdata, FALSE) ? curl_transport_data(ptr, size, nmemb, userdata) : 0;
+}
+
+size_t curl_transport_primary_header(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+	return search_transfer_claim((bing_transfer*)userdata, FALSE) ? curl_transport_header(buffer, size, nitems, userdata) : 0;
+}
+
+size_t curl_transport_hedge_data(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+	return search_transfer_claim((bing_transfer*)userdata, TRUE) ? curl_transport_data(ptr, size, nmemb, userdata) : 0;
+}
+
+size_t curl_transport_hedge_header(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+	return search_transfer_claim((bing_transfer*)userdata, TRUE) ? curl_transport_header(buffer, size, nitems, userdata) : 0;
+}
+
+//Limit a transfer to the time the search has left, once it has waited (ms). Returns FALSE if there's no time left.
+BOOL setCurlDeadline(CURL* curl, bing_transfer* transfer, unsigned int wait)
+{
+	unsigned long long start;
+	long remaining;
+
+	if(transfer->deadline == 0)
+	{
+		return TRUE;
+	}
+
+	start = engine_time() + wait;
+	if(start >= transfer->deadline)
+	{
+		return FALSE;
+	}
+	remaining = (long)(transfer->deadline - start);
+
+	//Searches run on many threads, so timeouts can't use signals. The transfer timeout includes connecting, and any time the transfer is paused.
+	return curl_easy_setopt(curl, CURLOPT_NOSIGNAL, CURL_TRUE) == CURLE_OK &&
+			curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, remaining) == CURLE_OK &&
+			curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, remaining) == CURLE_OK;
+}
+
+BOOL setCurl(const char* url, CURL* curl, bing_transfer* transfer)
+{
+	BOOL ret = FALSE;
+	bing* bingI = retrieveBing(transfer->bing);
+
+	if(bingI && curl)
+	{
+		curl_easy_reset(curl);
+
+		pthread_mutex_lock(&bingI->mutex);
+
+		if(bingI->accountKey)
+		{
+			//Set the URL
+			if(curl_easy_setopt(curl, CURLOPT_URL, url) == CURLE_OK &&							//The URL, required
+					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_transport_data) == CURLE_OK &&	//The function to handle the data, required
+					curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)transfer) == CURLE_OK &&		//The "userdata" to be passed into the write function, required
+					curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CURL_FALSE) == CURLE_OK &&	//We don't have a SSL cert for verification, so skip it
+					curl_easy_setopt(curl, CURLOPT_USERNAME, CURL_EMPTY_STRING) == CURLE_OK &&	//For basic HTTP authentication, this is the "user ID", which is ignored right now
+					curl_easy_setopt(curl, CURLOPT_PASSWORD, bingI->accountKey) == CURLE_OK)		//For basic HTTP authentication, this is the "account key"
+			{
+				//We don't want any progress meters
+				curl_easy_setopt(curl, CURLOPT_NOPROGRESS, CURL_TRUE);
+
+				//The status and validators of the response
+				curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_transport_header);
+				curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*)transfer);
+
+				//Use the cache shared by all searches, so new handles (and other Bing instances) skip name lookups and full TLS handshakes
+				if(transportShare)
+				{
+					curl_easy_setopt(curl, CURLOPT_SHARE, transportShare);
+				}
+
+				//Asks the server to only send the data if it changed
+				if(transfer->headers)
+				{
+					curl_easy_setopt(curl, CURLOPT_HTTPHEADER, (struct curl_slist*)transfer->headers);
+				}
+
+				ret = setCurlDeadline(curl, transfer, 0);
+
+#if !defined(BING_NO_COMPRESSION)
+				//Let the server compress the response with anything cURL supports. cURL decompresses it as it arrives, so the parser still gets it chunk by chunk.
+#if LIBCURL_VERSION_NUM >= 0x071506
+				curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, CURL_EMPTY_STRING);
+#else
+				curl_easy_setopt(curl, CURLOPT_ENCODING, CURL_EMPTY_STRING);
+#endif
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x072F00
+				if(ret && bingI->http2)
+				{
+					//Ask for HTTP/2 (falls back to HTTP/1.1), and wait for an existing connection that can be multiplexed instead of opening a new one
+					curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+					curl_easy_setopt(curl, CURLOPT_PIPEWAIT, CURL_TRUE);
+				}
+				else if(ret)
+				{
+					//cURL 7.62 and later ask for HTTP/2 over TLS on their own, so HTTP/1.1 has to be asked for
+					curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+				}
+#endif
+			}
+		}
+		pthread_mutex_unlock(&bingI->mutex);
+	}
+	return ret;
+}
+
+CURL* setupCurl(const char* url, bing_transfer* transfer)
+{
+	CURL* ret = curl_pool_take(transfer->bing);
+
+	if(ret)
+	{
+		if(!setCurl(url, ret, transfer))
+		{
+			curl_pool_return(transfer->bing, ret);
+			ret = NULL;
+		}
+	}
+
+	return ret;
+}
+
+struct curl_slist* curlHeaderAppend(struct curl_slist* headers, const char* name, const char* value)
+{
+	struct curl_slist* ret = headers;
+	size_t size = strlen(name) + strlen(value) + 1;
+	char* header = (char*)bing_mem_malloc(size);
+
+	if(header)
+	{
+		snprintf(header, size, "%s%s", name, value);
+
+		//cURL copies the header. If it fails, the list is unchanged.
+		ret = curl_slist_append(headers, header);
+		if(!ret)
+		{
+			ret = headers;
+		}
+		bing_mem_free(header);
+	}
+	return ret;
+}
+
+//Take a cURL handle for the search, the first time it makes a transfer (it's kept for any retries). The transfer is made once it has waited (ms).
+BOOL curl_transport_setup(bing_transfer* transfer, unsigned int wait)
+{
+	struct curl_slist* headers = NULL;
+	CURL* curl;
+
+	if(!transfer->headers && (transfer->ifNoneMatch || transfer->ifModifiedSince))
+	{
+		if(transfer->ifNoneMatch)
+		{
+			headers = curlHeaderAppend(headers, "If-None-Match: ", transfer->ifNoneMatch);
+		}
+		if(transfer->ifModifiedSince)
+		{
+			headers = curlHeaderAppend(headers, "If-Modified-Since: ", transfer->ifModifiedSince);
+		}
+		transfer->headers = headers;
+	}
+
+	transfer->handle = curl = setupCurl(transfer->url, transfer);
+	if(!curl)
+	{
+		return FALSE;
+	}
+
+	if(transfer->hedged)
+	{
+		//The first transfer to receive something is used
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_transport_primary_data);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_transport_primary_header);
+	}
+	return setCurlDeadline(curl, transfer, wait);
+}
+
+//Called by the engine once a transfer that had to wait (to be retried, or for the rate limit) can be made
+BOOL curl_transport_delayed_add(void* data, void* curl, int curlCode)
+{
+	bing_transfer* transfer = (bing_transfer*)data;
+
+	if(!engine_add(transfer->handle, search_engine_done, transfer->search))
+	{
+		//Can't be retried, it's done
+		search_engine_done(transfer->search, transfer->handle, CURLE_FAILED_INIT);
+	}
+	return FALSE;
+}
+
+BOOL curl_transport_start(bing_transfer* transfer, unsigned int delay)
+{
+	if(!transfer->handle && !curl_transport_setup(transfer, delay))
+	{
+		return FALSE;
+	}
+	return delay > 0 ? engine_post_delayed(curl_transport_delayed_add, transfer, delay) : engine_add(transfer->handle, search_engine_done, transfer->search);
+}
+
+int curl_transport_perform(bing_transfer* transfer)
+{
+	//The time the search has left was checked before this was called, and the transfer is made now
+	if(!transfer->handle && !curl_transport_setup(transfer, 0))
+	{
+		return CURLE_FAILED_INIT;
+	}
+	return curl_easy_perform((CURL*)transfer->handle);
+}
+
+BOOL curl_transport_deadline(bing_transfer* transfer, unsigned int wait)
+{
+	//Before the first transfer there's no handle yet, it's given the time once it's taken
+	return transfer->handle ? setCurlDeadline((CURL*)transfer->handle, transfer, wait) : transport_time_left(transfer, wait);
+}
+
+void curl_transport_cancel(bing_transfer* transfer)
+{
+	if(engine_cancel_post(curl_transport_delayed_add, transfer))
+	{
+		//Waiting to be retried (or for the rate limit), so it isn't running
+		engine_post(transport_aborted, transfer);
+	}
+	else
+	{
+		//Done like any other transfer, once it's stopped (unless it already completed)
+		engine_cancel(transfer->handle, transfer->search);
+		if(transfer->hedgeHandle)
+		{
+			engine_cancel(transfer->hedgeHandle, transfer->search);
+		}
+	}
+}
+
+void curl_transport_resume(bing_transfer* transfer)
+{
+	//Anything cURL held back is given to the write function now
+	curl_easy_pause((CURL*)transfer->handle, CURLPAUSE_CONT);
+}
+
+long curl_transport_status(bing_transfer* transfer)
+{
+	long ret = 0;
+
+	if(transfer->handle)
+	{
+		curl_easy_getinfo((CURL*)transfer->handle, CURLINFO_RESPONSE_CODE, &ret);
+	}
+	return ret;
+}
+
+size_t curl_transport_wire_bytes(bing_transfer* transfer)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t wireBytes;
+#else
+	double wireBytes;
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+	if(transfer->handle && curl_easy_getinfo((CURL*)transfer->handle, CURLINFO_SIZE_DOWNLOAD_T, &wireBytes) == CURLE_OK)
+#else
+	if(transfer->handle && curl_easy_getinfo((CURL*)transfer->handle, CURLINFO_SIZE_DOWNLOAD, &wireBytes) == CURLE_OK)
+#endif
+	{
+		return (size_t)wireBytes;
+	}
+	return 0;
+}
+
+//Make the hedge of a cURL transfer: the same search on another cURL handle, so it uses another connection
+BOOL curl_transport_hedge(bing_transfer* transfer)
+{
+	CURL* hedge = NULL;
+	char* url = NULL;
+
+	if(transfer->handle && curl_easy_getinfo((CURL*)transfer->handle, CURLINFO_EFFECTIVE_URL, &url) == CURLE_OK && url && (hedge = setupCurl(url, transfer)))
+	{
+		curl_easy_setopt(hedge, CURLOPT_WRITEFUNCTION, curl_transport_hedge_data);
+		curl_easy_setopt(hedge, CURLOPT_HEADERFUNCTION, curl_transport_hedge_header);
+
+		if(engine_add(hedge, search_engine_done, transfer->search))
+		{
+			transfer->hedgeHandle = hedge;
+			return TRUE;
+		}
+		curl_pool_return(transfer->bing, hedge);
+	}
+	return FALSE;
+}
+
+void curl_transport_stop(bing_transfer* transfer, void* handle)
+{
+	//Callbacks can't stop a transfer, the engine does it
+	engine_cancel(handle, transfer->search);
+}
+
+void curl_transport_release(bing_transfer* transfer, void* handle)
+{
+	//The connection is still good for other searches
+	curl_pool_return(transfer->bing, (CURL*)handle);
+}
+
+//Replay transport (the memory transport replays the responses it was given the same way, without any delay)
+
+//Time (ms) to wait for the next part of a replayed response, cut short by the deadline. Never zero, so the wait can be cancelled.
+unsigned int replay_transport_wait(bing_transfer* transfer, unsigned int wait)
+{
+	unsigned long long now = engine_time();
+
+	if(transfer->deadline > 0 && now + wait > transfer->deadline)
+	{
+		wait = transfer->deadline > now ? (unsigned int)(transfer->deadline - now) : 0;
+	}
+	return wait > 0 ? wait : 1;
+}
+
+//Called by the engine to give a replayed transfer it's response: the headers once the time until the first byte has passed, then the body once the rest of the time has
+BOOL replay_transport_give(void* data, void* curl, int curlCode)
+{
+	bing_transfer* transfer = (bing_transfer*)data;
+	bing_capture* response = &transfer->response;
+	char* line;
+	char* end;
+	size_t size;
+	size_t written;
+
+	curlCode = CURLE_OK;
+	if(transfer->cancelled)
+	{
+		curlCode = CURLE_ABORTED_BY_CALLBACK;
+	}
+	else if(response->status == 0)
+	{
+		//There's no response for the URL
+		curlCode = CURLE_REMOTE_FILE_NOT_FOUND;
+	}
+	else if(transfer->deadline > 0 && engine_time() >= transfer->deadline)
+	{
+		curlCode = CURLE_OPERATION_TIMEDOUT;
+	}
+	else
+	{
+		if(!transfer->responseHeadersDone)
+		{
+			transfer->responseHeadersDone = TRUE;
+
+			//A line at a time, like cURL
+			for(line = response->headers; line < response->headers + response->headerSize; line = end)
+			{
+				end = (char*)memchr(line, '\n', (response->headers + response->headerSize) - line);
+				end = end ? end + 1 : response->headers + response->headerSize;
+				search_transfer_header(transfer, line, end - line);
+			}
+
+			if(response->total > response->firstByte && engine_post_delayed(replay_transport_give, transfer, replay_transport_wait(transfer, response->total - response->firstByte)))
+			{
+				return FALSE;
+			}
+		}
+
+		while(transfer->responseOffset < response->bodySize)
+		{
+			size = response->bodySize - transfer->responseOffset;
+			if(size > CURL_MAX_WRITE_SIZE)
+			{
+				size = CURL_MAX_WRITE_SIZE;
+			}
+			written = search_transfer_data(transfer, response->body + transfer->responseOffset, size);
+			if(written == CURL_WRITEFUNC_PAUSE && engine_post_delayed(replay_transport_give, transfer, replay_transport_wait(transfer, REPLAY_PAUSE_WAIT)))
+			{
+				//Too many streamed results are waiting to be released, the same data is given again once enough are
+				return FALSE;
+			}
+			if(written != size)
+			{
+				//Same as cURL, the result limit was reached or an error occurred
+				curlCode = CURLE_WRITE_ERROR;
+				break;
+			}
+			transfer->responseOffset += size;
+		}
+	}
+
+	return search_engine_done(transfer->search, transfer->handle, curlCode);
+}
+
+//Replay a response for the transfer's URL instead of making the transfer. It's taken once the transfer is made, so a transfer that waited (to be retried) gets the response there is then.
+BOOL replay_transport_take(bing_transfer* transfer, BOOL (*take)(bing_transfer* transfer, bing_capture* capture))
+{
+	capture_free(&transfer->response);
+	transfer->responseHeadersDone = FALSE;
+	transfer->responseOffset = 0;
+
+	//If there's no response, the transfer still fails asynchronously, like it would if the server didn't have it
+	take(transfer, &transfer->response);
+
+	if(!engine_post_delayed(replay_transport_give, transfer, replay_transport_wait(transfer, transfer->response.firstByte)))
+	{
+		return search_engine_done(transfer->search, transfer->handle, CURLE_FAILED_INIT);
+	}
+	return FALSE;
+}
+
+BOOL memory_transport_begin(void* data, void* curl, int curlCode);
+
+BOOL replay_take(bing_transfer* transfer, bing_capture* capture)
+{
+	return capture_take(transfer->url, capture);
+}
+
+//Called by the engine once a replayed transfer is made
+BOOL replay_transport_begin(void* data, void* curl, int curlCode)
+{
+	return replay_transport_take((bing_transfer*)data, replay_take);
+}
+
+BOOL replay_transport_start(bing_transfer* transfer, unsigned int delay)
+{
+	return engine_post_delayed(replay_transport_begin, transfer, replay_transport_wait(transfer, delay));
+}
+
+void replay_transport_cancel(bing_transfer* transfer)
+{
+	//Replayed responses are given all at once, so it's always waiting
+	if(engine_cancel_post(replay_transport_begin, transfer) || engine_cancel_post(memory_transport_begin, transfer) || engine_cancel_post(replay_transport_give, transfer))
+	{
+		engine_post(transport_aborted, transfer);
+	}
+}
+
+void replay_transport_resume(bing_transfer* transfer)
+{
+	//Stop waiting
+	if(engine_cancel_post(replay_transport_give, transfer))
+	{
+		engine_post(replay_transport_give, transfer);
+	}
+}
+
+long replay_transport_status(bing_transfer* transfer)
+{
+	return transfer->response.status;
+}
+
+size_t replay_transport_wire_bytes(bing_transfer* transfer)
+{
+	return transfer->response.wireBytes;
+}
+
+//Memory transport
+
+unsigned int memory_hash(const char* data, size_t size)
+{
+	unsigned int hash = 5381;
+	while(size-- > 0)
+	{
+		hash = ((hash << 5) + hash) + (unsigned char)*(data++);
+	}
+	return hash;
+}
+
+//Must be called with the transport mutex locked
+memory_response** memory_find(const char* url, unsigned int hash)
+{
+	memory_response** response;
+
+	for(response = &memoryBuckets[hash % MEMORY_BUCKETS]; *response; response = &(*response)->bucketNext)
+	{
+		if((*response)->hash == hash && strcmp((*response)->url, url) == 0)
+		{
+			break;
+		}
+	}
+	return response;
+}
+
+void memory_free(memory_response* response)
+{
+	bing_mem_free(response->url);
+	bing_mem_free(response->body);
+	bing_mem_free(response);
+}
+
+//Get a copy of the memory transport's response for the transfer's URL. Returns FALSE if there isn't one.
+BOOL memory_take(bing_transfer* transfer, bing_capture* capture)
+{
+	memory_response* response;
+	unsigned int hash = memory_hash(transfer->url, strlen(transfer->url));
+	char header[64];
+	char etag[16];
+	int headerSize;
+	long status;
+	size_t size;
+	BOOL ret = FALSE;
+
+	memset(capture, 0, sizeof(bing_capture));
+
+	pthread_mutex_lock(&transportMutex);
+
+	response = *memory_find(transfer->url, hash);
+	if(response)
+	{
+		status = response->status;
+		size = response->size;
+		snprintf(etag, sizeof(etag), "\"%08x\"", response->etag);
+
+		//Like a server, if cached data is being revalidated and the response is the same, only a 304 is given
+		if(status == 200 && transfer->ifNoneMatch && strcmp(transfer->ifNoneMatch, etag) == 0)
+		{
+			status = 304;
+			size = 0;
+		}
+
+		//Only what the parser needs, a status line, the ETag of successful responses, and the end of the headers
+		if(status == 200 || status == 304)
+		{
+			headerSize = snprintf(header, sizeof(header), "HTTP/1.1 %ld\r\nETag: %s\r\n\r\n", status, etag);
+		}
+		else
+		{
+			headerSize = snprintf(header, sizeof(header), "HTTP/1.1 %ld\r\n\r\n", status);
+		}
+
+		capture->status = status;
+		capture->headers = bing_mem_strdup(header);
+		capture->body = (char*)bing_mem_malloc(size + 1);
+		if(headerSize > 0 && capture->headers && capture->body)
+		{
+			memcpy(capture->body, response->body, size);
+			capture->headerSize = (size_t)headerSize;
+			capture->headerAlloc = capture->headerSize + 1;
+			capture->bodySize = size;
+			capture->bodyAlloc = size + 1;
+			capture->wireBytes = size;
+			ret = TRUE;
+		}
+		else
+		{
+			capture_free(capture);
+		}
+	}
+
+	pthread_mutex_unlock(&transportMutex);
+
+	return ret;
+}
+
+//Called by the engine once a transfer of the memory transport is made
+BOOL memory_transport_begin(void* data, void* curl, int curlCode)
+{
+	return replay_transport_take((bing_transfer*)data, memory_take);
+}
+
+BOOL memory_transport_start(bing_transfer* transfer, unsigned int delay)
+{
+	return engine_post_delayed(memory_transport_begin, transfer, replay_transport_wait(transfer, delay));
+}
+
+//Custom transport
+
+//Called by the engine to give the transfer to the custom transport
+BOOL custom_transport_begin(void* data, void* curl, int curlCode)
+{
+	bing_transfer* transfer = (bing_transfer*)data;
+	char* accountKey;
+
+	transfer->httpStatus = 0;
+	transfer->customBytes = 0;
+	transfer->customCode = CURLE_OK;
+	transfer->customDone = FALSE;
+	transfer->customStarted = FALSE;
+
+	if(!transfer->cancelled && (accountKey = retrieveAccountKey(transfer->bing)))
+	{
+		//The transport could complete it before start returns
+		transfer->customStarted = TRUE;
+		if(!transfer->custom.start((bing_transfer_t)transfer, transfer->url, accountKey, transfer->custom.data))
+		{
+			transfer->customStarted = FALSE;
+		}
+		bing_mem_free(accountKey);
+	}
+
+	if(!transfer->customStarted)
+	{
+		return search_engine_done(transfer->search, transfer->handle, transfer->cancelled ? CURLE_ABORTED_BY_CALLBACK : CURLE_FAILED_INIT);
+	}
+	return FALSE;
+}
+
+//Called by the engine once the custom transport completed the transfer
+BOOL custom_transport_done(void* data, void* curl, int curlCode)
+{
+	bing_transfer* transfer = (bing_transfer*)data;
+
+	transfer->customStarted = FALSE;
+
+	return search_engine_done(transfer->search, transfer->handle, transfer->cancelled ? CURLE_ABORTED_BY_CALLBACK : transfer->customCode);
+}
+
+BOOL custom_transport_start(bing_transfer* transfer, unsigned int delay)
+{
+	return delay > 0 ? engine_post_delayed(custom_transport_begin, transfer, delay) : engine_post(custom_transport_begin, transfer);
+}
+
+void custom_transport_cancel(bing_transfer* transfer)
+{
+	if(engine_cancel_post(custom_transport_begin, transfer))
+	{
+		//Waiting to be retried (or for the rate limit), so the transport doesn't have it
+		engine_post(transport_aborted, transfer);
+	}
+	else if(transfer->customStarted && !transfer->customDone && transfer->custom.cancel)
+	{
+		//The transport still completes it. If it wasn't started yet, it won't be.
+		transfer->custom.cancel((bing_transfer_t)transfer, transfer->custom.data);
+	}
+}
+
+long custom_transport_status(bing_transfer* transfer)
+{
+	return transfer->httpStatus;
+}
+
+size_t custom_transport_wire_bytes(bing_transfer* transfer)
+{
+	return transfer->customBytes;
+}
+
+static const transport_ops curlTransport = {curl_transport_start, curl_transport_cancel, curl_transport_status, curl_transport_wire_bytes, curl_transport_deadline, curl_transport_resume, curl_transport_hedge, curl_transport_stop, curl_transport_release, curl_transport_perform};
+static const transport_ops replayTransport = {replay_transport_start, replay_transport_cancel, replay_transport_status, replay_transport_wire_bytes, transport_time_left, replay_transport_resume, NULL, NULL, NULL, NULL};
+static const transport_ops memoryTransport = {memory_transport_start, replay_transport_cancel, replay_transport_status, replay_transport_wire_bytes, transport_time_left, replay_transport_resume, NULL, NULL, NULL, NULL};
+static const transport_ops customTransport = {custom_transport_start, custom_transport_cancel, custom_transport_status, custom_transport_wire_bytes, transport_time_left, NULL, NULL, NULL, NULL, NULL};
+
+BOOL transport_setup(bing_transfer* transfer, void* search, unsigned int bingID, const char* url, BOOL replay)
+{
+	memset(transfer, 0, sizeof(bing_transfer));
+
+	transfer->search = search;
+	transfer->bing = bingID;
+	if(!(transfer->url = bing_mem_strdup(url)))
+	{
+		return FALSE;
+	}
+
+	if(replay)
+	{
+		transfer->transport = &replayTransport;
+		return TRUE;
+	}
+
+	pthread_mutex_lock(&transportMutex);
+
+	switch(transportType)
+	{
+		case BING_TRANSPORT_MEMORY:
+			transfer->transport = &memoryTransport;
+			break;
+		case BING_TRANSPORT_CUSTOM:
+			transfer->transport = &customTransport;
+			transfer->custom = transportCustom;
+			break;
+		default:
+			transfer->transport = &curlTransport;
+			break;
+	}
+
+	pthread_mutex_unlock(&transportMutex);
+
+	return TRUE;
+}
+
+void transport_unconditional(bing_transfer* transfer)
+{
+	//cURL keeps the headers it was given for each attempt
+	if(transfer->transport == &curlTransport && transfer->handle)
+	{
+		curl_easy_setopt((CURL*)transfer->handle, CURLOPT_HTTPHEADER, NULL);
+	}
+
+	curl_slist_free_all((struct curl_slist*)transfer->headers);
+	transfer->headers = NULL;
+	bing_mem_free(transfer->ifNoneMatch);
+	bing_mem_free(transfer->ifModifiedSince);
+	transfer->ifNoneMatch = NULL;
+	transfer->ifModifiedSince = NULL;
+}
+
+void transport_free(bing_transfer* transfer)
+{
+	//Return cURL to the pool (the connection stays open for the next search)
+	if(transfer->transport == &curlTransport)
+	{
+		curl_pool_return(transfer->bing, (CURL*)transfer->handle);
+		curl_pool_return(transfer->bing, (CURL*)transfer->hedgeHandle);
+	}
+	transfer->handle = NULL;
+	transfer->hedgeHandle = NULL;
+
+	transport_unconditional(transfer);
+
+	capture_free(&transfer->response);
+
+	bing_mem_free(transfer->url);
+	transfer->url = NULL;
+}
+
+int bing_set_transport(enum BING_TRANSPORT type, const bing_transport_t custom)
+{
+	BOOL ret = FALSE;
+	if(type == BING_TRANSPORT_CURL || type == BING_TRANSPORT_MEMORY || (type == BING_TRANSPORT_CUSTOM && custom && custom->start))
+	{
+		pthread_mutex_lock(&transportMutex);
+
+		transportType = type;
+		if(type == BING_TRANSPORT_CUSTOM)
+		{
+			transportCustom = *custom;
+		}
+
+		pthread_mutex_unlock(&transportMutex);
+
+		ret = TRUE;
+	}
+	return ret;
+}
+
+int bing_transfer_header(bing_transfer_t transfer, const char* header, size_t size)
+{
+	bing_transfer* transferI = (bing_transfer*)transfer;
+	return transferI && header && search_transfer_header(transferI, (char*)header, size) == size;
+}
+
+int bing_transfer_data(bing_transfer_t transfer, const char* data, size_t size)
+{
+	bing_transfer* transferI = (bing_transfer*)transfer;
+	size_t written;
+	int ret = 0;
+
+	if(transferI && data)
+	{
+		written = size > 0 ? search_transfer_data(transferI, (char*)data, size) : 0;
+		if(written == CURL_WRITEFUNC_PAUSE)
+		{
+			//Same as cURL, given again once results are released
+			ret = -1;
+		}
+		else if(written == size)
+		{
+			transferI->customBytes += size;
+			ret = 1;
+		}
+		else
+		{
+			//Same as cURL, the result limit was reached or an error occurred
+			transferI->customCode = CURLE_WRITE_ERROR;
+		}
+	}
+	return ret;
+}
+
+int bing_transfer_complete(bing_transfer_t transfer, int error)
+{
+	bing_transfer* transferI = (bing_transfer*)transfer;
+	BOOL ret = FALSE;
+
+	if(transferI)
+	{
+		if(error && transferI->customCode == CURLE_OK)
+		{
+			//Failed like a connection would, so it can be retried
+			transferI->customCode = CURLE_RECV_ERROR;
+		}
+		transferI->customDone = TRUE;
+
+		//Finished on the engine thread, like every other transfer
+		ret = engine_post(custom_transport_done, transferI);
+	}
+	return ret;
+}
+
+int bing_memory_transport_add(const char* url, long status, const char* body, size_t size)
+{
+	BOOL ret = FALSE;
+	memory_response* response;
+	memory_response** existing;
+
+	if(url && status > 0 && (body || size == 0) && (response = (memory_response*)bing_mem_calloc(1, sizeof(memory_response))))
+	{
+		response->url = bing_mem_strdup(url);
+		response->hash = memory_hash(url, strlen(url));
+		response->status = status;
+		response->body = (char*)bing_mem_malloc(size + 1);
+		response->size = size;
+		if(response->url && response->body)
+		{
+			if(size > 0)
+			{
+				memcpy(response->body, body, size);
+			}
+			response->etag = memory_hash(response->body, size);
+
+			pthread_mutex_lock(&transportMutex);
+
+			//Replaces any response the URL already has
+			existing = memory_find(url, response->hash);
+			if(*existing)
+			{
+				response->bucketNext = (*existing)->bucketNext;
+				memory_free(*existing);
+			}
+			*existing = response;
+
+			pthread_mutex_unlock(&transportMutex);
+
+			ret = TRUE;
+		}
+		else
+		{
+			memory_free(response);
+		}
+	}
+	return ret;
+}
+
+int bing_memory_transport_clear()
+{
+	memory_response* response;
+	unsigned int i;
+
+	pthread_mutex_lock(&transportMutex);
+
+	for(i = 0; i < MEMORY_BUCKETS; i++)
+	{
+		while((response = memoryBuckets[i]))
+		{
+			memoryBuckets[i] = response->bucketNext;
+			memory_free(response);
+		}
+	}
+
+	pthread_mutex_unlock(&transportMutex);
+
+	return TRUE;
+}
@@ -62,11 +62,25 @@ enum FIELD_TYPE getParsedTypeByType(const char* type)
 		*((long long*)tmp) = (x); \
 	}
 
+//Most nodes are a single run of text (libxml has already decoded any escapes into it), so the text can be used directly instead of being gathered into a temporary copy. Anything else (entity references, mixed content) goes through libxml.
+const xmlChar* getNodeText(xmlNodePtr node, BOOL* allocated)
+{
+	xmlNodePtr child = node->children;
+	if(child && !child->next && (child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE) && child->content)
+	{
+		*allocated = FALSE;
+		return child->content;
+	}
+	*allocated = TRUE;
+	return xmlNodeGetContent(node);
+}
+
 //This will always produce a unique memory element. It will not pass a pointer.
 void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 {
 	const xmlChar* text;
 	void* tmp;
+	BOOL allocated;
 	if(type && node)
 	{
 		//Could possibly change to an array of types-to-parsing types. Similar to what happens with finding the right result, response, etc. {type, FIELD_TYPE, parser func}
@@ -75,14 +89,17 @@ void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 				strcmp(type, "Edm.Guid") == 0) //There is no dedicated GUID type, so simply return it as a string
 		{
 			//Get the node contents
-			text = xmlNodeGetContent(node);
+			text = getNodeText(node, &allocated);
 			if(text)
 			{
 				//Duplicate the string
 				tmp = (void*)bing_mem_strdup((char*)text);
 
 				//Free the contents
-				xmlFree((void*)text);
+				if(allocated)
+				{
+					xmlFree((void*)text);
+				}
 
 				//Return the duplicated string
 				return tmp;
@@ -91,14 +108,17 @@ void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 		else if(strcmp(type, "dateTime") == 0 || strcmp(type, "Edm.DateTime") == 0)
 		{
 			//Get the node contents
-			text = xmlNodeGetContent(node);
+			text = getNodeText(node, &allocated);
 			if(text)
 			{
 				//We need to allocate memory for the long long
 				SAVE_LONG_LONG(parseTime((char*)text))
 
 				//Free the contents
-				xmlFree((void*)text);
+				if(allocated)
+				{
+					xmlFree((void*)text);
+				}
 
 				//Return the value
 				return tmp;
@@ -107,14 +127,17 @@ void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 		else if(strcmp(type, "Edm.Int32") == 0)
 		{
 			//Get the node contents
-			text = xmlNodeGetContent(node);
+			text = getNodeText(node, &allocated);
 			if(text)
 			{
 				//Parse the int
 				tmp = (void*)atoi((char*)text);
 
 				//Free the contents
-				xmlFree((void*)text);
+				if(allocated)
+				{
+					xmlFree((void*)text);
+				}
 
 				//Return the int;
 				return tmp;
@@ -123,7 +146,7 @@ void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 		else if(strcmp(type, "Edm.Int64") == 0)
 		{
 			//Get the node contents
-			text = xmlNodeGetContent(node);
+			text = getNodeText(node, &allocated);
 			if(text)
 			{
 				//Parse the long long
@@ -136,7 +159,10 @@ void* parseByType(const char* type, xmlNodePtr node, xmlFreeFunc xmlFree)
 #endif
 
 				//Free the contents
-				xmlFree((void*)text);
+				if(allocated)
+				{
+					xmlFree((void*)text);
+				}
 
 				//Return the value
 				return tmp;
@@ -270,7 +296,7 @@ BOOL handleParsedData(xmlNodePtr node, const void* parsedData, enum FIELD_TYPE t
 				name = xmlGetQualifiedName(node);
 				if(name)
 				{
-					res = hashtable_put_item(table, name, ptr, size);
+					res = type == FIELD_TYPE_STRING ? hashtable_put_string(table, name, (const char*)ptr) : hashtable_put_item(table, name, ptr, size);
 					bing_mem_free((void*)name);
 				}
 			}
@@ -0,0 +1,160 @@
+/*
+ * arena_test.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+//Counts the allocations each search makes, to measure what allocating the XML document of a search from an arena saves.
+//Build it with the library, for example: qcc -I../include ../src/*.c arena_test.c -lxml2 -lcurl -lbps -lm -o arena_test
+//Then build it again with -DBING_NO_SEARCH_ARENA and compare what they print. Searches are made through the memory transport, so only the library and libxml allocate.
+
+#include "bing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic.h>
+
+#define TEST_QUERY "arena"
+#define TEST_RESULTS 200
+#define TEST_SEARCHES 10
+
+#define TEST_FEED_START "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+	"<feed xmlns:d=\"http://schemas.microsoft.com/ado/2007/08/dataservices\" xmlns:m=\"http://schemas.microsoft.com/ado/2007/08/dataservices/metadata\" xmlns=\"http://www.w3.org/2005/Atom\">" \
+	"<subtitle type=\"text\">Bing Web Search</subtitle>"
+#define TEST_FEED_END "</feed>"
+#define TEST_ENTRY "<entry><title type=\"text\">WebResult</title><content type=\"application/xml\"><m:properties>" \
+	"<d:ID m:type=\"Edm.Guid\">00000000-0000-4000-8000-%012d</d:ID><d:Title m:type=\"Edm.String\">Title %d</d:Title>" \
+	"<d:Description m:type=\"Edm.String\">Description of result %d, long enough to be like the descriptions the service gives for a result.</d:Description>" \
+	"<d:DisplayUrl m:type=\"Edm.String\">www.example.com/%d</d:DisplayUrl><d:Url m:type=\"Edm.String\">http://www.example.com/%d</d:Url>" \
+	"</m:properties></content></entry>"
+
+static volatile unsigned int testAllocations = 0;
+static volatile unsigned int testReallocations = 0;
+static volatile unsigned int testFrees = 0;
+
+//Memory handlers that count what they're asked to do
+
+void* test_malloc(size_t size)
+{
+	atomic_add(&testAllocations, 1);
+	return malloc(size);
+}
+
+void* test_calloc(size_t count, size_t size)
+{
+	atomic_add(&testAllocations, 1);
+	return calloc(count, size);
+}
+
+void* test_realloc(void* ptr, size_t size)
+{
+	atomic_add(ptr ? &testReallocations : &testAllocations, 1);
+	return realloc(ptr, size);
+}
+
+void test_free(void* ptr)
+{
+	if(ptr)
+	{
+		atomic_add(&testFrees, 1);
+	}
+	free(ptr);
+}
+
+char* test_strdup(const char* str)
+{
+	atomic_add(&testAllocations, 1);
+	return strdup(str);
+}
+
+//Make a feed with count results. Returns NULL on error.
+char* test_feed(unsigned int count, size_t* size)
+{
+	char* feed;
+	size_t alloc = sizeof(TEST_FEED_START) + sizeof(TEST_FEED_END) + (count * (sizeof(TEST_ENTRY) + 64));
+	unsigned int i;
+
+	feed = (char*)malloc(alloc);
+	if(feed)
+	{
+		*size = (size_t)snprintf(feed, alloc, "%s", TEST_FEED_START);
+		for(i = 0; i < count; i++)
+		{
+			*size += (size_t)snprintf(feed + *size, alloc - *size, TEST_ENTRY, i, i, i, i, i);
+		}
+		*size += (size_t)snprintf(feed + *size, alloc - *size, "%s", TEST_FEED_END);
+	}
+	return feed;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int bing;
+	bing_request_t request = NULL;
+	bing_response_t response;
+	const char* url;
+	char* feed;
+	size_t size;
+	unsigned int allocations;
+	unsigned int reallocations;
+	unsigned int frees;
+	unsigned int i;
+	int ret = 0;
+
+	//Set before anything is allocated, so everything freed was counted
+	bing_set_memory_handlers(test_malloc, test_calloc, test_realloc, test_free, test_strdup);
+	bps_initialize();
+
+	bing = bing_create("arena_test");
+	feed = test_feed(TEST_RESULTS, &size);
+	if(!bing || !feed || !bing_request_create(BING_SOURCETYPE_WEB, &request) || !(url = bing_request_url(TEST_QUERY, request)))
+	{
+		printf("Setup failed\n");
+		return 1;
+	}
+
+	bing_set_transport(BING_TRANSPORT_MEMORY, NULL);
+	bing_memory_transport_add(url, 200, feed, size);
+
+	//The first search also sets up what every search shares (libxml, the engine)
+	bing_response_free(bing_search_sync(bing, TEST_QUERY, request));
+
+	allocations = testAllocations;
+	reallocations = testReallocations;
+	frees = testFrees;
+
+	for(i = 0; i < TEST_SEARCHES; i++)
+	{
+		response = bing_search_sync(bing, TEST_QUERY, request);
+		if(!response || bing_response_get_results(response, NULL) != TEST_RESULTS)
+		{
+			printf("Search %u failed\n", i);
+			ret = 1;
+		}
+		bing_response_free(response);
+	}
+
+	printf("%s, %u results (%u bytes): %u allocations, %u reallocations, %u frees per search\n",
+#if defined(BING_NO_SEARCH_ARENA)
+			"Without the arena",
+#else
+			"With the arena",
+#endif
+			TEST_RESULTS, (unsigned int)size, (testAllocations - allocations) / TEST_SEARCHES, (testReallocations - reallocations) / TEST_SEARCHES, (testFrees - frees) / TEST_SEARCHES);
+
+	bing_set_transport(BING_TRANSPORT_CURL, NULL);
+	bing_memory_transport_clear();
+
+	free((void*)url);
+	bing_request_free(request);
+	bing_free(bing);
+	free(feed);
+
+	bps_shutdown();
+
+	return ret;
+}
@@ -0,0 +1,101 @@
+/*
+ * latency_test.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+//Times synchronous searches made one after another to a server that acts like the service (such as tools/mockserver.c, built with MOCKSERVER_TLS), and prints the p50 and p99 latency.
+//Build it with the library, for example: qcc -I../include ../src/*.c latency_test.c -lxml2 -lcurl -lbps -lm -o latency_test
+//Then again with -DBING_CURL_POOL_SIZE=0, so every search uses a new cURL handle (and a new connection), and compare what they print.
+//Run it with the URL of the server, and optionally the number of searches: latency_test https://127.0.0.1:8443/ 1000
+
+#include "bing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_QUERY "latency"
+#define TEST_SEARCHES 500
+
+int test_compare(const void* a, const void* b)
+{
+	double da = *((const double*)a);
+	double db = *((const double*)b);
+	return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+double test_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec * 1000.0) + ((double)ts.tv_nsec / 1000000.0);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int bing;
+	bing_request_t request = NULL;
+	bing_response_t response;
+	double* times;
+	double start;
+	unsigned int count = TEST_SEARCHES;
+	unsigned int i;
+	int ret = 0;
+
+	if(argc < 2)
+	{
+		printf("Usage: %s <service URL> [searches]\n", argv[0]);
+		return 1;
+	}
+	if(argc > 2)
+	{
+		count = (unsigned int)atoi(argv[2]);
+	}
+
+	bps_initialize();
+
+	bing = bing_create("latency_test");
+	times = (double*)malloc(sizeof(double) * (count > 0 ? count : 1));
+	if(!bing || !times || count == 0 || !bing_set_service_url(argv[1]) || !bing_request_create(BING_SOURCETYPE_WEB, &request))
+	{
+		printf("Setup failed\n");
+		return 1;
+	}
+
+	//The first search also sets up what every search shares (libxml, cURL)
+	bing_response_free(bing_search_sync(bing, TEST_QUERY, request));
+
+	for(i = 0; i < count; i++)
+	{
+		start = test_now();
+		response = bing_search_sync(bing, TEST_QUERY, request);
+		times[i] = test_now() - start;
+		if(!response)
+		{
+			printf("Search %u failed\n", i);
+			ret = 1;
+		}
+		bing_response_free(response);
+	}
+
+	qsort(times, count, sizeof(double), test_compare);
+	printf("%s, %u searches: p50 %.2fms, p99 %.2fms\n",
+#if defined(BING_CURL_POOL_SIZE) && BING_CURL_POOL_SIZE == 0
+			"Without the handle pool",
+#else
+			"With the handle pool",
+#endif
+			count, times[count / 2], times[(count * 99) / 100]);
+
+	bing_request_free(request);
+	bing_free(bing);
+	free(times);
+
+	bps_shutdown();
+
+	return ret;
+}
@@ -0,0 +1,319 @@
+/*
+ * transport_test.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+//Runs searches through the memory transport, so the search paths (synchronous, asynchronous, cancelled, retried, cached, revalidated, refreshed) can be checked without a network or a server.
+//Build it with the library, for example: qcc -I../include ../src/*.c transport_test.c -lxml2 -lcurl -lbps -lm -o transport_test
+//Prints each check, and returns the number of checks that failed.
+
+#include "bing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define TEST_QUERY "transport"
+#define TEST_RESULTS 3
+
+#define TEST_ENTRY "<entry><title type=\"text\">WebResult</title><content type=\"application/xml\"><m:properties>" \
+	"<d:Title m:type=\"Edm.String\">Title</d:Title><d:Description m:type=\"Edm.String\">Description</d:Description>" \
+	"<d:DisplayUrl m:type=\"Edm.String\">example.com</d:DisplayUrl><d:Url m:type=\"Edm.String\">http://example.com/</d:Url>" \
+	"</m:properties></content></entry>"
+
+static const char testFeed[] = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+	"<feed xmlns:d=\"http://schemas.microsoft.com/ado/2007/08/dataservices\" xmlns:m=\"http://schemas.microsoft.com/ado/2007/08/dataservices/metadata\" xmlns=\"http://www.w3.org/2005/Atom\">"
+	"<subtitle type=\"text\">Bing Web Search</subtitle>"
+	TEST_ENTRY TEST_ENTRY TEST_ENTRY
+	"</feed>";
+
+typedef struct TEST_WAIT_S
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int done;
+	int results; //-1 if the search failed
+	unsigned int attempts;
+} test_wait;
+
+static int testFailures = 0;
+
+void test_check(const char* name, int passed)
+{
+	printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+	if(!passed)
+	{
+		testFailures++;
+	}
+}
+
+void test_wait_setup(test_wait* wait)
+{
+	pthread_mutex_init(&wait->mutex, NULL);
+	pthread_cond_init(&wait->cond, NULL);
+	wait->done = 0;
+	wait->results = -1;
+	wait->attempts = 0;
+}
+
+void test_wait_cleanup(test_wait* wait)
+{
+	pthread_cond_destroy(&wait->cond);
+	pthread_mutex_destroy(&wait->mutex);
+}
+
+//Wait for an asynchronous search, returns zero if it didn't complete within timeout (ms)
+int test_wait_done(test_wait* wait, unsigned int timeout)
+{
+	struct timespec until;
+	int done;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += timeout / 1000;
+	until.tv_nsec += (long)(timeout % 1000) * 1000000L;
+	if(until.tv_nsec >= 1000000000L)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&wait->mutex);
+	while(!wait->done && pthread_cond_timedwait(&wait->cond, &wait->mutex, &until) == 0);
+	done = wait->done;
+	pthread_mutex_unlock(&wait->mutex);
+
+	return done;
+}
+
+void test_response(bing_response_t response, const void* user_data)
+{
+	test_wait* wait = (test_wait*)user_data;
+	bing_transfer_stats_s stats;
+
+	pthread_mutex_lock(&wait->mutex);
+
+	if(response)
+	{
+		wait->results = bing_response_get_results(response, NULL);
+		if(bing_response_get_transfer_stats(response, &stats))
+		{
+			wait->attempts = stats.attempts;
+		}
+		bing_response_free(response);
+	}
+	wait->done = 1;
+	pthread_cond_signal(&wait->cond);
+
+	pthread_mutex_unlock(&wait->mutex);
+}
+
+int test_results(bing_response_t response)
+{
+	int ret = response ? bing_response_get_results(response, NULL) : -1;
+	bing_response_free(response);
+	return ret;
+}
+
+void test_sync(unsigned int bing, bing_request_t request, const char* url)
+{
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+
+	test_check("sync search", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+}
+
+void test_async(unsigned int bing, bing_request_t request, const char* url)
+{
+	test_wait wait;
+
+	test_wait_setup(&wait);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+
+	test_check("async search started", bing_search_async(bing, TEST_QUERY, request, &wait, test_response) != 0);
+	test_check("async search", test_wait_done(&wait, 5000) && wait.results == TEST_RESULTS);
+
+	test_wait_cleanup(&wait);
+}
+
+void test_cancel(unsigned int bing, bing_request_t request, const char* url)
+{
+	test_wait wait;
+	int search;
+
+	test_wait_setup(&wait);
+
+	//Fails, so the search waits to be retried until it's cancelled
+	bing_memory_transport_add(url, 503, NULL, 0);
+	bing_set_retry(bing, 2, 10000, 0);
+
+	search = bing_search_async(bing, TEST_QUERY, request, &wait, test_response);
+	usleep(100000);
+	test_check("cancel search", search != 0 && bing_search_cancel(search));
+	test_check("cancelled search can't be cancelled again", !bing_search_cancel(search));
+	usleep(100000);
+	test_check("cancelled search isn't told it completed", !wait.done);
+
+	bing_set_retry(bing, 1, 0, 0);
+	test_wait_cleanup(&wait);
+}
+
+void test_retry(unsigned int bing, bing_request_t request, const char* url)
+{
+	test_wait wait;
+	bing_transfer_stats_s stats;
+	bing_response_t response;
+
+	//Every attempt fails
+	bing_memory_transport_add(url, 503, NULL, 0);
+	bing_set_retry(bing, 3, 1, 1);
+	test_check("retried search that keeps failing", test_results(bing_search_sync(bing, TEST_QUERY, request)) == -1);
+
+	//Not retried
+	bing_memory_transport_add(url, 404, NULL, 0);
+	test_check("search that can't be retried", test_results(bing_search_sync(bing, TEST_QUERY, request)) == -1);
+
+	//The response is there by the time it's retried
+	test_wait_setup(&wait);
+	bing_memory_transport_add(url, 503, NULL, 0);
+	bing_set_retry(bing, 3, 500, 500);
+
+	test_check("retried search started", bing_search_async(bing, TEST_QUERY, request, &wait, test_response) != 0);
+	usleep(100000);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+	test_check("retried search", test_wait_done(&wait, 5000) && wait.results == TEST_RESULTS && wait.attempts == 2);
+
+	test_wait_cleanup(&wait);
+
+	//Only a failed attempt is retried
+	bing_set_retry(bing, 3, 1, 1);
+	response = bing_search_sync(bing, TEST_QUERY, request);
+	test_check("search that succeeds is made once", response && bing_response_get_transfer_stats(response, &stats) && stats.attempts == 1);
+	bing_response_free(response);
+
+	bing_set_retry(bing, 1, 0, 0);
+}
+
+void test_cache(unsigned int bing, bing_request_t request, const char* url)
+{
+	bing_body_cache_stats_s before;
+	bing_body_cache_stats_s after;
+
+	bing_set_body_cache(60, 1000000);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+	bing_get_body_cache_stats(&before);
+
+	test_check("search to cache", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+
+	//Gone from the transport, so it can only come from the cache
+	bing_memory_transport_clear();
+	test_check("cached search", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+
+	bing_get_body_cache_stats(&after);
+	test_check("cache hit counted", after.hits == before.hits + 1 && after.misses == before.misses + 1 && after.hit_bytes == before.hit_bytes + sizeof(testFeed) - 1);
+
+	bing_set_body_cache(0, 0);
+	test_check("search without cache", test_results(bing_search_sync(bing, TEST_QUERY, request)) == -1);
+}
+
+void test_revalidate(unsigned int bing, bing_request_t request, const char* url)
+{
+	test_wait wait;
+	bing_body_cache_stats_s before;
+	bing_body_cache_stats_s after;
+
+	//Cached for a second, then the server is asked if it changed (the memory transport gives a 304 if the response is the same)
+	bing_set_body_cache(1, 1000000);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+	test_check("search to revalidate", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+
+	sleep(2);
+	bing_get_body_cache_stats(&before);
+	test_check("revalidated search", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+	bing_get_body_cache_stats(&after);
+	test_check("revalidation counted", after.revalidations == before.revalidations + 1);
+
+	//The data is evicted while the server is being asked (the first attempt fails, and the cache is emptied before it's retried), so after the 304 the data itself is asked for
+	sleep(2);
+	test_wait_setup(&wait);
+	bing_memory_transport_add(url, 503, NULL, 0);
+	bing_set_retry(bing, 2, 500, 500);
+
+	test_check("evicted search started", bing_search_async(bing, TEST_QUERY, request, &wait, test_response) != 0);
+	usleep(100000);
+	bing_set_body_cache(0, 0);
+	bing_set_body_cache(1, 1000000);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+	test_check("search for evicted data", test_wait_done(&wait, 5000) && wait.results == TEST_RESULTS && wait.attempts == 3);
+
+	test_wait_cleanup(&wait);
+
+	bing_set_retry(bing, 1, 0, 0);
+	bing_set_body_cache(0, 0);
+}
+
+void test_refresh(unsigned int bing, bing_request_t request, const char* url)
+{
+	bing_body_cache_stats_s before;
+	bing_body_cache_stats_s after;
+
+	//Stale after two seconds, so it's used but refreshed in the background. The refresh is given a 304, so the data is only made good for another TTL.
+	//The cache counts whole seconds, so with a one second TTL the refreshed data could already be stale when it's searched for.
+	bing_set_body_cache(60, 1000000);
+	bing_set_body_cache_ttl(BING_SOURCETYPE_WEB, 2, 60);
+	bing_memory_transport_add(url, 200, testFeed, sizeof(testFeed) - 1);
+	test_check("search to refresh", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+
+	sleep(3);
+	bing_get_body_cache_stats(&before);
+	test_check("stale search", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+	usleep(200000);
+	test_check("refreshed search", test_results(bing_search_sync(bing, TEST_QUERY, request)) == TEST_RESULTS);
+	bing_get_body_cache_stats(&after);
+	test_check("refreshed in the background", after.hits == before.hits + 2 && after.stale_hits == before.stale_hits + 1 && after.revalidations == before.revalidations + 1);
+
+	bing_set_body_cache_ttl(BING_SOURCETYPE_WEB, 0, 0);
+	bing_set_body_cache(0, 0);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int bing;
+	bing_request_t request = NULL;
+	const char* url;
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	bps_initialize();
+
+	bing = bing_create("transport_test");
+	if(!bing || !bing_request_create(BING_SOURCETYPE_WEB, &request) || !(url = bing_request_url(TEST_QUERY, request)))
+	{
+		printf("FAIL: setup\n");
+		return 1;
+	}
+
+	bing_set_transport(BING_TRANSPORT_MEMORY, NULL);
+
+	test_sync(bing, request, url);
+	test_async(bing, request, url);
+	test_cancel(bing, request, url);
+	test_retry(bing, request, url);
+	test_cache(bing, request, url);
+	test_revalidate(bing, request, url);
+	test_refresh(bing, request, url);
+
+	bing_set_transport(BING_TRANSPORT_CURL, NULL);
+	bing_memory_transport_clear();
+
+	free((void*)url);
+	bing_request_free(request);
+	bing_free(bing);
+
+	bps_shutdown();
+
+	printf("%d failed\n", testFailures);
+	return testFailures;
+}
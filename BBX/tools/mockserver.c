@@ -0,0 +1,957 @@
+/*
+ * mockserver.c
+ *
+ * This software is distributed under Microsoft Public License (MSPL)
+ * see http://opensource.org/licenses/ms-pl.html
+ *
+ * Author: Vincent Simonetti
+ */
+
+//A local server that acts like the Bing service, so the library can be tested and measured without a network or an account (see bing_set_service_url).
+//It takes the same paths and parameters as the service and makes up the Atom feed of each source type, and of composite searches, honouring $top and $skip and giving next links.
+//It can also act like a slow or overloaded service: latency, a slow body, throttling (429), and errors.
+//Build it on its own, for example: gcc -std=gnu99 mockserver.c -lpthread -o mockserver
+//For HTTPS, define MOCKSERVER_TLS and link OpenSSL: gcc -std=gnu99 -DMOCKSERVER_TLS mockserver.c -lpthread -lssl -lcrypto -o mockserver
+//Then search with bing_set_service_url("http://127.0.0.1:8080/"), run "mockserver -h" for the options.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#if defined(MOCKSERVER_TLS)
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define MOCK_REQUEST_SIZE 16384
+#define MOCK_LINE_SIZE 1024
+#define MOCK_DEFAULT_PORT 8080
+#define MOCK_DEFAULT_RESULTS 100
+#define MOCK_DEFAULT_TOP 50
+#define MOCK_BODY_CHUNKS 10
+
+#define MOCK_FEED_START "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+	"<feed xmlns:d=\"http://schemas.microsoft.com/ado/2007/08/dataservices\" xmlns:m=\"http://schemas.microsoft.com/ado/2007/08/dataservices/metadata\" xmlns=\"http://www.w3.org/2005/Atom\">"
+#define MOCK_RELATED "http://schemas.microsoft.com/ado/2007/08/dataservices/related/"
+
+typedef struct MOCK_OPTIONS_S
+{
+	const char* address;
+	int port;
+	unsigned int latency; //Before the response (ms)
+	unsigned int latencyJitter; //Random extra latency, up to this (ms)
+	unsigned int bodyTime; //Time the body takes to be written (ms)
+	unsigned int throttleRate; //Requests a second before 429 is given, zero to never throttle
+	double errorRate; //Fraction of requests that get errorStatus
+	int errorStatus;
+	unsigned int results; //Results each source type has
+	int verbose;
+	const char* cert;
+	const char* key;
+} mock_options;
+
+typedef struct MOCK_BUFFER_S
+{
+	char* data;
+	size_t size;
+	size_t alloc;
+} mock_buffer;
+
+typedef struct MOCK_CONNECTION_S
+{
+	int fd;
+#if defined(MOCKSERVER_TLS)
+	SSL* ssl;
+#endif
+} mock_connection;
+
+typedef struct MOCK_REQUEST_S
+{
+	char method[16];
+	char target[MOCK_REQUEST_SIZE];
+	char host[MOCK_LINE_SIZE];
+	char ifNoneMatch[MOCK_LINE_SIZE];
+	char ifModifiedSince[MOCK_LINE_SIZE];
+	int keepAlive;
+} mock_request;
+
+//The source types, by the name of their path, their name in a composite search, the subtitle of their feed, and the title of their entries
+typedef struct MOCK_SOURCE_S
+{
+	const char* path;
+	const char* composite;
+	const char* subtitle;
+	const char* entry;
+	void (*properties)(mock_buffer* buffer, const char* query, unsigned int index);
+} mock_source;
+
+static mock_options options;
+static pthread_mutex_t mockMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int mockRandom = 0;
+static double mockThrottleTokens = 0.0;
+static unsigned long long mockThrottleUpdated = 0;
+static char mockLastModified[64];
+
+#if defined(MOCKSERVER_TLS)
+static SSL_CTX* mockTls = NULL;
+#endif
+
+//Buffer
+
+int buffer_append(mock_buffer* buffer, const char* format, ...)
+{
+	va_list args;
+	int size;
+	char* data;
+
+	va_start(args, format);
+	size = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if(size < 0)
+	{
+		return FALSE;
+	}
+
+	if(buffer->size + size + 1 > buffer->alloc)
+	{
+		data = (char*)realloc(buffer->data, (buffer->size + size + 1) * 2);
+		if(!data)
+		{
+			return FALSE;
+		}
+		buffer->data = data;
+		buffer->alloc = (buffer->size + size + 1) * 2;
+	}
+
+	va_start(args, format);
+	vsnprintf(buffer->data + buffer->size, size + 1, format, args);
+	va_end(args);
+	buffer->size += size;
+
+	return TRUE;
+}
+
+//Append text (of size characters), escaped for XML
+void buffer_append_xml(mock_buffer* buffer, const char* text, size_t size)
+{
+	for(; size > 0; text++, size--)
+	{
+		switch(*text)
+		{
+			case '&':	buffer_append(buffer, "&amp;");		break;
+			case '<':	buffer_append(buffer, "&lt;");		break;
+			case '>':	buffer_append(buffer, "&gt;");		break;
+			case '"':	buffer_append(buffer, "&quot;");	break;
+			case '\'':	buffer_append(buffer, "&apos;");	break;
+			default:	buffer_append(buffer, "%c", *text);	break;
+		}
+	}
+}
+
+//Time and faults
+
+unsigned long long mock_time()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((unsigned long long)now.tv_sec * 1000ULL) + ((unsigned long long)now.tv_nsec / 1000000ULL);
+}
+
+void mock_sleep(unsigned int ms)
+{
+	if(ms > 0)
+	{
+		usleep((useconds_t)ms * 1000);
+	}
+}
+
+//Must be called with the mock mutex locked. Returns a number from 0 up to (not including) 1, the same numbers in the same order for the same seed.
+double mock_random()
+{
+	mockRandom = (mockRandom * 1103515245U) + 12345U;
+	return (double)((mockRandom >> 16) & 0x7FFF) / 32768.0;
+}
+
+//Returns the status to give a request instead of it's response, zero if the request gets it's response. Latency is how long to wait before responding.
+int mock_fault(unsigned int* latency)
+{
+	unsigned long long now;
+	int status = 0;
+
+	pthread_mutex_lock(&mockMutex);
+
+	*latency = options.latency;
+	if(options.latencyJitter > 0)
+	{
+		*latency += (unsigned int)(mock_random() * (double)(options.latencyJitter + 1));
+	}
+
+	if(options.throttleRate > 0)
+	{
+		//Token bucket, holding at most a second of requests
+		now = mock_time();
+		mockThrottleTokens += ((double)(now - mockThrottleUpdated) * options.throttleRate) / 1000.0;
+		if(mockThrottleTokens > (double)options.throttleRate)
+		{
+			mockThrottleTokens = (double)options.throttleRate;
+		}
+		mockThrottleUpdated = now;
+
+		if(mockThrottleTokens < 1.0)
+		{
+			//Too many requests
+			status = 429;
+		}
+		else
+		{
+			mockThrottleTokens -= 1.0;
+		}
+	}
+
+	if(status == 0 && options.errorRate > 0.0 && mock_random() < options.errorRate)
+	{
+		status = options.errorStatus;
+	}
+
+	pthread_mutex_unlock(&mockMutex);
+
+	return status;
+}
+
+//Connection
+
+int connection_read(mock_connection* connection, char* data, size_t size)
+{
+#if defined(MOCKSERVER_TLS)
+	if(connection->ssl)
+	{
+		return SSL_read(connection->ssl, data, (int)size);
+	}
+#endif
+	return (int)recv(connection->fd, data, size, 0);
+}
+
+int connection_write(mock_connection* connection, const char* data, size_t size)
+{
+	int written;
+
+	while(size > 0)
+	{
+#if defined(MOCKSERVER_TLS)
+		if(connection->ssl)
+		{
+			written = SSL_write(connection->ssl, data, (int)size);
+		}
+		else
+#endif
+		{
+			written = (int)send(connection->fd, data, size, MSG_NOSIGNAL);
+		}
+		if(written <= 0)
+		{
+			return FALSE;
+		}
+		data += written;
+		size -= written;
+	}
+	return TRUE;
+}
+
+//Request
+
+//Copy the value of a header, if the line is that header
+void request_header(const char* line, const char* name, char* value, size_t size)
+{
+	size_t nameSize = strlen(name);
+
+	if(strncasecmp(line, name, nameSize) == 0 && line[nameSize] == ':')
+	{
+		for(line += nameSize + 1; *line == ' ' || *line == '\t'; line++);
+		snprintf(value, size, "%s", line);
+	}
+}
+
+//Read a request (up to the end of it's headers, requests have no body). Extra holds anything read past the request, and is used for the next request on the connection.
+int request_read(mock_connection* connection, mock_request* request, char* extra, size_t* extraSize)
+{
+	char data[MOCK_REQUEST_SIZE];
+	size_t size = *extraSize;
+	char* end;
+	char* line;
+	char* next;
+	char version[16];
+	char connectionHeader[MOCK_LINE_SIZE];
+	int got;
+
+	memcpy(data, extra, size);
+	data[size] = '\0';
+	while(!(end = strstr(data, "\r\n\r\n")))
+	{
+		if(size >= sizeof(data) - 1 || (got = connection_read(connection, data + size, sizeof(data) - 1 - size)) <= 0)
+		{
+			return FALSE;
+		}
+		size += got;
+		data[size] = '\0';
+	}
+
+	//Keep what's after the request
+	end += 4;
+	*extraSize = size - (end - data);
+	memcpy(extra, end, *extraSize);
+	end[-2] = '\0';
+
+	memset(request, 0, sizeof(mock_request));
+	connectionHeader[0] = '\0';
+	version[0] = '\0';
+
+	//Request line
+	next = strstr(data, "\r\n");
+	*next = '\0';
+	if(sscanf(data, "%15s %16383s %15s", request->method, request->target, version) != 3)
+	{
+		return FALSE;
+	}
+
+	//Headers
+	for(line = next + 2; *line; line = next + 2)
+	{
+		next = strstr(line, "\r\n");
+		*next = '\0';
+		request_header(line, "Host", request->host, sizeof(request->host));
+		request_header(line, "If-None-Match", request->ifNoneMatch, sizeof(request->ifNoneMatch));
+		request_header(line, "If-Modified-Since", request->ifModifiedSince, sizeof(request->ifModifiedSince));
+		request_header(line, "Connection", connectionHeader, sizeof(connectionHeader));
+	}
+
+	request->keepAlive = strcmp(version, "HTTP/1.1") == 0 ? strcasecmp(connectionHeader, "close") != 0 : strcasecmp(connectionHeader, "keep-alive") == 0;
+	if(request->host[0] == '\0')
+	{
+		snprintf(request->host, sizeof(request->host), "127.0.0.1:%d", options.port);
+	}
+
+	return TRUE;
+}
+
+//Decode a URL encoded string, in place
+void url_decode(char* text)
+{
+	char* out = text;
+	unsigned int value;
+
+	for(; *text; text++, out++)
+	{
+		if(*text == '%' && isxdigit((unsigned char)text[1]) && isxdigit((unsigned char)text[2]) && sscanf(text + 1, "%2x", &value) == 1)
+		{
+			*out = (char)value;
+			text += 2;
+		}
+		else if(*text == '+')
+		{
+			*out = ' ';
+		}
+		else
+		{
+			*out = *text;
+		}
+	}
+	*out = '\0';
+}
+
+//Compare the (URL encoded) name of a parameter to a name
+int param_is(const char* param, size_t size, const char* name)
+{
+	char decoded[MOCK_LINE_SIZE];
+
+	if(size >= sizeof(decoded))
+	{
+		return FALSE;
+	}
+	memcpy(decoded, param, size);
+	decoded[size] = '\0';
+	url_decode(decoded);
+	return strcmp(decoded, name) == 0;
+}
+
+//Get the decoded value of a parameter from the query string. Returns FALSE if the query doesn't have it.
+int param_get(const char* query, const char* name, char* value, size_t size)
+{
+	const char* param;
+	const char* equals;
+	size_t paramSize;
+
+	for(param = query; param && *param; param = strchr(param, '&') ? strchr(param, '&') + 1 : NULL)
+	{
+		paramSize = strcspn(param, "&");
+		equals = memchr(param, '=', paramSize);
+		if(equals && param_is(param, equals - param, name))
+		{
+			snprintf(value, size, "%.*s", (int)(paramSize - (equals + 1 - param)), equals + 1);
+			url_decode(value);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+unsigned int param_get_uint(const char* query, const char* name, unsigned int def)
+{
+	char value[32];
+	return param_get(query, name, value, sizeof(value)) ? (unsigned int)strtoul(value, NULL, 10) : def;
+}
+
+//Append the URL of another page of results: the same parameters, except $skip and $top (and Sources, for a single source type)
+void buffer_append_page(mock_buffer* buffer, const char* base, const char* path, const char* query, int keepSources, unsigned int skip, unsigned int top)
+{
+	const char* param;
+	const char* equals;
+	size_t paramSize;
+
+	buffer_append(buffer, "%s%s?", base, path);
+	for(param = query; param && *param; param = strchr(param, '&') ? strchr(param, '&') + 1 : NULL)
+	{
+		paramSize = strcspn(param, "&");
+		equals = memchr(param, '=', paramSize);
+		if(paramSize > 0 && !(equals && (param_is(param, equals - param, "$skip") || param_is(param, equals - param, "$top") ||
+				(!keepSources && param_is(param, equals - param, "Sources")))))
+		{
+			buffer_append_xml(buffer, param, paramSize);
+			buffer_append(buffer, "&amp;");
+		}
+	}
+	buffer_append(buffer, "$skip=%u&amp;$top=%u", skip, top);
+}
+
+//Results
+
+unsigned int mock_hash(const char* text)
+{
+	unsigned int hash = 5381;
+	while(*text)
+	{
+		hash = ((hash << 5) + hash) + (unsigned char)*(text++);
+	}
+	return hash;
+}
+
+void properties_id(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	buffer_append(buffer, "<d:ID m:type=\"Edm.Guid\">%08x-0000-4000-8000-%012x</d:ID>", mock_hash(query), index);
+}
+
+void properties_title(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	buffer_append(buffer, "<d:Title m:type=\"Edm.String\">");
+	buffer_append_xml(buffer, query, strlen(query));
+	buffer_append(buffer, " %u</d:Title>", index + 1);
+}
+
+void properties_thumbnail(mock_buffer* buffer, unsigned int index)
+{
+	buffer_append(buffer, "<d:Thumbnail m:type=\"Bing.Thumbnail\"><d:MediaUrl m:type=\"Edm.String\">http://ts.example.com/th?id=%u</d:MediaUrl>"
+			"<d:ContentType m:type=\"Edm.String\">image/jpg</d:ContentType><d:Width m:type=\"Edm.Int32\">160</d:Width><d:Height m:type=\"Edm.Int32\">120</d:Height>"
+			"<d:FileSize m:type=\"Edm.Int64\">%u</d:FileSize></d:Thumbnail>", index, 4000 + index);
+}
+
+void properties_web(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	properties_title(buffer, query, index);
+	buffer_append(buffer, "<d:Description m:type=\"Edm.String\">Result %u of the search for ", index + 1);
+	buffer_append_xml(buffer, query, strlen(query));
+	buffer_append(buffer, ", made up by the mock server.</d:Description><d:DisplayUrl m:type=\"Edm.String\">www.example.com/%u</d:DisplayUrl>"
+			"<d:Url m:type=\"Edm.String\">http://www.example.com/%u</d:Url>", index, index);
+}
+
+void properties_image(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	properties_title(buffer, query, index);
+	buffer_append(buffer, "<d:MediaUrl m:type=\"Edm.String\">http://www.example.com/images/%u.jpg</d:MediaUrl><d:SourceUrl m:type=\"Edm.String\">http://www.example.com/%u</d:SourceUrl>"
+			"<d:DisplayUrl m:type=\"Edm.String\">www.example.com/%u</d:DisplayUrl><d:Width m:type=\"Edm.Int32\">640</d:Width><d:Height m:type=\"Edm.Int32\">480</d:Height>"
+			"<d:FileSize m:type=\"Edm.Int64\">%u</d:FileSize><d:ContentType m:type=\"Edm.String\">image/jpeg</d:ContentType>", index, index, index, 40000 + index);
+	properties_thumbnail(buffer, index);
+}
+
+void properties_video(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	properties_title(buffer, query, index);
+	buffer_append(buffer, "<d:MediaUrl m:type=\"Edm.String\">http://www.example.com/videos/%u</d:MediaUrl><d:DisplayUrl m:type=\"Edm.String\">www.example.com/videos/%u</d:DisplayUrl>"
+			"<d:RunTime m:type=\"Edm.Int32\">%u</d:RunTime>", index, index, 60000 + (index * 1000));
+	properties_thumbnail(buffer, index);
+}
+
+void properties_news(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	properties_title(buffer, query, index);
+	buffer_append(buffer, "<d:Url m:type=\"Edm.String\">http://news.example.com/%u</d:Url><d:Source m:type=\"Edm.String\">Example News</d:Source>"
+			"<d:Description m:type=\"Edm.String\">Story %u about ", index, index + 1);
+	buffer_append_xml(buffer, query, strlen(query));
+	buffer_append(buffer, ".</d:Description><d:Date m:type=\"Edm.DateTime\">2012-05-%02uT12:00:00Z</d:Date>", (index % 28) + 1);
+}
+
+void properties_related(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	properties_title(buffer, query, index);
+	buffer_append(buffer, "<d:BingUrl m:type=\"Edm.String\">http://www.bing.com/search?q=related+%u</d:BingUrl>", index);
+}
+
+void properties_spell(mock_buffer* buffer, const char* query, unsigned int index)
+{
+	properties_id(buffer, query, index);
+	buffer_append(buffer, "<d:Value m:type=\"Edm.String\">");
+	buffer_append_xml(buffer, query, strlen(query));
+	buffer_append(buffer, " %u</d:Value>", index + 1);
+}
+
+static const mock_source mock_sources[] =
+{
+		{"Web",					"web",				"Bing Web Search",		"WebResult",			properties_web},
+		{"Image",				"image",			"Bing Image Search",	"ImageResult",			properties_image},
+		{"Video",				"video",			"Bing Video Search",	"VideoResult",			properties_video},
+		{"News",				"news",				"Bing News Search",		"NewsResult",			properties_news},
+		{"RelatedSearch",		"relatedsearch",	"Bing Related Search",	"RelatedSearchResult",	properties_related},
+		{"SpellingSuggestions",	"spell",			"Bing Spell Search",	"SpellResult",			properties_spell},
+		{NULL,					NULL,				NULL,					NULL,					NULL}
+};
+
+const mock_source* source_find(const char* name, size_t size, int composite)
+{
+	const mock_source* source;
+	for(source = mock_sources; source->path; source++)
+	{
+		if(strlen(composite ? source->composite : source->path) == size && strncasecmp(composite ? source->composite : source->path, name, size) == 0)
+		{
+			return source;
+		}
+	}
+	return NULL;
+}
+
+//Feeds
+
+//Append the entries of a page of results
+void feed_entries(mock_buffer* buffer, const mock_source* source, const char* query, unsigned int skip, unsigned int top)
+{
+	unsigned int i;
+
+	for(i = skip; i < options.results && i - skip < top; i++)
+	{
+		buffer_append(buffer, "<entry><title type=\"text\">%s</title><content type=\"application/xml\"><m:properties>", source->entry);
+		source->properties(buffer, query, i);
+		buffer_append(buffer, "</m:properties></content></entry>");
+	}
+}
+
+//Append the next link of a page of results, if there are more results
+void feed_next(mock_buffer* buffer, const char* base, const char* path, const char* params, int keepSources, unsigned int skip, unsigned int top)
+{
+	if(top > 0 && skip + top < options.results)
+	{
+		buffer_append(buffer, "<link rel=\"next\" href=\"");
+		buffer_append_page(buffer, base, path, params, keepSources, skip + top, top);
+		buffer_append(buffer, "\"/>");
+	}
+}
+
+void feed_source(mock_buffer* buffer, const char* base, const mock_request* request, const mock_source* source, const char* params, const char* query, unsigned int skip, unsigned int top)
+{
+	buffer_append(buffer, MOCK_FEED_START "<title type=\"text\">%s</title><subtitle type=\"text\">%s</subtitle><link rel=\"self\" href=\"%s", source->path, source->subtitle, base);
+	buffer_append_xml(buffer, request->target + 1, strlen(request->target + 1));
+	buffer_append(buffer, "\"/>");
+	feed_next(buffer, base, source->path, params, FALSE, skip, top);
+	feed_entries(buffer, source, query, skip, top);
+	buffer_append(buffer, "</feed>");
+}
+
+//Composite searches have one entry, holding the feed of each source type that was asked for. Returns FALSE if a source type isn't known.
+int feed_composite(mock_buffer* buffer, const char* base, const mock_request* request, const char* params, const char* query, unsigned int skip, unsigned int top)
+{
+	char sources[MOCK_LINE_SIZE];
+	const char* name;
+	const mock_source* source;
+	size_t size;
+
+	//Sources='web+image', the quotes are optional
+	if(!param_get(params, "Sources", sources, sizeof(sources)))
+	{
+		return FALSE;
+	}
+
+	buffer_append(buffer, MOCK_FEED_START "<title type=\"text\">Composite</title><subtitle type=\"text\">Bing Search API</subtitle><link rel=\"self\" href=\"%s", base);
+	buffer_append_xml(buffer, request->target + 1, strlen(request->target + 1));
+	buffer_append(buffer, "\"/><entry><title type=\"text\">ExpandableSearchResult</title>");
+
+	for(name = sources; *name; name += size)
+	{
+		name += strspn(name, "'+ ");
+		size = strcspn(name, "'+ ");
+		if(size == 0)
+		{
+			continue;
+		}
+		if(!(source = source_find(name, size, TRUE)))
+		{
+			return FALSE;
+		}
+
+		buffer_append(buffer, "<link rel=\"" MOCK_RELATED "%s\" type=\"application/atom+xml;type=feed\" title=\"%s\" href=\"%s", source->path, source->path, base);
+		buffer_append_xml(buffer, request->target + 1, strlen(request->target + 1));
+		buffer_append(buffer, "\"><m:inline><feed><title type=\"text\">%s</title>", source->path);
+		feed_next(buffer, base, source->path, params, FALSE, skip, top);
+		feed_entries(buffer, source, query, skip, top);
+		buffer_append(buffer, "</feed></m:inline></link>");
+	}
+
+	buffer_append(buffer, "</entry></feed>");
+	return TRUE;
+}
+
+//Response
+
+const char* response_reason(int status)
+{
+	switch(status)
+	{
+		case 200:	return "OK";
+		case 304:	return "Not Modified";
+		case 400:	return "Bad Request";
+		case 404:	return "Not Found";
+		case 405:	return "Method Not Allowed";
+		case 429:	return "Too Many Requests";
+		case 500:	return "Internal Server Error";
+		case 503:	return "Service Unavailable";
+		default:	return "Error";
+	}
+}
+
+//Make the feed for a request. Returns the status of the response.
+int response_feed(mock_buffer* body, const mock_request* request, int tls)
+{
+	char base[MOCK_LINE_SIZE * 2 + 16];
+	char path[MOCK_LINE_SIZE];
+	char query[MOCK_LINE_SIZE];
+	const char* params;
+	const char* name;
+	const mock_source* source;
+	unsigned int skip;
+	unsigned int top;
+	size_t size;
+
+	//The source type is the last part of the path
+	params = strchr(request->target, '?');
+	size = params ? (size_t)(params - request->target) : strlen(request->target);
+	params = params ? params + 1 : "";
+	if(size >= sizeof(path))
+	{
+		return 404;
+	}
+	memcpy(path, request->target, size);
+	path[size] = '\0';
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	//Query='text', the quotes are optional
+	if(!param_get(params, "Query", query, sizeof(query)))
+	{
+		return 400;
+	}
+	size = strlen(query);
+	if(size >= 2 && query[0] == '\'' && query[size - 1] == '\'')
+	{
+		memmove(query, query + 1, size - 2);
+		query[size - 2] = '\0';
+	}
+
+	skip = param_get_uint(params, "$skip", 0);
+	top = param_get_uint(params, "$top", MOCK_DEFAULT_TOP);
+
+	//Other pages go to the same path
+	snprintf(base, sizeof(base), "%s://%s%.*s", tls ? "https" : "http", request->host, (int)(name - path), path);
+
+	if(strcmp(name, "Composite") == 0)
+	{
+		return feed_composite(body, base, request, params, query, skip, top) ? 200 : 400;
+	}
+	if((source = source_find(name, strlen(name), FALSE)))
+	{
+		feed_source(body, base, request, source, params, query, skip, top);
+		return 200;
+	}
+	return 404;
+}
+
+//Respond to a request. Returns FALSE if the connection should be closed.
+int response_send(mock_connection* connection, const mock_request* request, int tls)
+{
+	mock_buffer body = {NULL, 0, 0};
+	mock_buffer head = {NULL, 0, 0};
+	char etag[32];
+	unsigned int latency;
+	unsigned int i;
+	size_t chunk;
+	int status;
+	int ret;
+
+	status = mock_fault(&latency);
+	mock_sleep(latency);
+
+	snprintf(etag, sizeof(etag), "\"%08x\"", mock_hash(request->target));
+	if(status == 0)
+	{
+		if(strcmp(request->method, "GET") != 0)
+		{
+			status = 405;
+		}
+		else if((request->ifNoneMatch[0] && strcmp(request->ifNoneMatch, etag) == 0) ||
+				(!request->ifNoneMatch[0] && request->ifModifiedSince[0] && strcmp(request->ifModifiedSince, mockLastModified) == 0))
+		{
+			//Feeds don't change, so a validator of the feed always matches
+			status = 304;
+		}
+		else
+		{
+			status = response_feed(&body, request, tls);
+		}
+	}
+	if(status != 200)
+	{
+		body.size = 0;
+	}
+
+	buffer_append(&head, "HTTP/1.1 %d %s\r\nContent-Length: %u\r\nConnection: %s\r\n", status, response_reason(status), (unsigned int)body.size, request->keepAlive ? "keep-alive" : "close");
+	if(status == 200 || status == 304)
+	{
+		buffer_append(&head, "ETag: %s\r\nLast-Modified: %s\r\nCache-Control: private\r\n", etag, mockLastModified);
+	}
+	if(status == 200)
+	{
+		buffer_append(&head, "Content-Type: application/atom+xml; charset=utf-8\r\n");
+	}
+	if(status == 429 || status == 503)
+	{
+		buffer_append(&head, "Retry-After: 1\r\n");
+	}
+	buffer_append(&head, "\r\n");
+
+	if(options.verbose)
+	{
+		printf("%d %s\n", status, request->target);
+		fflush(stdout);
+	}
+
+	ret = head.data && connection_write(connection, head.data, head.size);
+	if(ret && body.size > 0)
+	{
+		if(options.bodyTime > 0)
+		{
+			//A slow body, written a chunk at a time over the body time
+			chunk = (body.size + MOCK_BODY_CHUNKS - 1) / MOCK_BODY_CHUNKS;
+			for(i = 0; ret && i * chunk < body.size; i++)
+			{
+				mock_sleep(options.bodyTime / MOCK_BODY_CHUNKS);
+				ret = connection_write(connection, body.data + (i * chunk), (i + 1) * chunk < body.size ? chunk : body.size - (i * chunk));
+			}
+		}
+		else
+		{
+			ret = connection_write(connection, body.data, body.size);
+		}
+	}
+
+	free(head.data);
+	free(body.data);
+
+	return ret && request->keepAlive;
+}
+
+//Server
+
+void* connection_run(void* data)
+{
+	mock_connection connection;
+	mock_request* request;
+	char* extra;
+	size_t extraSize = 0;
+	int tls = FALSE;
+
+	connection.fd = (int)(long)data;
+#if defined(MOCKSERVER_TLS)
+	connection.ssl = NULL;
+	if(mockTls)
+	{
+		tls = TRUE;
+		connection.ssl = SSL_new(mockTls);
+		if(!connection.ssl || !SSL_set_fd(connection.ssl, connection.fd) || SSL_accept(connection.ssl) <= 0)
+		{
+			SSL_free(connection.ssl);
+			close(connection.fd);
+			return NULL;
+		}
+	}
+#endif
+
+	request = (mock_request*)malloc(sizeof(mock_request));
+	extra = (char*)malloc(MOCK_REQUEST_SIZE);
+	if(request && extra)
+	{
+		while(request_read(&connection, request, extra, &extraSize) && response_send(&connection, request, tls));
+	}
+	free(extra);
+	free(request);
+
+#if defined(MOCKSERVER_TLS)
+	if(connection.ssl)
+	{
+		SSL_shutdown(connection.ssl);
+		SSL_free(connection.ssl);
+	}
+#endif
+	close(connection.fd);
+	return NULL;
+}
+
+void usage(const char* name)
+{
+	printf("Usage: %s [options]\n"
+			"  -a address   Address to listen on (default 127.0.0.1)\n"
+			"  -p port      Port to listen on (default %d)\n"
+			"  -n results   Results each source type has (default %d)\n"
+			"  -l ms        Latency before each response\n"
+			"  -j ms        Random extra latency, up to this\n"
+			"  -b ms        Time each body takes to be written\n"
+			"  -t rate      Requests a second before 429 is given\n"
+			"  -e fraction  Fraction of requests that get an error\n"
+			"  -E status    Status of the errors (default 500)\n"
+			"  -r seed      Seed of the latency jitter and errors\n"
+#if defined(MOCKSERVER_TLS)
+			"  -c file      Certificate (PEM), serves HTTPS with -k\n"
+			"  -k file      Private key (PEM)\n"
+#endif
+			"  -v           Print each request\n", name, MOCK_DEFAULT_PORT, MOCK_DEFAULT_RESULTS);
+}
+
+int main(int argc, char** argv)
+{
+	struct sockaddr_in address;
+	pthread_attr_t attr;
+	pthread_t thread;
+	time_t now;
+	int server;
+	int client;
+	int opt;
+	int on = 1;
+
+	memset(&options, 0, sizeof(mock_options));
+	options.address = "127.0.0.1";
+	options.port = MOCK_DEFAULT_PORT;
+	options.results = MOCK_DEFAULT_RESULTS;
+	options.errorStatus = 500;
+
+	while((opt = getopt(argc, argv, "a:p:n:l:j:b:t:e:E:r:c:k:vh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'a':	options.address = optarg;									break;
+			case 'p':	options.port = atoi(optarg);								break;
+			case 'n':	options.results = (unsigned int)strtoul(optarg, NULL, 10);	break;
+			case 'l':	options.latency = (unsigned int)strtoul(optarg, NULL, 10);	break;
+			case 'j':	options.latencyJitter = (unsigned int)strtoul(optarg, NULL, 10);	break;
+			case 'b':	options.bodyTime = (unsigned int)strtoul(optarg, NULL, 10);	break;
+			case 't':	options.throttleRate = (unsigned int)strtoul(optarg, NULL, 10);	break;
+			case 'e':	options.errorRate = atof(optarg);							break;
+			case 'E':	options.errorStatus = atoi(optarg);							break;
+			case 'r':	mockRandom = (unsigned int)strtoul(optarg, NULL, 10);		break;
+			case 'c':	options.cert = optarg;										break;
+			case 'k':	options.key = optarg;										break;
+			case 'v':	options.verbose = TRUE;										break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+	if(options.errorRate < 0.0 || options.errorRate > 1.0 || options.port <= 0 || options.port > 65535)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(options.cert || options.key)
+	{
+#if defined(MOCKSERVER_TLS)
+		SSL_library_init();
+		SSL_load_error_strings();
+		mockTls = SSL_CTX_new(SSLv23_server_method());
+		if(!mockTls || !options.cert || !options.key ||
+				SSL_CTX_use_certificate_chain_file(mockTls, options.cert) != 1 || SSL_CTX_use_PrivateKey_file(mockTls, options.key, SSL_FILETYPE_PEM) != 1)
+		{
+			ERR_print_errors_fp(stderr);
+			fprintf(stderr, "Could not load the certificate and key\n");
+			return 1;
+		}
+#else
+		fprintf(stderr, "Built without MOCKSERVER_TLS, so HTTPS can't be served\n");
+		return 1;
+#endif
+	}
+
+	//Feeds never change, so they were last modified when the server started
+	now = time(NULL);
+	strftime(mockLastModified, sizeof(mockLastModified), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
+	mockThrottleTokens = (double)options.throttleRate;
+	mockThrottleUpdated = mock_time();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)options.port);
+	if((server = socket(AF_INET, SOCK_STREAM, 0)) < 0 || inet_pton(AF_INET, options.address, &address.sin_addr) != 1 ||
+			setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+			bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, 128) != 0)
+	{
+		perror("Could not listen");
+		return 1;
+	}
+	printf("Listening on %s://%s:%d/\n", options.cert ? "https" : "http", options.address, options.port);
+	fflush(stdout);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	//A thread for each connection
+	for(;;)
+	{
+		if((client = accept(server, NULL, NULL)) < 0)
+		{
+			continue;
+		}
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if(pthread_create(&thread, &attr, connection_run, (void*)(long)client) != 0)
+		{
+			close(client);
+		}
+	}
+
+	return 0;
+}